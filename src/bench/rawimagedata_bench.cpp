@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include "rawimagedata/cameras/nikon_raw.h"
+#include "rawimagedata/image_writer.h"
+#include "rawimagedata/cpu_dispatch.h"
+#include "synthetic_raw.h"
+
+/*
+ * rawimagedata_bench [--output FILE] [--repeats N] [--filter TEXT] [--size WxH] [--threads N] [--corpus DIR]
+ *
+ * Times the byte readers, IFD walk, JPEG header parse and every decode
+ * stage on a deterministic synthetic corpus and prints JSON results.
+ * --corpus writes the corpus files to DIR instead of running.
+ */
+
+struct bench_options_t {
+  u_int repeats = 5;
+  u_int width = 1536, height = 1024;
+  std::string filter;
+  const char* output = nullptr;
+  const char* corpus_dir = nullptr;
+  int threads = -1;           // -1: shared pool, 0: calling thread
+  bool help = false;
+};
+
+struct bench_input_t {
+  std::string name;
+  synthetic_raw_options_t options;
+  std::vector<u_char> data;
+};
+
+struct bench_result_t {
+  std::string name;
+  std::string input;
+  bool ok = true;
+  u_int64_t ops = 1;          // Operations per timed run
+  u_int64_t items = 0;        // Pixels or bytes per operation
+  const char* unit = "";
+  std::vector<double> times;  // Nanoseconds per operation, one per run
+};
+
+typedef std::function<bool()> bench_fn_t;
+
+class BenchRunner {
+
+public:
+  BenchRunner(const bench_options_t& options) : options(options) {}
+
+  /* setup runs untimed before every run, body is timed and repeated ops times */
+  void run(const std::string& name, const std::string& input, u_int64_t ops, u_int64_t items, const char* unit,
+           const bench_fn_t& setup, const bench_fn_t& body) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+      return;
+    }
+    bench_result_t result;
+    result.name = name;
+    result.input = input;
+    result.ops = ops;
+    result.items = items;
+    result.unit = unit;
+
+    // One warm-up run fills the buffer pool and caches
+    for (u_int run = 0; run <= options.repeats && result.ok; ++run) {
+      if (setup && !setup()) {
+        result.ok = false;
+        break;
+      }
+      auto start = std::chrono::steady_clock::now();
+      for (u_int64_t i = 0; i < ops && result.ok; ++i) {
+        result.ok = body();
+      }
+      auto end = std::chrono::steady_clock::now();
+      if (run > 0) {
+        result.times.push_back(std::chrono::duration<double, std::nano>(end - start).count() / ops);
+      }
+    }
+
+    std::vector<double> sorted = result.times;
+    std::sort(sorted.begin(), sorted.end());
+    fprintf(stderr, "%-24s %-24s %12.0f ns%s\n", name.c_str(), input.c_str(),
+            sorted.empty() ? 0 : sorted[sorted.size() / 2], result.ok ? "" : "  FAILED");
+    results.push_back(result);
+  }
+
+  const std::vector<bench_result_t>& get_results() const { return results; }
+
+private:
+  const bench_options_t& options;
+  std::vector<bench_result_t> results;
+
+};
+
+static bool parse_args(int argc, char** argv, bench_options_t* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      options->help = true;
+      return true;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "ERROR: Missing value for %s\n", arg.c_str());
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--output") {
+      options->output = value;
+    } else if (arg == "--repeats") {
+      options->repeats = std::max(1, atoi(value));
+    } else if (arg == "--filter") {
+      options->filter = value;
+    } else if (arg == "--size") {
+      if (sscanf(value, "%ux%u", &options->width, &options->height) != 2 || options->width < 16 || options->height < 16) {
+        fprintf(stderr, "ERROR: Invalid size: %s\n", value);
+        return false;
+      }
+    } else if (arg == "--threads") {
+      options->threads = atoi(value);
+    } else if (arg == "--corpus") {
+      options->corpus_dir = value;
+    } else {
+      fprintf(stderr, "ERROR: Unknown option: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::vector<bench_input_t> make_corpus(const bench_options_t& options) {
+  std::vector<bench_input_t> corpus(4);
+
+  // NEF as most cameras write it: big-endian, 16 bit containers, preview JPEG
+  corpus[0].name = "nef_mm_14bit";
+  corpus[0].options.extra_tags = 8;
+  // Packed rows in many strips
+  corpus[1].name = "nef_mm_14bit_packed";
+  corpus[1].options.packed = true;
+  corpus[1].options.strips = 16;
+  corpus[1].options.extra_tags = 8;
+  // Little-endian 12 bit
+  corpus[2].name = "tiff_ii_12bit";
+  corpus[2].options.big_endian = false;
+  corpus[2].options.bps = 12;
+  corpus[2].options.strips = 4;
+  // Metadata heavy: full IFD chain, many tags, small payload
+  corpus[3].name = "tiff_ii_many_tags";
+  corpus[3].options.big_endian = false;
+  corpus[3].options.width = 256;
+  corpus[3].options.height = 256;
+  corpus[3].options.extra_ifds = SYNTHETIC_MAX_EXTRA_IFDS;
+  corpus[3].options.extra_tags = 96;
+  corpus[3].options.makernote_tags = 64;
+  corpus[3].options.jpeg_width = 160;
+  corpus[3].options.jpeg_height = 120;
+
+  for (u_int i = 0; i < corpus.size(); ++i) {
+    if (i < 3) {
+      corpus[i].options.width = options.width;
+      corpus[i].options.height = options.height;
+    }
+    if (i == 0) {
+      // Preview smaller than the raw frame, so the raw IFD stays the main one
+      corpus[i].options.jpeg_width = options.width / 4;
+      corpus[i].options.jpeg_height = options.height / 4;
+    }
+    corpus[i].options.seed = i + 1;
+    corpus[i].data = generate_synthetic_raw(corpus[i].options);
+  }
+  return corpus;
+}
+
+static RawImage copy_image(const RawImage& src) {
+  RawImage dest(src.width, src.height, src.channels, src.sample_bytes);
+  size_t row_bytes = (size_t)src.width * src.channels * src.sample_bytes;
+  dest.copy_info(src);
+  for (u_int y = 0; y < src.height && !dest.empty(); ++y) {
+    memcpy(dest.row<u_char>(y), src.row<u_char>(y), row_bytes);
+  }
+  return dest;
+}
+
+/* Byte readers and row unpackers on an in-memory stream */
+static void bench_byte_readers(BenchRunner& runner) {
+  const size_t size = 64 << 10;
+  std::vector<u_char> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = (i * 131 + 7) & 0xff;
+  MemoryReader reader(data.data(), size);
+  std::ifstream stream;
+  stream.std::ios::rdbuf(&reader);
+  volatile u_int32_t sink = 0;
+
+  for (u_int16_t bitorder : { 0x4d4d, 0x4949 }) {
+    std::string order = bitorder == 0x4d4d ? "mm" : "ii";
+    runner.run("read_2_bytes", order, 1, size, "bytes", nullptr, [&]() {
+      u_int32_t sum = 0;
+      stream.clear();
+      stream.seekg(0, std::ios::beg);
+      for (size_t i = 0; i < size; i += 2) sum += read_2_bytes_unsigned(stream, bitorder);
+      sink = sum;
+      return true;
+    });
+    runner.run("read_4_bytes", order, 1, size, "bytes", nullptr, [&]() {
+      u_int32_t sum = 0;
+      stream.clear();
+      stream.seekg(0, std::ios::beg);
+      for (size_t i = 0; i < size; i += 4) sum += read_4_bytes_unsigned(stream, bitorder);
+      sink = sum;
+      return true;
+    });
+    runner.run("bit_order_4_bytes", order, 1, size, "bytes", nullptr, [&]() {
+      u_int32_t sum = 0;
+      for (size_t i = 0; i < size; i += 4) sum += bit_order_4_bytes(&data[i], bitorder);
+      sink = sum;
+      return true;
+    });
+  }
+
+  std::vector<u_int16_t> samples(size);
+  runner.run("unpack_16_bits", "mm", 1, size, "bytes", nullptr, [&]() {
+    unpack_16_bits(data.data(), samples.data(), size / 2, 0x4d4d);
+    return true;
+  });
+  for (u_int bps : { 12, 14 }) {
+    runner.run("unpack_bits_msb", std::to_string(bps) + "bit", 1, size, "bytes", nullptr, [&, bps]() {
+      unpack_bits_msb(data.data(), samples.data(), size * 8 / bps, bps);
+      return true;
+    });
+  }
+}
+
+static void bench_metadata(BenchRunner& runner, const std::vector<bench_input_t>& corpus) {
+  for (const bench_input_t& input : corpus) {
+    runner.run("ifd_walk", input.name, 20, input.data.size(), "bytes", nullptr, [&]() {
+      NikonRaw img(input.data.data(), input.data.size());
+      return img.open_raw();
+    });
+  }
+
+  std::vector<u_char> jpeg = generate_synthetic_jpeg(640, 424);
+  MemoryReader reader(jpeg.data(), jpeg.size());
+  std::ifstream stream;
+  stream.std::ios::rdbuf(&reader);
+  for (bool info_only : { true, false }) {
+    runner.run(info_only ? "jpeg_header_info" : "jpeg_header_full", "640x424", 100, jpeg.size(), "bytes", nullptr, [&, info_only]() {
+      jpeg_info_t jpeg_info;
+      stream.clear();
+      stream.seekg(0, std::ios::beg);
+      return parse_jpeg_info(stream, &jpeg_info, info_only);
+    });
+  }
+}
+
+/* Each stage on its own, fed with the previous stage's output */
+static void bench_stages(BenchRunner& runner, const bench_input_t& input, ThreadPool* pool, const std::string& temp_path) {
+  const u_int64_t pixels = (u_int64_t)input.options.width * input.options.height;
+  std::unique_ptr<RawImageData> img;
+  RawImage raw, cfa, rgb, output;
+  float rgb_cam[3][3];
+
+  img.reset(new NikonRaw(input.data.data(), input.data.size()));
+  if (!img->open_raw() || !img->load_raw()) {
+    fprintf(stderr, "ERROR: Synthetic input %s does not decode\n", input.name.c_str());
+    return;
+  }
+  raw = img->take_image();
+  img->get_camera_matrix(rgb_cam);
+
+  runner.run("unpack", input.name, 1, pixels, "pixels", [&]() {
+    img.reset(new NikonRaw(input.data.data(), input.data.size()));
+    return img->open_raw();
+  }, [&]() {
+    return img->load_raw();
+  });
+
+  stats_options_t stats_options;
+  stats_options.pool = pool;
+  runner.run("raw_stats", input.name, 1, pixels, "pixels", nullptr, [&]() {
+    image_stats_t stats;
+    return compute_image_stats(raw, &stats, stats_options);
+  });
+
+  runner.run("normalise", input.name, 1, pixels, "pixels", [&]() {
+    img->set_image(copy_image(raw));
+    return true;
+  }, [&]() {
+    return img->normalise_raw();
+  });
+  img->set_image(copy_image(raw));
+  if (!img->normalise_raw()) {
+    return;
+  }
+  cfa = img->take_image();
+
+  const std::pair<const char*, Demosaic_Method> methods[] = {
+    { "demosaic_bilinear", Demosaic_Method::BILINEAR },
+    { "demosaic_ppg", Demosaic_Method::PPG },
+    { "demosaic_ahd", Demosaic_Method::AHD }
+  };
+  for (const auto& method : methods) {
+    demosaic_options_t demosaic_options;
+    demosaic_options.method = method.second;
+    demosaic_options.pool = pool;
+    memcpy(demosaic_options.rgb_cam, rgb_cam, sizeof(rgb_cam));
+    runner.run(method.first, input.name, 1, pixels, "pixels", nullptr, [&]() {
+      return demosaic_raw_image(cfa, rgb, demosaic_options);
+    });
+  }
+  if (rgb.empty()) {
+    return;
+  }
+
+  const std::pair<const char*, Output_Format> formats[] = {
+    { "colour_rgb16", Output_Format::RGB16 },
+    { "colour_float", Output_Format::FLOAT },
+    { "colour_rgb8", Output_Format::RGB8 }
+  };
+  for (const auto& format : formats) {
+    colour_options_t colour_options;
+    colour_options.format = format.second;
+    colour_options.pool = pool;
+    runner.run(format.first, input.name, 1, pixels, "pixels", nullptr, [&]() {
+      return convert_colour(rgb, output, rgb_cam, colour_options);
+    });
+  }
+  if (output.empty()) {
+    return;
+  }
+
+  runner.run("output_stats", input.name, 1, pixels, "pixels", nullptr, [&]() {
+    image_stats_t stats;
+    return compute_image_stats(output, &stats, stats_options);
+  });
+
+  image_writer_options_t writer_options;
+  writer_options.pool = pool;
+  runner.run("write_tiff", input.name, 1, pixels, "pixels", nullptr, [&]() {
+    return write_image(temp_path.c_str(), output, writer_options);
+  });
+  writer_options.format = Image_File_Format::PNM;
+  runner.run("write_ppm", input.name, 1, pixels, "pixels", nullptr, [&]() {
+    return write_image(temp_path.c_str(), output, writer_options);
+  });
+  unlink(temp_path.c_str());
+}
+
+/* Whole decodes from the file bytes, parse included */
+static void bench_decodes(BenchRunner& runner, const bench_input_t& input, ThreadPool* pool) {
+  const u_int64_t pixels = (u_int64_t)input.options.width * input.options.height;
+  decode_options_t decode_options;
+  decode_options.pool = pool;
+
+  for (bool half_size : { false, true }) {
+    decode_options.half_size = half_size;
+    runner.run(half_size ? "decode_half_size" : "decode", input.name, 1, pixels, "pixels", nullptr, [&]() {
+      NikonRaw img(input.data.data(), input.data.size());
+      RawImage output;
+      return img.open_raw() && img.decode(decode_options, output);
+    });
+  }
+
+  pipeline_options_t pipeline_options;
+  pipeline_options.pool = pool;
+  decode_options.half_size = false;
+  runner.run("decode_bands", input.name, 1, pixels, "pixels", nullptr, [&]() {
+    NikonRaw img(input.data.data(), input.data.size());
+    return img.open_raw() && img.decode_bands(decode_options, pipeline_options, [](const RawImage&, u_int) { return true; });
+  });
+}
+
+static void write_json(FILE* out, const bench_options_t& options, u_int threads,
+                       const std::vector<bench_input_t>& corpus, const std::vector<bench_result_t>& results) {
+  fprintf(out, "{\n  \"benchmark\": \"rawimagedata_bench\",\n  \"threads\": %d,\n  \"repeats\": %d,\n  \"cpu_level\": \"%s\",\n",
+          threads, options.repeats, get_cpu_level_name(get_kernels().level));
+
+  fprintf(out, "  \"inputs\": [\n");
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    const synthetic_raw_options_t& o = corpus[i].options;
+    fprintf(out, "    {\"name\": \"%s\", \"bytes\": %zu, \"fnv1a\": \"%016llx\", \"width\": %d, \"height\": %d, \"bps\": %d, "
+                 "\"packed\": %s, \"byte_order\": \"%s\", \"strips\": %d, \"extra_ifds\": %d, \"extra_tags\": %d, "
+                 "\"makernote_tags\": %d, \"jpeg_width\": %d, \"jpeg_height\": %d}%s\n",
+            corpus[i].name.c_str(), corpus[i].data.size(), (unsigned long long)get_fnv1a_hash(corpus[i].data.data(), corpus[i].data.size()),
+            o.width, o.height, o.bps, o.packed ? "true" : "false", o.big_endian ? "MM" : "II", o.strips, o.extra_ifds,
+            o.extra_tags, o.makernote ? o.makernote_tags : 0, o.jpeg_width, o.jpeg_height, i + 1 < corpus.size() ? "," : "");
+  }
+  fprintf(out, "  ],\n");
+
+  fprintf(out, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const bench_result_t& r = results[i];
+    std::vector<double> sorted = r.times;
+    std::sort(sorted.begin(), sorted.end());
+    double min = 0, median = 0, mean = 0, max = 0;
+    if (!sorted.empty()) {
+      min = sorted.front();
+      max = sorted.back();
+      median = sorted.size() & 1 ? sorted[sorted.size() / 2] : (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+      for (double t : sorted) mean += t / sorted.size();
+    }
+    fprintf(out, "    {\"name\": \"%s\", \"input\": \"%s\", \"ok\": %s, \"runs\": %zu, \"ops_per_run\": %llu, "
+                 "\"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"max_ns\": %.1f, "
+                 "\"items\": %llu, \"unit\": \"%s\", \"items_per_second\": %.1f}%s\n",
+            r.name.c_str(), r.input.c_str(), r.ok ? "true" : "false", r.times.size(), (unsigned long long)r.ops,
+            min, median, mean, max, (unsigned long long)r.items, r.unit, median > 0 ? r.items * 1e9 / median : 0,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+static bool write_corpus(const char* dir, const std::vector<bench_input_t>& corpus) {
+  for (const bench_input_t& input : corpus) {
+    std::string path = std::string(dir) + "/" + input.name + ".nef";
+    FILE* f = fopen(path.c_str(), "wb");
+    if (f == nullptr || fwrite(input.data.data(), 1, input.data.size(), f) != input.data.size()) {
+      fprintf(stderr, "ERROR: Unable to write %s\n", path.c_str());
+      if (f != nullptr) fclose(f);
+      return false;
+    }
+    fclose(f);
+    printf("%s\n", path.c_str());
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  bench_options_t options;
+  bool parsed = parse_args(argc, argv, &options);
+  if (!parsed || options.help) {
+    fprintf(parsed ? stdout : stderr, "Usage: %s [--output FILE] [--repeats N] [--filter TEXT] [--size WxH] [--threads N] [--corpus DIR]\n", argv[0]);
+    return parsed ? 0 : 2;
+  }
+
+  std::vector<bench_input_t> corpus = make_corpus(options);
+  if (options.corpus_dir != nullptr) {
+    return write_corpus(options.corpus_dir, corpus) ? 0 : 1;
+  }
+
+  std::unique_ptr<ThreadPool> own_pool;
+  ThreadPool* pool = &ThreadPool::shared();
+  if (options.threads == 0) {
+    pool = nullptr;
+  } else if (options.threads > 0) {
+    own_pool.reset(new ThreadPool(options.threads));
+    pool = own_pool.get();
+  }
+
+  const char* temp_dir = getenv("TMPDIR");
+  std::string temp_path = std::string(temp_dir ? temp_dir : "/tmp") + "/rawimagedata_bench_" + std::to_string(getpid()) + ".tif";
+
+  // The results go to stdout, parser traces (RAWIMAGEDATA_DEBUG) would corrupt them and skew the timings
+  set_debug_output(false);
+
+  BenchRunner runner(options);
+  bench_byte_readers(runner);
+  bench_metadata(runner, corpus);
+  for (u_int i = 0; i < 3; ++i) {
+    bench_stages(runner, corpus[i], pool, temp_path);
+    bench_decodes(runner, corpus[i], pool);
+  }
+
+  FILE* out = options.output != nullptr ? fopen(options.output, "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", options.output);
+    return 1;
+  }
+  write_json(out, options, pool != nullptr ? pool->size() : 0, corpus, runner.get_results());
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  for (const bench_result_t& result : runner.get_results()) {
+    if (!result.ok) return 1;
+  }
+  return 0;
+}
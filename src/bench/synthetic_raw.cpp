@@ -0,0 +1,363 @@
+#include "synthetic_raw.h"
+
+#include <algorithm>
+
+#define SYNTHETIC_DATA_ALIGN 4096
+#define SYNTHETIC_FILLER_TAG 0xfe00   // Private range, skipped by every parser switch
+
+struct tiff_entry_t {
+  u_int16_t tag;
+  u_int16_t type;
+  u_int32_t count;
+  std::vector<u_char> value;
+};
+
+/* Offsets of every block, measured by one layout pass and used by the next */
+struct synthetic_layout_t {
+  u_int32_t ifd0 = 0, preview_ifd = 0, jpeg = 0, raw_ifd = 0, exif = 0, raw_data = 0;
+  u_int32_t extra_ifds[SYNTHETIC_MAX_EXTRA_IFDS] = { 0 };
+};
+
+/* xorshift32, so the bytes do not depend on the standard library */
+struct synthetic_random_t {
+  u_int32_t state;
+
+  synthetic_random_t(u_int32_t seed) : state(seed ? seed : 0x9e3779b9) {}
+  u_int32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+};
+
+static void put_bytes(std::vector<u_char>& out, u_int32_t value, u_int n, bool big_endian) {
+  for (u_int i = 0; i < n; ++i) {
+    u_int shift = big_endian ? (n - 1 - i) * 8 : i * 8;
+    out.push_back((value >> shift) & 0xff);
+  }
+}
+
+static tiff_entry_t make_shorts(u_int16_t tag, const std::vector<u_int>& values, bool big_endian) {
+  tiff_entry_t entry = { tag, 3, (u_int32_t)values.size(), {} };
+  for (u_int value : values) put_bytes(entry.value, value, 2, big_endian);
+  return entry;
+}
+
+static tiff_entry_t make_longs(u_int16_t tag, const std::vector<u_int32_t>& values, bool big_endian) {
+  tiff_entry_t entry = { tag, 4, (u_int32_t)values.size(), {} };
+  for (u_int32_t value : values) put_bytes(entry.value, value, 4, big_endian);
+  return entry;
+}
+
+static tiff_entry_t make_rationals(u_int16_t tag, const std::vector<double>& values, bool big_endian) {
+  tiff_entry_t entry = { tag, 5, (u_int32_t)values.size(), {} };
+  for (double value : values) {
+    put_bytes(entry.value, (u_int32_t)(value * 1000 + 0.5), 4, big_endian);
+    put_bytes(entry.value, 1000, 4, big_endian);
+  }
+  return entry;
+}
+
+static tiff_entry_t make_ascii(u_int16_t tag, const std::string& text) {
+  tiff_entry_t entry = { tag, 2, (u_int32_t)text.size() + 1, {} };
+  entry.value.assign(text.begin(), text.end());
+  entry.value.push_back(0);
+  return entry;
+}
+
+static tiff_entry_t make_undefined(u_int16_t tag, const std::vector<u_char>& bytes) {
+  return { tag, 7, (u_int32_t)bytes.size(), bytes };
+}
+
+/* Mix of inline and out-of-line values, as vendor tags in real files */
+static void add_filler_tags(std::vector<tiff_entry_t>& entries, u_int n, synthetic_random_t& random, bool big_endian) {
+  for (u_int i = 0; i < n; ++i) {
+    u_int16_t tag = SYNTHETIC_FILLER_TAG + i;
+    u_int count = 1 + random.next() % 16;
+    std::vector<u_int32_t> longs;
+    std::vector<double> rationals;
+    std::string text;
+    switch (i % 4) {
+      case 0:
+        entries.push_back(make_shorts(tag, { random.next() & 0xffff }, big_endian));
+        break;
+      case 1:
+        for (u_int j = 0; j < count + 7; ++j) text.push_back('A' + random.next() % 26);
+        entries.push_back(make_ascii(tag, text));
+        break;
+      case 2:
+        for (u_int j = 0; j < count; ++j) longs.push_back(random.next());
+        entries.push_back(make_longs(tag, longs, big_endian));
+        break;
+      default:
+        for (u_int j = 0; j < 1 + count % 3; ++j) rationals.push_back((random.next() & 0xffff) / 1000.0);
+        entries.push_back(make_rationals(tag, rationals, big_endian));
+        break;
+    }
+  }
+}
+
+/* Writes the IFD and its out-of-line values, returns its offset from base */
+static u_int32_t write_ifd(std::vector<u_char>& out, std::vector<tiff_entry_t> entries, u_int32_t next_ifd, size_t base, bool big_endian) {
+  std::sort(entries.begin(), entries.end(), [](const tiff_entry_t& a, const tiff_entry_t& b) { return a.tag < b.tag; });
+
+  size_t offset = out.size();
+  size_t values_offset = offset + 2 + 12 * entries.size() + 4;
+  std::vector<u_char> values;
+
+  put_bytes(out, entries.size(), 2, big_endian);
+  for (const tiff_entry_t& entry : entries) {
+    put_bytes(out, entry.tag, 2, big_endian);
+    put_bytes(out, entry.type, 2, big_endian);
+    put_bytes(out, entry.count, 4, big_endian);
+    if (entry.value.size() <= 4) {
+      out.insert(out.end(), entry.value.begin(), entry.value.end());
+      out.insert(out.end(), 4 - entry.value.size(), 0);
+    } else {
+      put_bytes(out, values_offset + values.size() - base, 4, big_endian);
+      values.insert(values.end(), entry.value.begin(), entry.value.end());
+      if (values.size() & 1) values.push_back(0);   // Values start on word boundaries
+    }
+  }
+  put_bytes(out, next_ifd, 4, big_endian);
+  out.insert(out.end(), values.begin(), values.end());
+
+  return offset - base;
+}
+
+static std::vector<u_char> make_makernote(const synthetic_raw_options_t& options, u_int black, synthetic_random_t& random) {
+  const bool be = options.big_endian;
+  const u_char magic[10] = { 'N', 'i', 'k', 'o', 'n', 0, 0x02, 0x10, 0, 0 };
+  std::vector<u_char> out(magic, magic + sizeof(magic));
+  std::vector<tiff_entry_t> entries;
+
+  // Offsets count from the makernote's own TIFF header
+  size_t base = out.size();
+  put_bytes(out, be ? 0x4d4d : 0x4949, 2, true);
+  put_bytes(out, 42, 2, be);
+  put_bytes(out, 8, 4, be);
+
+  entries.push_back(make_rationals(0x000c, { 2.0, 1.5, 1.0, 1.0 }, be));   // WB_RBLevels
+  entries.push_back(make_ascii(0x001d, "1234567"));                       // SerialNumber
+  entries.push_back(make_shorts(0x003d, { black, black, black, black }, be));  // CBlack
+  add_filler_tags(entries, options.makernote_tags, random, be);
+  write_ifd(out, entries, 0, base, be);
+
+  return out;
+}
+
+static u_int scale_level(u_int value, u_int bps) {
+  return bps >= 14 ? value << (bps - 14) : value >> (14 - bps);
+}
+
+/* RGGB mosaic with a gradient and noise, one row as stored in the file */
+static void make_raw_row(const synthetic_raw_options_t& options, u_int y, synthetic_random_t& random, std::vector<u_char>& out) {
+  static const u_int levels[4] = { 1800, 3000, 3000, 1200 };
+  const u_int max = (1u << options.bps) - 1;
+  u_int64_t bits = 0;
+  u_int n_bits = 0;
+
+  for (u_int x = 0; x < options.width; ++x) {
+    u_int value = 600 + levels[(y & 1) << 1 | (x & 1)] + (x * 7 + y * 3) % 200 + (random.next() & 255);
+    value = std::min(scale_level(value, options.bps), max);
+    if (!options.packed) {
+      put_bytes(out, value, 2, options.big_endian);
+      continue;
+    }
+    bits = bits << options.bps | value;
+    n_bits += options.bps;
+    while (n_bits >= 8) {
+      n_bits -= 8;
+      out.push_back((bits >> n_bits) & 0xff);
+    }
+  }
+  if (n_bits) {
+    out.push_back((bits << (8 - n_bits)) & 0xff);
+  }
+}
+
+static size_t get_row_bytes(const synthetic_raw_options_t& options) {
+  return options.packed ? ((size_t)options.width * options.bps + 7) / 8 : (size_t)options.width * 2;
+}
+
+static synthetic_layout_t write_metadata(std::vector<u_char>& out, const synthetic_raw_options_t& options,
+                                         const std::vector<u_char>& jpeg, const synthetic_layout_t& layout) {
+  const bool be = options.big_endian;
+  const u_int extra_ifds = std::min(options.extra_ifds, (u_int)SYNTHETIC_MAX_EXTRA_IFDS);
+  const u_int rows_per_strip = (options.height + options.strips - 1) / options.strips;
+  const u_int n_strips = (options.height + rows_per_strip - 1) / rows_per_strip;
+  const size_t row_bytes = get_row_bytes(options);
+  synthetic_random_t random(options.seed);
+  synthetic_layout_t measured;
+  std::vector<tiff_entry_t> entries;
+
+  out.clear();
+  put_bytes(out, be ? 0x4d4d : 0x4949, 2, true);
+  put_bytes(out, 42, 2, be);
+  put_bytes(out, layout.ifd0, 4, be);
+
+  // IFD0: camera, orientation, pointers to the SubIFDs, EXIF and the extra IFD chain
+  std::vector<u_int32_t> sub_ifds;
+  if (!jpeg.empty()) sub_ifds.push_back(layout.preview_ifd);
+  sub_ifds.push_back(layout.raw_ifd);
+  entries.push_back(make_longs(254, { 1 }, be));
+  entries.push_back(make_ascii(271, "NIKON CORPORATION"));
+  entries.push_back(make_ascii(272, "NIKON D750"));
+  entries.push_back(make_shorts(274, { (u_int)options.orientation }, be));
+  entries.push_back(make_ascii(306, "2024:01:02 03:04:05"));
+  entries.push_back(make_longs(330, sub_ifds, be));
+  entries.push_back(make_longs(34665, { layout.exif }, be));
+  add_filler_tags(entries, options.extra_tags, random, be);
+  measured.ifd0 = write_ifd(out, entries, extra_ifds ? layout.extra_ifds[0] : 0, 0, be);
+
+  if (!jpeg.empty()) {
+    entries.clear();
+    entries.push_back(make_longs(254, { 1 }, be));
+    entries.push_back(make_shorts(259, { 6 }, be));
+    entries.push_back(make_longs(513, { layout.jpeg }, be));
+    entries.push_back(make_longs(514, { (u_int32_t)jpeg.size() }, be));
+    add_filler_tags(entries, options.extra_tags, random, be);
+    measured.preview_ifd = write_ifd(out, entries, 0, 0, be);
+    measured.jpeg = out.size();
+    out.insert(out.end(), jpeg.begin(), jpeg.end());
+    if (out.size() & 1) out.push_back(0);
+  }
+
+  // Raw SubIFD, strips are stored last to first so their offsets are not in file order
+  std::vector<u_int32_t> strip_offsets(n_strips), strip_bytes(n_strips);
+  size_t data_offset = layout.raw_data;
+  for (u_int i = n_strips; i-- > 0;) {
+    u_int rows = std::min(rows_per_strip, options.height - i * rows_per_strip);
+    strip_offsets[i] = data_offset;
+    strip_bytes[i] = rows * row_bytes;
+    data_offset += strip_bytes[i];
+  }
+  entries.clear();
+  entries.push_back(make_longs(254, { 0 }, be));
+  entries.push_back(make_longs(256, { options.width }, be));
+  entries.push_back(make_longs(257, { options.height }, be));
+  entries.push_back(make_shorts(258, { options.bps }, be));
+  entries.push_back(make_shorts(259, { 1 }, be));
+  entries.push_back(make_shorts(262, { 32803 }, be));
+  entries.push_back(make_longs(273, strip_offsets, be));
+  entries.push_back(make_shorts(277, { 1 }, be));
+  entries.push_back(make_longs(278, { rows_per_strip }, be));
+  entries.push_back(make_longs(279, strip_bytes, be));
+  entries.push_back(make_shorts(284, { 1 }, be));
+  entries.push_back(make_shorts(33421, { 2, 2 }, be));
+  entries.push_back(make_undefined(33422, { 0, 1, 1, 2 }));
+  add_filler_tags(entries, options.extra_tags, random, be);
+  measured.raw_ifd = write_ifd(out, entries, 0, 0, be);
+
+  entries.clear();
+  entries.push_back(make_rationals(0x829a, { 0.01 }, be));   // ExposureTime
+  entries.push_back(make_rationals(0x829d, { 5.6 }, be));    // FNumber
+  entries.push_back(make_shorts(0x8827, { 200 }, be));       // ISO
+  if (options.makernote) {
+    entries.push_back(make_undefined(0x927c, make_makernote(options, scale_level(600, options.bps), random)));
+  }
+  add_filler_tags(entries, options.extra_tags, random, be);
+  measured.exif = write_ifd(out, entries, 0, 0, be);
+
+  for (u_int i = 0; i < extra_ifds; ++i) {
+    entries.clear();
+    entries.push_back(make_longs(254, { 1 }, be));
+    add_filler_tags(entries, options.extra_tags, random, be);
+    measured.extra_ifds[i] = write_ifd(out, entries, i + 1 < extra_ifds ? layout.extra_ifds[i + 1] : 0, 0, be);
+  }
+
+  measured.raw_data = (out.size() + SYNTHETIC_DATA_ALIGN - 1) / SYNTHETIC_DATA_ALIGN * SYNTHETIC_DATA_ALIGN;
+  return measured;
+}
+
+std::vector<u_char> generate_synthetic_raw(const synthetic_raw_options_t& options) {
+  std::vector<u_char> out, jpeg, row;
+  synthetic_layout_t layout;
+
+  if (options.width == 0 || options.height == 0 || options.bps < 8 || options.bps > 16 || options.strips == 0) {
+    fprintf(stderr, "ERROR: Invalid synthetic raw %dx%d bps: %d strips: %d\n", options.width, options.height, options.bps, options.strips);
+    return out;
+  }
+  if (options.jpeg_width && options.jpeg_height) {
+    jpeg = generate_synthetic_jpeg(options.jpeg_width, options.jpeg_height);
+  }
+
+  // Every value has a fixed width, so the offsets measured by the first pass hold for the second
+  layout = write_metadata(out, options, jpeg, layout);
+  layout = write_metadata(out, options, jpeg, layout);
+  out.resize(layout.raw_data, 0);
+
+  // Strips last to first, matching the offsets in the raw IFD
+  const u_int rows_per_strip = (options.height + options.strips - 1) / options.strips;
+  const size_t row_bytes = get_row_bytes(options);
+  std::vector<u_char> data((size_t)options.height * row_bytes);
+  synthetic_random_t random(options.seed * 2654435761u + 1);
+  for (u_int y = 0; y < options.height; ++y) {
+    row.clear();
+    make_raw_row(options, y, random, row);
+    memcpy(&data[y * row_bytes], row.data(), row_bytes);
+  }
+  for (u_int i = (options.height + rows_per_strip - 1) / rows_per_strip; i-- > 0;) {
+    size_t begin = (size_t)i * rows_per_strip * row_bytes;
+    size_t end = std::min(begin + rows_per_strip * row_bytes, data.size());
+    out.insert(out.end(), data.begin() + begin, data.begin() + end);
+  }
+
+  return out;
+}
+
+std::vector<u_char> generate_synthetic_jpeg(u_int width, u_int height) {
+  // Luminance DC code lengths of ITU T.81 Annex K
+  static const u_char dc_counts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+  std::vector<u_char> out = { 0xff, 0xd8 };
+
+  auto marker = [&out](u_int16_t code, u_int length) {
+    put_bytes(out, code, 2, true);
+    put_bytes(out, length + 2, 2, true);
+  };
+
+  marker(0xffe0, 14);   // APP0
+  const u_char jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+  out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+  marker(0xffdb, 65);   // DQT, one 8 bit table
+  out.push_back(0);
+  for (u_int i = 0; i < 64; ++i) out.push_back(16 + i);
+
+  marker(0xffc0, 15);   // SOF0, 3 components 4:2:0
+  out.push_back(8);
+  put_bytes(out, height, 2, true);
+  put_bytes(out, width, 2, true);
+  out.push_back(3);
+  const u_char components[9] = { 1, 0x22, 0, 2, 0x11, 0, 3, 0x11, 0 };
+  out.insert(out.end(), components, components + sizeof(components));
+
+  marker(0xffc4, 29);   // DHT
+  out.push_back(0);
+  out.insert(out.end(), dc_counts, dc_counts + 16);
+  for (u_int i = 0; i < 12; ++i) out.push_back(i);
+
+  marker(0xffdd, 2);    // DRI
+  put_bytes(out, (width + 15) / 16, 2, true);
+
+  marker(0xffda, 10);   // SOS
+  const u_char scan[10] = { 3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0 };
+  out.insert(out.end(), scan, scan + sizeof(scan));
+
+  // Token entropy coded data, the header parse stops at SOS
+  out.insert(out.end(), 64, 0);
+  out.push_back(0xff);
+  out.push_back(0xd9);
+
+  return out;
+}
+
+u_int64_t get_fnv1a_hash(const void* data, size_t size) {
+  const u_char* p = static_cast<const u_char*>(data);
+  u_int64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ull;
+  }
+  return hash;
+}
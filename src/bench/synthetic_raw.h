@@ -0,0 +1,41 @@
+#ifndef SYNTHETIC_RAW_H
+#define SYNTHETIC_RAW_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define SYNTHETIC_MAX_EXTRA_IFDS 4   // The parser keeps 8 IFDs: IFD0, preview, raw, extras
+
+struct synthetic_raw_options_t {
+  u_int width = 1536, height = 1024;
+  u_int bps = 14;
+  bool packed = false;        // bps bit MSB first rows, otherwise 16 bit containers
+  bool big_endian = true;     // "MM" as in NEF, false: "II"
+  u_int strips = 1;           // Strips of the raw IFD, written in reverse order
+  u_int extra_ifds = 0;       // Chained after IFD0, at most SYNTHETIC_MAX_EXTRA_IFDS
+  u_int extra_tags = 0;       // Filler tags in every IFD, most with out-of-line values
+  bool makernote = true;      // Nikon type 2 makernote (white balance, black, serial)
+  u_int makernote_tags = 0;   // Filler tags in the makernote IFD
+  u_int jpeg_width = 0, jpeg_height = 0;  // Preview JPEG headers in their own SubIFD, 0: none
+  int orientation = 1;
+  u_int32_t seed = 1;
+};
+
+/*
+ * Deterministic NEF-like TIFF: IFD0 (make, model, orientation, EXIF and
+ * SubIFD pointers), an optional preview SubIFD pointing at a JPEG, the
+ * uncompressed CFA SubIFD, EXIF with the makernote and the raw strips on
+ * a 4 KB boundary at the end. The same options and seed give the same bytes.
+ */
+std::vector<u_char> generate_synthetic_raw(const synthetic_raw_options_t& options);
+
+/* Baseline JPEG header (APP0, DQT, SOF0, DHT, DRI, SOS) with a token scan */
+std::vector<u_char> generate_synthetic_jpeg(u_int width, u_int height);
+
+u_int64_t get_fnv1a_hash(const void* data, size_t size);
+
+#endif
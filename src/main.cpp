@@ -1,25 +1,23 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "rawimagedata/cameras/nikon_raw.h"
-#include "rawimagedata/cameras/canon_raw.h"
+#include "rawimagedata/cameras/camera_raw.h"
 
 int main(int argc, char** argv) {
   RawImageData *img;
-  int index = 0;
+  const char* file_path = argc > 1 ? argv[1] : "../sample_images/nikon/DSC_0498.NEF";
 
-  if (index == 0) {
-    img = new NikonRaw("../sample_images/nikon/DSC_0498.NEF");
-  } else if (index == 1) {
-    img = new CanonRaw("../sample_images/canon/canon-eos-r.cr3");
-  } else {
-    /* Some other child classes*/
-  }
+  // Trace the parse and dump what it found
+  set_debug_output(true);
+
+  // Picks NikonRaw, CanonRaw, ... from the file header
+  img = open_camera_raw(file_path);
   
   if (img != nullptr) {
-    img->load_raw();
+    if (img->load_raw()) {
+      img->print_data(true, false);
+    }
   }
   
   delete img;
-}
\ No newline at end of file
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <thread>
+
+#include "rawimagedata/decode_server.h"
+
+int main(int argc, char** argv) {
+  decode_server_options_t options;
+  const char* socket_path = argc > 1 ? argv[1] : "/tmp/rawimagedata.sock";
+  sigset_t signals;
+  int signal;
+
+  if (argc > 2) {
+    options.cache.max_bytes = (size_t)atol(argv[2]) << 20;   // Cache size in MB
+  }
+
+  // Every thread inherits the mask, only sigwait() below sees the signals
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  DecodeServer server(options);
+  if (!server.listen(socket_path)) {
+    return 1;
+  }
+  printf("Serving on %s\n", socket_path);
+  fflush(stdout);
+
+  std::thread accept_thread(&DecodeServer::run, &server);
+  sigwait(&signals, &signal);
+  server.stop();
+  accept_thread.join();
+  return 0;
+}
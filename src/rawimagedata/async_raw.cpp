@@ -0,0 +1,107 @@
+#include "async_raw.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include "cameras/camera_raw.h"
+
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+EventFdExecutor :: EventFdExecutor(ThreadPool* pool) : pool(pool) {
+  fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to create eventfd");
+  }
+}
+
+EventFdExecutor :: ~EventFdExecutor() {
+  close(fd);
+}
+
+void EventFdExecutor :: post(std::function<void()> work, std::coroutine_handle<> resume) {
+  auto run = [this, work = std::move(work), resume]() {
+    work();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready.push_back(resume);
+    }
+    u_int64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+      fprintf(stderr, "ERROR: eventfd write failed\n");
+    }
+  };
+  if (pool != nullptr) {
+    pool->submit(std::move(run));
+  } else {
+    run();
+  }
+}
+
+size_t EventFdExecutor :: run_ready() {
+  std::vector<std::coroutine_handle<>> batch;
+  u_int64_t count;
+
+  if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    fprintf(stderr, "ERROR: eventfd read failed\n");
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batch.swap(ready);
+  }
+  // Resumed coroutines may post again, those wait for the next call
+  for (std::coroutine_handle<> handle : batch) {
+    handle.resume();
+  }
+  return batch.size();
+}
+
+void EventFdExecutor :: run_until(const std::function<bool()>& done) {
+  struct pollfd event = { fd, POLLIN, 0 };
+  while (!done()) {
+    if (run_ready() == 0) {
+      poll(&event, 1, -1);
+    }
+  }
+}
+
+RawTask<bool> AsyncRawParser :: open(std::string file_path) {
+  RawImageData* opened = nullptr;
+  // Awaiters are named locals, GCC 12 destroys a braced co_await temporary twice
+  raw_offload_t offload { executor, [&]() { opened = open_camera_raw(file_path); } };
+  co_await offload;
+  img.reset(opened);
+  parsed = false;
+  co_return img != nullptr;
+}
+
+RawTask<const RawImageData*> AsyncRawParser :: metadata() {
+  if (img == nullptr) {
+    co_return nullptr;
+  }
+  if (!parsed) {
+    bool ok = false;
+    RawImageData* parser = img.get();
+    raw_offload_t offload { executor, [&]() { ok = parser->open_raw(); } };
+    co_await offload;
+    if (!ok) {
+      co_return nullptr;
+    }
+    parsed = true;
+  }
+  co_return img.get();
+}
+
+RawTask<bool> AsyncRawParser :: decode(decode_options_t options, RawImage& output) {
+  if (co_await metadata() == nullptr) {
+    co_return false;
+  }
+  bool ok = false;
+  RawImageData* parser = img.get();
+  raw_offload_t offload { executor, [&]() { ok = parser->decode(options, output); } };
+  co_await offload;
+  co_return ok;
+}
+
+#endif
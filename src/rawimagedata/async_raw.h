@@ -0,0 +1,173 @@
+#ifndef ASYNC_RAW_H
+#define ASYNC_RAW_H
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimagedata.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+/*
+ * Runs the blocking parts of a parse off the caller's thread. post() runs
+ * work somewhere and then resumes the suspended coroutine on whichever
+ * thread the executor resumes on.
+ */
+class RawExecutor {
+
+public:
+  virtual ~RawExecutor() {}
+  virtual void post(std::function<void()> work, std::coroutine_handle<> resume) = 0;
+
+};
+
+/*
+ * Event loop executor: work runs on a thread pool and finished coroutines
+ * queue up until the loop thread calls run_ready(). get_fd() is an eventfd
+ * that turns readable while any are queued, for the loop's epoll/poll set.
+ */
+class EventFdExecutor : public RawExecutor {
+
+public:
+  EventFdExecutor(ThreadPool* pool = &ThreadPool::shared());
+  ~EventFdExecutor();
+
+  void post(std::function<void()> work, std::coroutine_handle<> resume) override;
+
+  int get_fd() const { return fd; }
+  size_t run_ready();                                   // Resumes finished coroutines, returns how many
+  void run_until(const std::function<bool()>& done);    // Blocks on the fd between batches
+
+private:
+  ThreadPool* pool;
+  int fd = -1;
+  std::mutex mutex;
+  std::vector<std::coroutine_handle<>> ready;
+
+};
+
+/* Synchronous adapter: runs work and resumes on the calling thread */
+class InlineExecutor : public RawExecutor {
+
+public:
+  void post(std::function<void()> work, std::coroutine_handle<> resume) override {
+    work();
+    resume.resume();
+  }
+
+};
+
+/* Lazily started coroutine task, resumes its awaiter when it finishes */
+template <typename T>
+class RawTask {
+
+public:
+  struct promise_type {
+    T value {};
+    std::exception_ptr error;
+    std::coroutine_handle<> continuation;
+
+    RawTask get_return_object() { return RawTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      struct final_awaiter_t {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+          std::coroutine_handle<> next = handle.promise().continuation;
+          return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return final_awaiter_t {};
+    }
+    void return_value(T result) { value = std::move(result); }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  RawTask(RawTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+  RawTask(const RawTask&) = delete;
+  ~RawTask() {
+    if (handle) handle.destroy();
+  }
+
+  bool done() const { return !handle || handle.done(); }
+
+  // Starts a task that nothing awaits (top level of an event loop)
+  void start() { handle.resume(); }
+  T get() {
+    if (handle.promise().error) std::rethrow_exception(handle.promise().error);
+    return std::move(handle.promise().value);
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+  T await_resume() { return get(); }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit RawTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+};
+
+/* Suspends the coroutine while work runs on the executor */
+struct raw_offload_t {
+  RawExecutor& executor;
+  std::function<void()> work;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { executor.post(std::move(work), handle); }
+  void await_resume() const noexcept {}
+};
+
+/*
+ * Coroutine front end of the camera parsers. Every stage that touches the
+ * file or the pixels (open, metadata parse, decode) suspends the caller and
+ * runs on the executor, so an event loop thread never blocks on I/O:
+ *
+ *   co_await parser.open(path);
+ *   const RawImageData* info = co_await parser.metadata();
+ *   co_await parser.decode(options, output);
+ */
+class AsyncRawParser {
+
+public:
+  AsyncRawParser(RawExecutor& executor) : executor(executor) {}
+
+  RawTask<bool> open(std::string file_path);
+  RawTask<const RawImageData*> metadata();      // nullptr if the file could not be parsed
+  RawTask<bool> decode(decode_options_t options, RawImage& output);
+
+  RawImageData* get() { return img.get(); }
+
+private:
+  RawExecutor& executor;
+  std::unique_ptr<RawImageData> img;
+  bool parsed = false;
+
+};
+
+/* Runs a task to completion on the calling thread */
+template <typename T>
+T sync_wait(RawTask<T> task) {
+  task.start();
+  if (!task.done()) {
+    throw std::runtime_error("sync_wait: task suspended on an asynchronous executor");
+  }
+  return task.get();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+#include "batch_decode.h"
+#include "cameras/camera_raw.h"
+
+#include <sys/stat.h>
+
+typedef std::function<bool(size_t index)> batch_task_t;
+
+struct batch_state_t {
+  std::mutex mutex;
+  size_t next = 0;
+  u_int files_in_flight = 0;
+  size_t bytes_in_flight = 0;
+  std::atomic<size_t> done { 0 };
+  std::atomic<bool> ok { true };
+};
+
+static size_t get_file_size(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static bool run_many(const std::vector<std::string>& paths, ThreadPool* pool, const batch_options_t& batch_options,
+                     const prefetch_options_t& prefetch_options, const batch_task_t& task) {
+  FilePrefetcher prefetcher(paths, prefetch_options);
+  std::vector<size_t> file_sizes(paths.size());
+  batch_state_t state;
+
+  if (pool == nullptr) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      prefetcher.start(i);
+      if (!task(i)) {
+        state.ok = false;
+      }
+      prefetcher.release(i);
+    }
+    return state.ok;
+  }
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    file_sizes[i] = get_file_size(paths[i]);
+  }
+  u_int max_files = batch_options.max_files_in_flight;
+  if (max_files == 0) {
+    max_files = pool->size() + 1;
+  }
+
+  // Starts as many queued files as the limits allow, the first always fits
+  std::function<void()> admit = [&]() {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    while (state.next < paths.size() && state.files_in_flight < max_files) {
+      size_t i = state.next;
+      if (batch_options.max_bytes_in_flight && state.files_in_flight > 0 &&
+          state.bytes_in_flight + file_sizes[i] > batch_options.max_bytes_in_flight) {
+        break;
+      }
+      ++state.next;
+      ++state.files_in_flight;
+      state.bytes_in_flight += file_sizes[i];
+      prefetcher.start(i);
+      pool->submit([&, i]() {
+        if (!task(i)) {
+          state.ok = false;
+        }
+        prefetcher.release(i);
+        {
+          std::lock_guard<std::mutex> lock(state.mutex);
+          --state.files_in_flight;
+          state.bytes_in_flight -= file_sizes[i];
+        }
+        admit();
+        state.done++;
+      });
+    }
+  };
+
+  admit();
+  pool->wait_until([&]() { return state.done.load() == paths.size(); });
+  return state.ok;
+}
+
+bool decode_many(const std::vector<std::string>& paths, const decode_options_t& options,
+                 const decode_callback_t& callback, const batch_options_t& batch_options) {
+  return run_many(paths, options.pool, batch_options, batch_options.prefetch, [&](size_t i) {
+    RawImageData* img = open_camera_raw(paths[i]);
+    RawImage output;
+    bool ok = img != nullptr && img->open_raw() && img->decode(options, output);
+    delete img;
+    callback(i, ok, output);
+    return ok;
+  });
+}
+
+bool open_many(const std::vector<std::string>& paths, ThreadPool* pool,
+               const open_callback_t& callback, const batch_options_t& batch_options) {
+  prefetch_options_t prefetch_options = batch_options.prefetch;
+  if (prefetch_options.header_bytes == 0) {
+    prefetch_options.header_bytes = PREFETCH_HEADER_BYTES;
+  }
+  return run_many(paths, pool, batch_options, prefetch_options, [&](size_t i) {
+    RawImageData* img = open_camera_raw(paths[i]);
+    bool ok = img != nullptr && img->open_raw();
+    callback(i, ok ? img : nullptr);
+    delete img;
+    return ok;
+  });
+}
@@ -0,0 +1,42 @@
+#ifndef BATCH_DECODE_H
+#define BATCH_DECODE_H
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimagedata.h"
+#include "file_prefetch.h"
+
+/* Called from a pool thread as each file finishes, in completion order */
+typedef std::function<void(size_t index, bool ok, RawImage& output)> decode_callback_t;
+/* Called with the opened (metadata parsed) file, nullptr if it failed; deleted after the call */
+typedef std::function<void(size_t index, RawImageData* img)> open_callback_t;
+
+struct batch_options_t {
+  u_int max_files_in_flight = 0;    // 0: one per pool thread plus the caller
+  size_t max_bytes_in_flight = 0;   // Sum of raw file sizes being decoded, 0: no limit
+  prefetch_options_t prefetch;      // Read ahead of the files being decoded
+};
+
+/*
+ * Decodes every file on options.pool: files run concurrently with each other
+ * and each decode's stages spread over the same threads, so one large file
+ * does not leave the pool idle at the end of a batch. A file is started only
+ * while the count and file size admitted stay under the batch limits (one
+ * file is always admitted, however large). Returns false if any file failed.
+ */
+bool decode_many(const std::vector<std::string>& paths, const decode_options_t& options,
+                 const decode_callback_t& callback, const batch_options_t& batch_options = batch_options_t());
+
+/*
+ * Metadata scan: open_raw() on every file, same scheduling as decode_many().
+ * Read ahead covers only the header region, prefetch.header_bytes or
+ * PREFETCH_HEADER_BYTES if that is 0.
+ */
+bool open_many(const std::vector<std::string>& paths, ThreadPool* pool,
+               const open_callback_t& callback, const batch_options_t& batch_options = batch_options_t());
+
+#endif
@@ -0,0 +1,132 @@
+#include "camera_raw.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+enum class Camera_Maker {
+  UNKNOWN,
+  NIKON,
+  CANON
+};
+
+static Camera_Maker get_maker_from_name(const char* name) {
+  if (!strncasecmp(name, "Nikon", 5)) return Camera_Maker::NIKON;
+  if (!strncasecmp(name, "Canon", 5)) return Camera_Maker::CANON;
+  return Camera_Maker::UNKNOWN;
+}
+
+static Camera_Maker identify_maker(std::ifstream& file) {
+  char header[16] = { 0 };
+  char make[64] = { 0 };
+  u_int16_t bitorder;
+
+  if (!file.read(header, sizeof(header))) {
+    return Camera_Maker::UNKNOWN;
+  }
+  if (!memcmp(header + 4, "ftypcrx ", 8)) {
+    return Camera_Maker::CANON;     // CR3
+  }
+  if ((memcmp(header, "II", 2) && memcmp(header, "MM", 2))) {
+    return Camera_Maker::UNKNOWN;
+  }
+  if (!memcmp(header + 8, "CR", 2)) {
+    return Camera_Maker::CANON;     // CR2
+  }
+
+  // Make (271) from IFD0
+  file.seekg(0, std::ios::beg);
+  bitorder = read_2_bytes_unsigned(file, 0x4949);
+  read_2_bytes_unsigned(file, bitorder);
+  file.seekg(read_4_bytes_unsigned(file, bitorder), std::ios::beg);
+  u_int n_entries = read_2_bytes_unsigned(file, bitorder);
+  for (u_int i = 0; i < n_entries && file; ++i) {
+    u_int tag = read_2_bytes_unsigned(file, bitorder);
+    read_2_bytes_unsigned(file, bitorder);
+    u_int count = read_4_bytes_unsigned(file, bitorder);
+    u_int value = read_4_bytes_unsigned(file, bitorder);
+    if (tag != 271) {
+      continue;
+    }
+    if (count > 4) {
+      file.seekg(value, std::ios::beg);
+    } else {
+      file.seekg(-4, std::ios::cur);
+    }
+    file.read(make, std::min(count, (u_int)sizeof(make) - 1));
+    return get_maker_from_name(make);
+  }
+  return Camera_Maker::UNKNOWN;
+}
+
+static Camera_Maker identify_maker(std::streambuf* buffer) {
+  std::ifstream file;
+  file.std::ios::rdbuf(buffer);
+  return identify_maker(file);
+}
+
+static Camera_Maker get_maker_from_extension(const std::string& file_path) {
+  size_t dot = file_path.rfind('.');
+  if (dot == std::string::npos) {
+    return Camera_Maker::UNKNOWN;
+  }
+  const char* extension = file_path.c_str() + dot + 1;
+  if (!strcasecmp(extension, "nef") || !strcasecmp(extension, "nrw")) return Camera_Maker::NIKON;
+  if (!strcasecmp(extension, "cr2") || !strcasecmp(extension, "cr3")) return Camera_Maker::CANON;
+  return Camera_Maker::UNKNOWN;
+}
+
+RawImageData* open_camera_raw(const std::string& file_path) {
+  struct stat st;
+  std::unique_ptr<StreamReader> stream;
+  Camera_Maker maker = Camera_Maker::UNKNOWN;
+
+  if (stat(file_path.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) {
+    // A pipe is peeked through the reader the parser then gets, which still holds the header
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "ERROR: Unable to open stream: %s\n", file_path.c_str());
+      return nullptr;
+    }
+    stream.reset(new StreamReader(fd));
+    maker = identify_maker(stream.get());
+  } else {
+    std::filebuf buffer;
+    if (buffer.open(file_path, std::ios::in | std::ios::binary)) {
+      maker = identify_maker(&buffer);
+    }
+  }
+  if (maker == Camera_Maker::UNKNOWN) {
+    maker = get_maker_from_extension(file_path);
+  }
+
+  try {
+    switch (maker) {
+      case Camera_Maker::NIKON:
+        return stream ? new NikonRaw(file_path, std::move(stream)) : new NikonRaw(file_path);
+      case Camera_Maker::CANON:
+        return stream ? new CanonRaw(file_path, std::move(stream)) : new CanonRaw(file_path);
+      default:
+        break;
+    }
+  } catch (const std::runtime_error& error) {
+    fprintf(stderr, "ERROR: %s\n", error.what());
+    return nullptr;
+  }
+  fprintf(stderr, "ERROR: Unknown camera maker: %s\n", file_path.c_str());
+  return nullptr;
+}
+
+RawImageData* open_camera_raw(const void* data, size_t size) {
+  MemoryReader reader(data, size);
+
+  switch (identify_maker(&reader)) {
+    case Camera_Maker::NIKON:
+      return new NikonRaw(data, size);
+    case Camera_Maker::CANON:
+      return new CanonRaw(data, size);
+    default:
+      break;
+  }
+  fprintf(stderr, "ERROR: Unknown camera maker in memory buffer\n");
+  return nullptr;
+}
@@ -0,0 +1,17 @@
+#ifndef CAMERA_RAW_H
+#define CAMERA_RAW_H
+
+#include "nikon_raw.h"
+#include "canon_raw.h"
+
+/*
+ * Creates the parser for a raw file from the maker signature in its header
+ * (TIFF Make tag, CR2/CR3 magic), falling back to the file extension.
+ * Returns nullptr if the file cannot be opened or the maker is unknown.
+ * Pipes and sockets are peeked through the stream reader the parser keeps.
+ */
+RawImageData* open_camera_raw(const std::string& file_path);
+/* Same for a file already in memory, which must outlive the parser */
+RawImageData* open_camera_raw(const void* data, size_t size);
+
+#endif
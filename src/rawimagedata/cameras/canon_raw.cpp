@@ -2,6 +2,8 @@
 #include "canon_raw.h"
 
 CanonRaw :: CanonRaw(const std::string& filepath) : RawImageData(filepath) {}
+CanonRaw :: CanonRaw(const void* data, size_t size) : RawImageData(data, size) {}
+CanonRaw :: CanonRaw(const std::string& filepath, std::unique_ptr<StreamReader> stream) : RawImageData(filepath, std::move(stream)) {}
 CanonRaw :: ~CanonRaw(){}
 
 bool CanonRaw :: load_raw_data() {
@@ -14,7 +16,7 @@ bool CanonRaw :: parse_makernote(u_int ifd, off_t raw_data_base, int uptag) {
   
   file.read(maker_magic, 10);
   if (strncasecmp(maker_magic, "Nikon", 6)) {
-    fprintf(stderr, "ERROR: Makernote Conflict: %s, was given %s\n", raw_data.ifds[ifd].exif.camera_make, maker_magic);
+    fprintf(stderr, "ERROR: Makernote Conflict: %s, was given %s\n", raw_data.tags.get_string(Tag_Space::IFD, 271), maker_magic);
     return false;
   }
   
@@ -31,6 +33,7 @@ bool CanonRaw :: parse_makernote(u_int ifd, off_t raw_data_base, int uptag) {
 
   bitorder = raw_data.bitorder;
   n_tag_entries = read_2_bytes_unsigned(file, raw_data.bitorder);
+  plan_ifd_reads(base, n_tag_entries);
 
   for (u_int i = 0; i < n_tag_entries; ++i) {
     raw_data.bitorder = bitorder;
@@ -47,11 +50,12 @@ void CanonRaw :: parse_markernote_tag(u_int ifd, off_t raw_data_base, int uptag)
   u_int tag_id, tag_type, tag_count;
   off_t tag_data_offset, tag_offset;
   get_tag_header(raw_data_base, &tag_id, &tag_type, &tag_count, &tag_offset);
-  printf("Makernote tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
+  DEBUG_PRINT("Makernote tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
   tag_data_offset = get_tag_data_offset(raw_data_base, tag_type, tag_count);  
+  store_tag(Tag_Space::MAKERNOTE, ifd, tag_id, tag_type, tag_count, tag_data_offset);
   jpeg_info_t jh;
   char buffer[16] = { 0 };
-  u_int n, serial = 0;
+  u_int n;
   file.seekg(tag_data_offset, std::ios::beg); // Jump to data offset
   switch (tag_id) {
     case 0x0002:  // Exif.Nikon3.ISOSpeed (First Value: 0, Second Value: ISO Speed)
@@ -71,16 +75,10 @@ void CanonRaw :: parse_markernote_tag(u_int ifd, off_t raw_data_base, int uptag)
     case 0x0011:  // Exif.Nikon3.Preview
       // Thumbnail as lossy jpeg embedded in tiff_ifd format
       file.seekg(get_tag_value(tag_type) + raw_data_base, std::ios::beg);
-      printf("Parse makernote offset: %d\n", file.tellg());
+      DEBUG_PRINT("Parse makernote offset: %d\n", (int)file.tellg());
       parse_raw_data_ifd(raw_data_base);
       break;
-    case 0x001d:  // Exif.Nikon3.SerialNumber
-      if (tag_count > 16) {
-        fprintf(stderr, "ERROR: Makernote 0x001d: tag_count Exceeded 16: %d\n", tag_count);
-        break;
-      }
-      file.read(buffer, tag_count);
-      serial = std::stoi(buffer, 0, 10);
+    case 0x001d:  // Exif.Nikon3.SerialNumber, a string kept in raw_data.tags
       break;
     case 0x003d:  // Exif.Nikon3.CBlack
       if (tag_type == 3 && tag_count == 4) {
@@ -105,12 +103,12 @@ void CanonRaw :: parse_markernote_tag(u_int ifd, off_t raw_data_base, int uptag)
     case 0x008c:  // Exif.Nikon3.ContrastCurve
     case 0x0096:  // Exif.Nikon3.LinearizationTable
       raw_data.ifds[ifd].meta_offset = file.tellg();
-      printf("Meta Offset: %d\n", raw_data.ifds[ifd].meta_offset);
+      DEBUG_PRINT("Meta Offset: %d\n", raw_data.ifds[ifd].meta_offset);
       break;
     case 0x0097:  // Exif.Nikon3.ColorBalance
       file.read(buffer, 4);
       n = std::stoi(buffer, 0, 10);
-      printf("Colour balance ver: %d\n", n);
+      DEBUG_PRINT("Colour balance ver: %d\n", n);
       break;
     case 0x00a5:  // Exif.Nikon3.ImageCount
       raw_data.ifds[ifd].exif.image_count = get_tag_value(tag_type);
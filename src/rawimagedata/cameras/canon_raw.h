@@ -7,6 +7,8 @@ class CanonRaw : public RawImageData {
 
 public:
   CanonRaw(const std::string& filepath);
+  CanonRaw(const void* data, size_t size);
+  CanonRaw(const std::string& filepath, std::unique_ptr<StreamReader> stream);
   ~CanonRaw();
 
   bool load_raw_data() override;
@@ -7,6 +7,8 @@ class NikonRaw : public RawImageData {
 
 public:
   NikonRaw(const std::string& filepath);
+  NikonRaw(const void* data, size_t size);
+  NikonRaw(const std::string& filepath, std::unique_ptr<StreamReader> stream);
   ~NikonRaw();
 
 private:
@@ -0,0 +1,206 @@
+#include "colour.h"
+#include "cpu_dispatch.h"
+
+#include <cmath>
+#include <mutex>
+
+#define COLOUR_BAND_ROWS 64
+#define COLOUR_BLOCK_COLS 256
+
+static const double XYZ_RGB[3][3] = {   // sRGB (D65) to XYZ
+  { 0.412453, 0.357580, 0.180423 },
+  { 0.212671, 0.715160, 0.072169 },
+  { 0.019334, 0.119193, 0.950227 }
+};
+
+struct colour_lut_t {
+  std::vector<u_int8_t> lut8;
+  std::vector<u_int16_t> lut16;
+  std::vector<float> lutf;
+};
+
+const camera_matrix_t* find_camera_matrix(const char* make, const char* model) {
+  char name[64];
+  size_t make_length, length;
+
+  for (const camera_matrix_t& matrix : CAMERA_MATRICES) {
+    make_length = strlen(matrix.make);
+    if (strncasecmp(make, matrix.make, make_length)) {
+      continue;
+    }
+    // Models usually repeat the make: "NIKON D750", "Canon EOS R"
+    const char* p = model;
+    if (!strncasecmp(p, matrix.make, make_length)) {
+      p += make_length;
+    }
+    while (*p == ' ') ++p;
+    strncpy(name, p, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    for (length = strlen(name); length > 0 && name[length - 1] == ' '; --length) {
+      name[length - 1] = 0;
+    }
+    if (!strcasecmp(name, matrix.model)) {
+      return &matrix;
+    }
+  }
+  return nullptr;
+}
+
+static bool invert_3x3(const double in[3][3], double out[3][3]) {
+  double det = in[0][0] * (in[1][1] * in[2][2] - in[1][2] * in[2][1]) -
+               in[0][1] * (in[1][0] * in[2][2] - in[1][2] * in[2][0]) +
+               in[0][2] * (in[1][0] * in[2][1] - in[1][1] * in[2][0]);
+  if (fabs(det) < 1e-12) {
+    return false;
+  }
+  for (u_int i = 0; i < 3; ++i) {
+    for (u_int j = 0; j < 3; ++j) {
+      u_int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+      out[i][j] = (in[i1][j1] * in[i2][j2] - in[i1][j2] * in[i2][j1]) / det;
+    }
+  }
+  return true;
+}
+
+bool get_rgb_cam(const char* make, const char* model, float rgb_cam[3][3]) {
+  const camera_matrix_t* matrix = find_camera_matrix(make, model);
+  double cam_rgb[3][3], inverse[3][3], sum;
+
+  for (u_int i = 0; i < 3; ++i) {
+    for (u_int j = 0; j < 3; ++j) {
+      rgb_cam[i][j] = i == j;
+    }
+  }
+  if (matrix == nullptr) {
+    return false;
+  }
+
+  // cam_rgb = cam_xyz * xyz_rgb, rows normalised so sRGB white maps to camera white
+  for (u_int i = 0; i < 3; ++i) {
+    sum = 0;
+    for (u_int j = 0; j < 3; ++j) {
+      cam_rgb[i][j] = 0;
+      for (u_int k = 0; k < 3; ++k) {
+        cam_rgb[i][j] += matrix->cam_xyz[i * 3 + k] / 10000.0 * XYZ_RGB[k][j];
+      }
+      sum += cam_rgb[i][j];
+    }
+    for (u_int j = 0; j < 3; ++j) {
+      cam_rgb[i][j] /= sum;
+    }
+  }
+  if (!invert_3x3(cam_rgb, inverse)) {
+    return false;
+  }
+  for (u_int i = 0; i < 3; ++i) {
+    for (u_int j = 0; j < 3; ++j) {
+      rgb_cam[i][j] = inverse[i][j];
+    }
+  }
+  return true;
+}
+
+u_int get_output_sample_bytes(Output_Format format) {
+  switch (format) {
+    case Output_Format::RGB8:   return 1;
+    case Output_Format::RGB16:  return 2;
+    case Output_Format::FLOAT:  return 4;
+  }
+  return 1;
+}
+
+static const colour_lut_t& get_colour_lut(Transfer_Curve curve) {
+  static colour_lut_t luts[2];
+  static std::once_flag lut_flags[2];
+  u_int index = curve == Transfer_Curve::SRGB ? 0 : 1;
+
+  std::call_once(lut_flags[index], [curve](colour_lut_t* lut) {
+    lut->lut8.resize(0x10000);
+    lut->lut16.resize(0x10000);
+    lut->lutf.resize(0x10000);
+    for (u_int i = 0; i < 0x10000; ++i) {
+      double v = i / 65535.0;
+      if (curve == Transfer_Curve::SRGB) {
+        v = v <= 0.0031308 ? 12.92 * v : 1.055 * pow(v, 1 / 2.4) - 0.055;
+      }
+      lut->lut8[i] = (u_int8_t)lrint(v * 255);
+      lut->lut16[i] = (u_int16_t)lrint(v * 65535);
+      lut->lutf[i] = (float)v;
+    }
+  }, &luts[index]);
+  return luts[index];
+}
+
+bool convert_colour(const RawImage& rgb, RawImage& output, const float rgb_cam[3][3], const colour_options_t& options) {
+  u_int sample_bytes = get_output_sample_bytes(options.format);
+  if (rgb.channels != 3 || rgb.sample_bytes != 2) {
+    fprintf(stderr, "ERROR: Colour conversion needs 16 bit RGB input\n");
+    return false;
+  }
+  u_int width, height;
+  get_oriented_size(options.orientation, rgb.width, rgb.height, &width, &height);
+  if (output.empty() || output.width != width || output.height != height || output.channels != 3 || output.sample_bytes != sample_bytes) {
+    output = RawImage(width, height, 3, sample_bytes);
+    if (output.empty()) {
+      return false;
+    }
+  }
+  output.white = options.format == Output_Format::RGB8 ? 0xff : options.format == Output_Format::RGB16 ? 0xffff : 1;
+
+  // Input is scaled to 16 bit full scale, fold that into the matrix
+  float m[3][3];
+  float scale = rgb.white ? 65535.0f / rgb.white : 1;
+  for (u_int i = 0; i < 3; ++i) {
+    for (u_int j = 0; j < 3; ++j) {
+      m[i][j] = rgb_cam[i][j] * scale;
+    }
+  }
+
+  const colour_lut_t& lut = get_colour_lut(options.curve);
+  const kernel_table_t& kernels = get_kernels();
+  u_int n_bands = (rgb.height + COLOUR_BAND_ROWS - 1) / COLOUR_BAND_ROWS;
+  auto convert_rows = [&](const RawImage& src, RawImage& dest) {
+    for (u_int y = 0; y < src.height; ++y) {
+      switch (options.format) {
+        case Output_Format::RGB8:
+          kernels.convert_colour_row_8(src.row(y), dest.row<u_int8_t>(y), src.width, m, lut.lut8.data());
+          break;
+        case Output_Format::RGB16:
+          kernels.convert_colour_row_16(src.row(y), dest.row<u_int16_t>(y), src.width, m, lut.lut16.data());
+          break;
+        case Output_Format::FLOAT:
+          kernels.convert_colour_row_float(src.row(y), dest.row<float>(y), src.width, m, lut.lutf.data());
+          break;
+      }
+    }
+  };
+  auto run_band = [&](u_int band) {
+    u_int y = band * COLOUR_BAND_ROWS;
+    RawImage src = rgb.view(0, y, rgb.width, COLOUR_BAND_ROWS);
+    if (options.orientation <= 1 || options.orientation > 8) {
+      RawImage dest = output.view(0, y, output.width, COLOUR_BAND_ROWS);
+      convert_rows(src, dest);
+      return;
+    }
+    static thread_local RawImage block;
+    if (block.empty() || block.sample_bytes != sample_bytes) {
+      MemoryAccountScope unaccounted(nullptr);   // Outlives the decode, kept per thread
+      block = RawImage(COLOUR_BLOCK_COLS, COLOUR_BAND_ROWS, 3, sample_bytes);
+    }
+    for (u_int x = 0; x < rgb.width; x += COLOUR_BLOCK_COLS) {
+      RawImage src_block = src.view(x, 0, COLOUR_BLOCK_COLS, COLOUR_BAND_ROWS);
+      RawImage dest_block = block.view(0, 0, src_block.width, src_block.height);
+      convert_rows(src_block, dest_block);
+      orient_copy(dest_block, output, x, y, rgb.width, rgb.height, options.orientation);
+    }
+  };
+
+  if (options.pool != nullptr) {
+    options.pool->parallel_for(0, n_bands, run_band);
+  } else {
+    for (u_int band = 0; band < n_bands; ++band) {
+      run_band(band);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,72 @@
+#ifndef COLOUR_H
+#define COLOUR_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+#include "orientation.h"
+
+enum class Output_Format {
+  RGB8,
+  RGB16,
+  FLOAT       // 32 bit float RGB, 0 - 1
+};
+
+enum class Transfer_Curve {
+  SRGB,
+  LINEAR
+};
+
+struct camera_matrix_t {
+  const char* make;
+  const char* model;
+  short cam_xyz[9];           // XYZ (D65) to camera, * 10000
+};
+
+/*
+ * Built-in colour matrices (Adobe DNG converter ColorMatrix2 values).
+ * Model names are given without the make prefix.
+ */
+constexpr camera_matrix_t CAMERA_MATRICES[] = {
+  { "Nikon", "D3",            { 8139, -2171, -663, -8747, 16541, 2295, -1925, 2008, 8093 } },
+  { "Nikon", "D90",           { 7309, -1403, -519, -8474, 16008, 2622, -2434, 2826, 8064 } },
+  { "Nikon", "D700",          { 8139, -2171, -663, -8747, 16541, 2295, -1925, 2008, 8093 } },
+  { "Nikon", "D750",          { 9020, -2890, -715, -4535, 12436, 2348, -934, 1919, 7086 } },
+  { "Nikon", "D800",          { 7866, -2108, -555, -4869, 12483, 2681, -1176, 2069, 7501 } },
+  { "Nikon", "D810",          { 9369, -3195, -791, -4488, 12430, 2301, -893, 1796, 6872 } },
+  { "Nikon", "D850",          { 10405, -3755, -1270, -5461, 13787, 1793, -1040, 2015, 6785 } },
+  { "Nikon", "D5300",         { 6988, -1384, -714, -5631, 13410, 2447, -1485, 2204, 7318 } },
+  { "Nikon", "D7000",         { 8198, -2239, -724, -4871, 12389, 2798, -1043, 2050, 7181 } },
+  { "Nikon", "Z 7",           { 10405, -3755, -1270, -5461, 13787, 1793, -1040, 2015, 6785 } },
+  { "Canon", "EOS 5D Mark III", { 6722, -635, -963, -4287, 12460, 2028, -908, 2162, 5668 } },
+  { "Canon", "EOS 5D Mark IV",  { 6446, -366, -864, -4436, 12204, 2513, -952, 2496, 6348 } },
+  { "Canon", "EOS 6D",        { 7034, -804, -1014, -4420, 12564, 2058, -851, 1994, 5758 } },
+  { "Canon", "EOS R",         { 6446, -366, -864, -4436, 12204, 2513, -952, 2496, 6348 } },
+};
+
+struct colour_options_t {
+  Output_Format format = Output_Format::RGB8;
+  Transfer_Curve curve = Transfer_Curve::SRGB;
+  int orientation = 1;        // EXIF orientation applied while writing
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+};
+
+const camera_matrix_t* find_camera_matrix(const char* make, const char* model);
+bool get_rgb_cam(const char* make, const char* model, float rgb_cam[3][3]);
+
+u_int get_output_sample_bytes(Output_Format format);
+
+/*
+ * Camera RGB (white balanced, 16 bit linear) to output RGB in one pass:
+ * 3x3 matrix, clip, transfer curve LUT and conversion to the output format.
+ * With an orientation set, blocks are converted into a cache resident
+ * scratch block and written rotated, instead of a separate rotate pass.
+ */
+bool convert_colour(const RawImage& rgb, RawImage& output, const float rgb_cam[3][3], const colour_options_t& options);
+
+#endif
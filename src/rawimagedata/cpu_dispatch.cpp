@@ -0,0 +1,70 @@
+#include "cpu_dispatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Cpu_Level detect_cpu_level() {
+  Cpu_Level level = Cpu_Level::BASELINE;
+#if defined(RAWIMAGEDATA_DISPATCH)
+  // F16C, LZCNT and MOVBE come with BMI2 on every x86-64-v3 part
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+      __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")) {
+    level = Cpu_Level::X86_64_V3;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512cd") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+      level = Cpu_Level::X86_64_V4;
+    }
+  }
+#endif
+
+  const char* cap = getenv("RAWIMAGEDATA_CPU");
+  if (cap != nullptr && cap[0] != 0) {
+    if (strcmp(cap, "baseline") == 0) {
+      level = Cpu_Level::BASELINE;
+    } else if (strcmp(cap, "v3") == 0) {
+      level = level > Cpu_Level::X86_64_V3 ? Cpu_Level::X86_64_V3 : level;
+    } else if (strcmp(cap, "v4") != 0) {
+      fprintf(stderr, "ERROR: Unknown RAWIMAGEDATA_CPU level %s, expected baseline, v3 or v4\n", cap);
+    }
+  }
+  return level;
+}
+
+Cpu_Level get_cpu_level() {
+  static const Cpu_Level level = detect_cpu_level();
+  return level;
+}
+
+const char* get_cpu_level_name(Cpu_Level level) {
+  switch (level) {
+    case Cpu_Level::BASELINE:   return "baseline";
+    case Cpu_Level::X86_64_V3:  return "x86-64-v3";
+    case Cpu_Level::X86_64_V4:  return "x86-64-v4";
+  }
+  return "baseline";
+}
+
+static kernel_table_t make_kernel_table() {
+  kernel_table_t table;
+  switch (get_cpu_level()) {
+#if defined(RAWIMAGEDATA_DISPATCH)
+    case Cpu_Level::X86_64_V4:
+      init_kernels_v4(&table);
+      break;
+    case Cpu_Level::X86_64_V3:
+      init_kernels_v3(&table);
+      break;
+#endif
+    default:
+      init_kernels_baseline(&table);
+      break;
+  }
+  return table;
+}
+
+const kernel_table_t& get_kernels() {
+  static const kernel_table_t table = make_kernel_table();
+  return table;
+}
@@ -0,0 +1,60 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Runtime ISA selection for the pixel kernels. cpu_kernels.cpp is built
+ * once per x86-64 level and the highest level this CPU runs fills the
+ * kernel table, once, the first time it is asked for. One binary then
+ * serves machines with and without AVX2 or AVX-512, no -march=native.
+ * RAWIMAGEDATA_CPU=baseline|v3|v4 in the environment caps the level.
+ */
+enum class Cpu_Level {
+  BASELINE,     // Compiler default target (x86-64: SSE2)
+  X86_64_V3,    // AVX2, FMA, BMI1/2
+  X86_64_V4     // AVX-512 F, BW, CD, DQ, VL
+};
+
+/* Demosaic tile planes, sized by demosaic_raw_image(). Pixel (0, 0) is the halo corner */
+struct demosaic_planes_t {
+  u_int w, h;                 // Tile with halo
+  u_int halo;
+  u_int cfa;
+  const u_int16_t* raw;       // w * h mosaic
+  u_int16_t* img;             // w * h * 3, only the site colour set (PPG output)
+  u_int16_t* rgb;             // w * h * 3 output (and AHD direction 0)
+  u_int16_t* rgb_v;           // AHD direction 1
+  int16_t* lab;               // AHD CIELab, 2 * w * h * 3
+  u_char* homo;               // AHD homogeneity, 2 * w * h
+  u_int16_t* rows;            // Bilinear row temporaries, w * 4
+  const float* cbrt;          // AHD cube root table, 0x10000 entries
+  float xyz_cam[3][3];        // AHD camera to XYZ over D65 white
+};
+
+struct kernel_table_t {
+  Cpu_Level level;
+  void (*unpack_16_bits)(const u_char* s, u_int16_t* dest, size_t count, uint16_t bitorder);
+  void (*unpack_bits_msb)(const u_char* s, u_int16_t* dest, size_t count, u_int bps);
+  void (*normalise_row)(const u_int16_t* src, u_int16_t* dest, u_int count, const u_int black[2], const float scale[2], u_int out_max);
+  void (*convert_colour_row_8)(const u_int16_t* src, u_int8_t* dest, u_int width, const float m[3][3], const u_int8_t* lut);
+  void (*convert_colour_row_16)(const u_int16_t* src, u_int16_t* dest, u_int width, const float m[3][3], const u_int16_t* lut);
+  void (*convert_colour_row_float)(const u_int16_t* src, float* dest, u_int width, const float m[3][3], const float* lut);
+  void (*bilinear_tile)(const demosaic_planes_t* tile);
+  void (*ppg_tile)(const demosaic_planes_t* tile);
+  void (*ahd_tile)(const demosaic_planes_t* tile);
+};
+
+/* Highest level this CPU supports among the levels built */
+Cpu_Level get_cpu_level();
+const char* get_cpu_level_name(Cpu_Level level);
+const kernel_table_t& get_kernels();
+
+/* Table fillers, one per level built from cpu_kernels.cpp */
+void init_kernels_baseline(kernel_table_t* table);
+void init_kernels_v3(kernel_table_t* table);
+void init_kernels_v4(kernel_table_t* table);
+
+#endif
@@ -0,0 +1,428 @@
+#include "cpu_dispatch.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Pixel kernels, compiled once per ISA level (CPU_KERNEL_INIT names the
+ * table filler of each build). Everything here is static and nothing from
+ * a C++ header is used: an out of line inline function or template would
+ * be emitted by every level, and the linker may keep the copy built for
+ * the highest one.
+ */
+
+#ifndef CPU_KERNEL_INIT
+#define CPU_KERNEL_INIT init_kernels_baseline
+#define CPU_KERNEL_LEVEL Cpu_Level::BASELINE
+#endif
+
+#define DM_CLIP(x) ((x) < 0 ? 0 : (x) > 0xffff ? 0xffff : (x))
+#define DM_ULIM(x, y, z) ((y) < (z) ? min_i(max_i((x), (y)), (z)) : min_i(max_i((x), (z)), (y)))
+
+static inline int min_i(int a, int b) { return a < b ? a : b; }
+static inline int max_i(int a, int b) { return a > b ? a : b; }
+static inline u_int min_u(u_int a, u_int b) { return a < b ? a : b; }
+static inline u_int max_u(u_int a, u_int b) { return a > b ? a : b; }
+
+/* Same as cfa_colour() in rawimage.h */
+static inline u_int cfa_colour(u_int cfa, u_int row, u_int col) {
+  return cfa >> ((((row << 1) & 14) | (col & 1)) << 1) & 3;
+}
+
+/* ================ Unpacking ================ */
+
+static void unpack_16_bits(const u_char *s, u_int16_t *dest, size_t count, uint16_t bitorder) {
+  if (bitorder == 0x4D4D) {
+    for (size_t i = 0; i < count; ++i) {
+      dest[i] = s[2 * i] << 8 | s[2 * i + 1];
+    }
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      dest[i] = s[2 * i] | s[2 * i + 1] << 8;
+    }
+  }
+}
+
+static void unpack_bits_msb(const u_char *s, u_int16_t *dest, size_t count, u_int bps) {
+  // s must be readable for ceil(count * bps / 8) bytes
+  u_int64_t bit_buffer = 0;
+  u_int bits = 0, mask = (1 << bps) - 1;
+  for (size_t i = 0; i < count; ++i) {
+    while (bits < bps) {
+      bit_buffer = bit_buffer << 8 | *s++;
+      bits += 8;
+    }
+    bits -= bps;
+    dest[i] = (bit_buffer >> bits) & mask;
+  }
+}
+
+/* ================ Normalise ================ */
+
+static void normalise_row(const u_int16_t* src, u_int16_t* dest, u_int count, const u_int black[2], const float scale[2], u_int out_max) {
+  u_int x = 0;
+  float value;
+
+#if defined(__AVX512BW__)
+  const __m512i black_w = _mm512_set1_epi32(black[0] | black[1] << 16);
+  const __m512 scale_w = _mm512_setr4_ps(scale[0], scale[1], scale[0], scale[1]);
+  const __m512 max_w = _mm512_set1_ps((float)out_max);
+  const __m512i zero_w = _mm512_setzero_si512();
+  for (; x + 32 <= count; x += 32) {
+    __m512i v = _mm512_loadu_si512(src + x);
+    v = _mm512_subs_epu16(v, black_w);
+    // Same per 128 bit lane order as the AVX2 loop
+    __m512 lo = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_unpacklo_epi16(v, zero_w)), scale_w);
+    __m512 hi = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_unpackhi_epi16(v, zero_w)), scale_w);
+    lo = _mm512_min_ps(lo, max_w);
+    hi = _mm512_min_ps(hi, max_w);
+    v = _mm512_packus_epi32(_mm512_cvtps_epi32(lo), _mm512_cvtps_epi32(hi));
+    _mm512_storeu_si512(dest + x, v);
+  }
+#endif
+#if defined(__AVX2__)
+  const __m256i black_v = _mm256_set1_epi32(black[0] | black[1] << 16);
+  const __m256 scale_v = _mm256_setr_ps(scale[0], scale[1], scale[0], scale[1], scale[0], scale[1], scale[0], scale[1]);
+  const __m256 max_v = _mm256_set1_ps((float)out_max);
+  const __m256i zero = _mm256_setzero_si256();
+  for (; x + 16 <= count; x += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+    v = _mm256_subs_epu16(v, black_v);
+    // unpack/pack work per 128 bit lane, so the lane order is preserved
+    __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(v, zero)), scale_v);
+    __m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(v, zero)), scale_v);
+    lo = _mm256_min_ps(lo, max_v);
+    hi = _mm256_min_ps(hi, max_v);
+    v = _mm256_packus_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + x), v);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i black_s = _mm_set1_epi32(black[0] | black[1] << 16);
+  const __m128 scale_s = _mm_setr_ps(scale[0], scale[1], scale[0], scale[1]);
+  const __m128 max_s = _mm_set1_ps((float)out_max);
+  const __m128i zero_s = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi32(0x8000);
+  for (; x + 8 <= count; x += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    v = _mm_subs_epu16(v, black_s);
+    __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero_s)), scale_s);
+    __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero_s)), scale_s);
+    lo = _mm_min_ps(lo, max_s);
+    hi = _mm_min_ps(hi, max_s);
+    // SSE2 only has a signed 32 -> 16 pack, bias into signed range and back
+    v = _mm_packs_epi32(_mm_sub_epi32(_mm_cvtps_epi32(lo), bias), _mm_sub_epi32(_mm_cvtps_epi32(hi), bias));
+    v = _mm_xor_si128(v, _mm_set1_epi16((short)0x8000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), v);
+  }
+#endif
+  for (; x < count; ++x) {
+    value = (src[x] > black[x & 1] ? src[x] - black[x & 1] : 0) * scale[x & 1];
+    dest[x] = value < out_max ? (u_int16_t)lrintf(value) : out_max;
+  }
+}
+
+/* ================ Colour ================ */
+
+template <typename T>
+static void convert_colour_row(const u_int16_t* src, T* dest, u_int width, const float m[3][3], const T* lut) {
+  u_int x = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max = _mm_set1_ps(65535.0f);
+  int32_t index[12];
+  for (; x + 4 <= width; x += 4) {
+    const u_int16_t* s = src + x * 3;
+    __m128 r = _mm_setr_ps(s[0], s[3], s[6], s[9]);
+    __m128 g = _mm_setr_ps(s[1], s[4], s[7], s[10]);
+    __m128 b = _mm_setr_ps(s[2], s[5], s[8], s[11]);
+    for (u_int c = 0; c < 3; ++c) {
+      __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(m[c][0])), _mm_mul_ps(g, _mm_set1_ps(m[c][1]))),
+                            _mm_mul_ps(b, _mm_set1_ps(m[c][2])));
+      v = _mm_min_ps(_mm_max_ps(v, zero), max);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&index[c * 4]), _mm_cvtps_epi32(v));
+    }
+    T* d = dest + x * 3;
+    for (u_int i = 0; i < 4; ++i) {
+      d[i * 3 + 0] = lut[index[i]];
+      d[i * 3 + 1] = lut[index[4 + i]];
+      d[i * 3 + 2] = lut[index[8 + i]];
+    }
+  }
+#endif
+  for (; x < width; ++x) {
+    const u_int16_t* s = src + x * 3;
+    for (u_int c = 0; c < 3; ++c) {
+      float v = m[c][0] * s[0] + m[c][1] * s[1] + m[c][2] * s[2];
+      dest[x * 3 + c] = lut[(int)lrintf(v < 0 ? 0.0f : v > 65535.0f ? 65535.0f : v)];
+    }
+  }
+}
+
+/* ================ Demosaic tiles ================ */
+
+static void init_tile_img(const demosaic_planes_t* tile) {
+  size_t n = (size_t)tile->w * tile->h;
+  memset(tile->img, 0, n * 3 * sizeof(u_int16_t));
+  for (u_int y = 0; y < tile->h; ++y) {
+    for (u_int x = 0; x < tile->w; ++x) {
+      size_t i = (size_t)y * tile->w + x;
+      tile->img[i * 3 + cfa_colour(tile->cfa, y, x)] = tile->raw[i];
+    }
+  }
+}
+
+/* ================ Bilinear ================ */
+
+static void average_rows(const u_int16_t* up, const u_int16_t* mid, const u_int16_t* down,
+                         u_int16_t* horiz, u_int16_t* vert, u_int16_t* cross, u_int16_t* diag, u_int count) {
+  // Neighbour averages for x = 1 .. count - 2
+  u_int x = 1;
+#if defined(__SSE2__)
+  for (; x + 8 < count; x += 8) {
+    __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + x - 1));
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + x + 1));
+    __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+    __m128i ul = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x - 1));
+    __m128i ur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x + 1));
+    __m128i dl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x - 1));
+    __m128i dr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x + 1));
+    __m128i h = _mm_avg_epu16(l, r);
+    __m128i v = _mm_avg_epu16(u, d);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(horiz + x), h);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vert + x), v);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(cross + x), _mm_avg_epu16(h, v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(diag + x), _mm_avg_epu16(_mm_avg_epu16(ul, ur), _mm_avg_epu16(dl, dr)));
+  }
+#endif
+  for (; x + 1 < count; ++x) {
+    horiz[x] = (mid[x - 1] + mid[x + 1] + 1) >> 1;
+    vert[x] = (up[x] + down[x] + 1) >> 1;
+    cross[x] = (horiz[x] + vert[x] + 1) >> 1;
+    diag[x] = (((up[x - 1] + up[x + 1] + 1) >> 1) + ((down[x - 1] + down[x + 1] + 1) >> 1) + 1) >> 1;
+  }
+}
+
+static void bilinear_tile(const demosaic_planes_t* tile) {
+  u_int w = tile->w, halo = tile->halo;
+  u_int16_t* horiz = &tile->rows[0];
+  u_int16_t* vert = &tile->rows[w];
+  u_int16_t* cross = &tile->rows[w * 2];
+  u_int16_t* diag = &tile->rows[w * 3];
+
+  for (u_int y = halo; y + halo < tile->h; ++y) {
+    const u_int16_t* mid = &tile->raw[(size_t)y * w];
+    average_rows(mid - w, mid, mid + w, horiz, vert, cross, diag, w);
+
+    // Per column parity, where each output channel comes from
+    const u_int16_t* src[2][3];
+    for (u_int p = 0; p < 2; ++p) {
+      u_int c = cfa_colour(tile->cfa, y, p);
+      src[p][c] = mid;
+      if (c == 1) {
+        u_int hc = cfa_colour(tile->cfa, y, p + 1);
+        src[p][hc] = horiz;
+        src[p][2 - hc] = vert;
+      } else {
+        src[p][1] = cross;
+        src[p][2 - c] = diag;
+      }
+    }
+    u_int16_t* dest = &tile->rgb[(size_t)y * w * 3];
+    for (u_int x = halo; x + halo < w; ++x) {
+      const u_int16_t* const* s = src[x & 1];
+      dest[x * 3 + 0] = s[0][x];
+      dest[x * 3 + 1] = s[1][x];
+      dest[x * 3 + 2] = s[2][x];
+    }
+  }
+}
+
+/* ================ PPG ================ */
+
+static void ppg_tile(const demosaic_planes_t* tile) {
+  int w = tile->w, h = tile->h;
+  int dir[5] = { 1, w, -1, -w, 1 };
+  int row, col, c, d, i, diff[2], guess[2];
+  u_int16_t (*image)[3], (*pix)[3];
+
+  init_tile_img(tile);
+  image = reinterpret_cast<u_int16_t (*)[3]>(tile->img);
+
+  // Green with gradients and pattern recognition
+  for (row = 3; row < h - 3; ++row) {
+    for (col = 3 + (cfa_colour(tile->cfa, row, 3) & 1), c = cfa_colour(tile->cfa, row, col); col < w - 3; col += 2) {
+      pix = image + row * w + col;
+      for (i = 0; (d = dir[i]) > 0; ++i) {
+        guess[i] = (pix[-d][1] + pix[0][c] + pix[d][1]) * 2 - pix[-2 * d][c] - pix[2 * d][c];
+        diff[i] = (abs(pix[-2 * d][c] - pix[0][c]) + abs(pix[2 * d][c] - pix[0][c]) + abs(pix[-d][1] - pix[d][1])) * 3 +
+                  (abs(pix[3 * d][1] - pix[d][1]) + abs(pix[-3 * d][1] - pix[-d][1])) * 2;
+      }
+      d = dir[i = diff[0] > diff[1]];
+      pix[0][1] = DM_ULIM(guess[i] >> 2, (int)pix[d][1], (int)pix[-d][1]);
+    }
+  }
+  // Red and blue for green sites
+  for (row = 1; row < h - 1; ++row) {
+    for (col = 1 + (cfa_colour(tile->cfa, row, 2) & 1), c = cfa_colour(tile->cfa, row, col + 1); col < w - 1; col += 2) {
+      pix = image + row * w + col;
+      for (i = 0; (d = dir[i]) > 0; c = 2 - c, ++i) {
+        int val = (pix[-d][c] + pix[d][c] + 2 * pix[0][1] - pix[-d][1] - pix[d][1]) >> 1;
+        pix[0][c] = DM_CLIP(val);
+      }
+    }
+  }
+  // Blue for red sites and vice versa
+  for (row = 1; row < h - 1; ++row) {
+    for (col = 1 + (cfa_colour(tile->cfa, row, 1) & 1), c = 2 - cfa_colour(tile->cfa, row, col); col < w - 1; col += 2) {
+      pix = image + row * w + col;
+      for (i = 0; (d = dir[i] + dir[i + 1]) > 0; ++i) {
+        diff[i] = abs(pix[-d][c] - pix[d][c]) + abs(pix[-d][1] - pix[0][1]) + abs(pix[d][1] - pix[0][1]);
+        guess[i] = pix[-d][c] + pix[d][c] + 2 * pix[0][1] - pix[-d][1] - pix[d][1];
+      }
+      int val = diff[0] != diff[1] ? guess[diff[0] > diff[1]] >> 1 : (guess[0] + guess[1]) >> 2;
+      pix[0][c] = DM_CLIP(val);
+    }
+  }
+}
+
+/* ================ AHD ================ */
+
+static inline void to_cielab(const float* cbrt, const float xyz_cam[3][3], const u_int16_t rgb[3], int16_t lab[3]) {
+  float xyz[3];
+  for (u_int i = 0; i < 3; ++i) {
+    float v = 0.5f + xyz_cam[i][0] * rgb[0] + xyz_cam[i][1] * rgb[1] + xyz_cam[i][2] * rgb[2];
+    xyz[i] = cbrt[DM_CLIP((int)v)];
+  }
+  lab[0] = 64 * (116 * xyz[1] - 16);
+  lab[1] = 64 * 500 * (xyz[0] - xyz[1]);
+  lab[2] = 64 * 200 * (xyz[1] - xyz[2]);
+}
+
+static void ahd_tile(const demosaic_planes_t* tile) {
+  int w = tile->w, h = tile->h;
+  int dir[4] = { -1, 1, -w, w };
+  size_t n = (size_t)w * h;
+  int row, col, c, d, i, j, val, hm[2];
+  u_int ldiff[2][4], abdiff[2][4], leps, abeps;
+  const float* cbrt = tile->cbrt;
+
+  init_tile_img(tile);
+  memset(tile->rgb, 0, n * 3 * sizeof(u_int16_t));
+  memset(tile->rgb_v, 0, n * 3 * sizeof(u_int16_t));
+  memset(tile->lab, 0, n * 6 * sizeof(int16_t));
+  memset(tile->homo, 0, n * 2);
+
+  u_int16_t (*image)[3] = reinterpret_cast<u_int16_t (*)[3]>(tile->img);
+  u_int16_t (*rgb[2])[3] = {
+    reinterpret_cast<u_int16_t (*)[3]>(tile->rgb),
+    reinterpret_cast<u_int16_t (*)[3]>(tile->rgb_v)
+  };
+  int16_t (*lab[2])[3] = {
+    reinterpret_cast<int16_t (*)[3]>(tile->lab),
+    reinterpret_cast<int16_t (*)[3]>(tile->lab + n * 3)
+  };
+  u_char* homo[2] = { tile->homo, tile->homo + n };
+  u_int16_t (*pix)[3], (*rix)[3];
+  int16_t (*lix)[3];
+
+  // Green horizontally and vertically
+  for (row = 2; row < h - 2; ++row) {
+    col = 2 + (cfa_colour(tile->cfa, row, 2) & 1);
+    for (c = cfa_colour(tile->cfa, row, col); col < w - 2; col += 2) {
+      pix = image + row * w + col;
+      val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2 - pix[-2][c] - pix[2][c]) >> 2;
+      rgb[0][row * w + col][1] = DM_ULIM(val, (int)pix[-1][1], (int)pix[1][1]);
+      val = ((pix[-w][1] + pix[0][c] + pix[w][1]) * 2 - pix[-2 * w][c] - pix[2 * w][c]) >> 2;
+      rgb[1][row * w + col][1] = DM_ULIM(val, (int)pix[-w][1], (int)pix[w][1]);
+    }
+  }
+  // Red and blue, then CIELab
+  for (d = 0; d < 2; ++d) {
+    for (row = 3; row < h - 3; ++row) {
+      for (col = 3; col < w - 3; ++col) {
+        pix = image + row * w + col;
+        rix = rgb[d] + row * w + col;
+        lix = lab[d] + row * w + col;
+        if ((c = 2 - cfa_colour(tile->cfa, row, col)) == 1) {
+          c = cfa_colour(tile->cfa, row + 1, col);
+          val = pix[0][1] + ((pix[-1][2 - c] + pix[1][2 - c] - rix[-1][1] - rix[1][1]) >> 1);
+          rix[0][2 - c] = DM_CLIP(val);
+          val = pix[0][1] + ((pix[-w][c] + pix[w][c] - rix[-w][1] - rix[w][1]) >> 1);
+        } else {
+          val = rix[0][1] + ((pix[-w - 1][c] + pix[-w + 1][c] + pix[w - 1][c] + pix[w + 1][c] -
+                              rix[-w - 1][1] - rix[-w + 1][1] - rix[w - 1][1] - rix[w + 1][1] + 1) >> 2);
+        }
+        rix[0][c] = DM_CLIP(val);
+        c = cfa_colour(tile->cfa, row, col);
+        rix[0][c] = pix[0][c];
+        to_cielab(cbrt, tile->xyz_cam, rix[0], lix[0]);
+      }
+    }
+  }
+  // Homogeneity maps
+  for (row = 4; row < h - 4; ++row) {
+    for (col = 4; col < w - 4; ++col) {
+      for (d = 0; d < 2; ++d) {
+        lix = lab[d] + row * w + col;
+        for (i = 0; i < 4; ++i) {
+          ldiff[d][i] = abs(lix[0][0] - lix[dir[i]][0]);
+          abdiff[d][i] = (lix[0][1] - lix[dir[i]][1]) * (lix[0][1] - lix[dir[i]][1]) +
+                         (lix[0][2] - lix[dir[i]][2]) * (lix[0][2] - lix[dir[i]][2]);
+        }
+      }
+      leps = min_u(max_u(ldiff[0][0], ldiff[0][1]), max_u(ldiff[1][2], ldiff[1][3]));
+      abeps = min_u(max_u(abdiff[0][0], abdiff[0][1]), max_u(abdiff[1][2], abdiff[1][3]));
+      for (d = 0; d < 2; ++d) {
+        for (i = 0; i < 4; ++i) {
+          if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps) {
+            homo[d][row * w + col]++;
+          }
+        }
+      }
+    }
+  }
+  // Most homogeneous direction per pixel, into rgb[0]
+  for (row = 5; row < h - 5; ++row) {
+    for (col = 5; col < w - 5; ++col) {
+      for (d = 0; d < 2; ++d) {
+        for (hm[d] = 0, i = row - 1; i <= row + 1; ++i) {
+          for (j = col - 1; j <= col + 1; ++j) {
+            hm[d] += homo[d][i * w + j];
+          }
+        }
+      }
+      rix = rgb[0] + row * w + col;
+      if (hm[0] != hm[1]) {
+        if (hm[1] > hm[0]) {
+          memcpy(rix[0], rgb[1][row * w + col], sizeof(rix[0]));
+        }
+      } else {
+        for (c = 0; c < 3; ++c) {
+          rix[0][c] = (rix[0][c] + rgb[1][row * w + col][c]) >> 1;
+        }
+      }
+    }
+  }
+}
+
+/* ================ Table ================ */
+
+void CPU_KERNEL_INIT(kernel_table_t* table) {
+  table->level = CPU_KERNEL_LEVEL;
+  table->unpack_16_bits = unpack_16_bits;
+  table->unpack_bits_msb = unpack_bits_msb;
+  table->normalise_row = normalise_row;
+  table->convert_colour_row_8 = convert_colour_row<u_int8_t>;
+  table->convert_colour_row_16 = convert_colour_row<u_int16_t>;
+  table->convert_colour_row_float = convert_colour_row<float>;
+  table->bilinear_tile = bilinear_tile;
+  table->ppg_tile = ppg_tile;
+  table->ahd_tile = ahd_tile;
+}
@@ -0,0 +1,265 @@
+#include "decode_cache.h"
+#include "cameras/camera_raw.h"
+
+#include <chrono>
+#include <sys/stat.h>
+
+static u_int64_t mix_hash(u_int64_t hash, u_int64_t value) {
+  // FNV style combine over 64 bit words
+  return (hash ^ value) * 0x100000001b3ull;
+}
+
+size_t cache_key_hash_t :: operator()(const cache_key_t& key) const {
+  u_int64_t hash = 0xcbf29ce484222325ull;
+  hash = mix_hash(hash, key.device);
+  hash = mix_hash(hash, key.inode);
+  hash = mix_hash(hash, key.size);
+  hash = mix_hash(hash, key.mtime_ns);
+  hash = mix_hash(hash, (u_int64_t)key.type);
+  hash = mix_hash(hash, key.options);
+  return hash ^ (hash >> 29);
+}
+
+bool get_cache_key(const std::string& file_path, cache_key_t* key) {
+  struct stat st;
+  if (stat(file_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  key->device = st.st_dev;
+  key->inode = st.st_ino;
+  key->size = st.st_size;
+  key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+u_int64_t hash_decode_options(const decode_options_t& options) {
+  u_int64_t hash = 0xcbf29ce484222325ull;
+  hash = mix_hash(hash, (u_int64_t)options.demosaic);
+  hash = mix_hash(hash, (u_int64_t)options.format);
+  hash = mix_hash(hash, (u_int64_t)options.curve);
+  hash = mix_hash(hash, options.half_size);
+  hash = mix_hash(hash, options.apply_orientation);
+  return hash;
+}
+
+static RawImage copy_raw_image(const RawImage& src) {
+  RawImage copy(src.width, src.height, src.channels, src.sample_bytes);
+  if (copy.empty()) {
+    return copy;
+  }
+  copy.copy_info(src);
+  for (u_int y = 0; y < src.height; ++y) {
+    memcpy(copy.row<u_char>(y), src.row<u_char>(y), (size_t)src.width * src.channels * src.sample_bytes);
+  }
+  return copy;
+}
+
+DecodeCache :: DecodeCache(const cache_options_t& options)
+  : options(options), total_bytes(0), hits(0), misses(0), insertions(0), evictions(0) {
+  u_int n_shards = std::max(1u, options.shards);
+  for (u_int i = 0; i < n_shards; ++i) {
+    shards.emplace_back(new shard_t());
+  }
+}
+
+DecodeCache::shard_t& DecodeCache :: get_shard(const cache_key_t& key) {
+  return *shards[cache_key_hash_t()(key) % shards.size()];
+}
+
+DecodeCache::entry_t* DecodeCache :: find(shard_t& shard, const cache_key_t& key) {
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    misses++;
+    return nullptr;
+  }
+  // A hit raises the entry back above the clock
+  entry_t& entry = it->second;
+  shard.order.erase(entry.order);
+  entry.order = std::make_pair(shard.clock + entry.cost * (1 << 20) / std::max<size_t>(entry.bytes, 1), shard.next_seq++);
+  shard.order.emplace(entry.order, key);
+  hits++;
+  return &entry;
+}
+
+void DecodeCache :: evict_lowest(shard_t& shard) {
+  auto victim = shard.order.begin();
+  auto it = shard.entries.find(victim->second);
+  shard.clock = victim->first.first;
+  shard.bytes -= it->second.bytes;
+  total_bytes -= it->second.bytes;
+  shard.entries.erase(it);
+  shard.order.erase(victim);
+  evictions++;
+}
+
+void DecodeCache :: insert(shard_t& shard, const cache_key_t& key, entry_t entry) {
+  auto existing = shard.entries.find(key);
+  if (existing != shard.entries.end()) {
+    shard.order.erase(existing->second.order);
+    shard.bytes -= existing->second.bytes;
+    total_bytes -= existing->second.bytes;
+    shard.entries.erase(existing);
+  }
+
+  // Room comes from this shard first, trim() takes the rest from the others
+  while (total_bytes + entry.bytes > options.max_bytes && !shard.order.empty()) {
+    evict_lowest(shard);
+  }
+
+  entry.order = std::make_pair(shard.clock + entry.cost * (1 << 20) / std::max<size_t>(entry.bytes, 1), shard.next_seq++);
+  shard.order.emplace(entry.order, key);
+  shard.bytes += entry.bytes;
+  total_bytes += entry.bytes;
+  shard.entries.emplace(key, std::move(entry));
+  insertions++;
+}
+
+void DecodeCache :: trim() {
+  // One shard lock at a time, so concurrent inserts cannot deadlock
+  for (auto& shard : shards) {
+    if (total_bytes <= options.max_bytes) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    while (total_bytes > options.max_bytes && !shard->order.empty()) {
+      evict_lowest(*shard);
+    }
+  }
+}
+
+std::shared_ptr<const RawImageData::metadata_t> DecodeCache :: get_metadata(const cache_key_t& key) {
+  shard_t& shard = get_shard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  entry_t* entry = find(shard, key);
+  return entry != nullptr ? entry->metadata : nullptr;
+}
+
+void DecodeCache :: put_metadata(const cache_key_t& key, const RawImageData::metadata_t& metadata, double cost) {
+  entry_t entry;
+  entry.metadata = std::make_shared<RawImageData::metadata_t>(metadata);
+  entry.bytes = sizeof(metadata) + entry.metadata->tags.get_heap_bytes();   // The copy, sized to fit
+  entry.cost = cost;
+
+  if (entry.bytes > options.max_bytes) {
+    return;
+  }
+  shard_t& shard = get_shard(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    insert(shard, key, std::move(entry));
+  }
+  trim();
+}
+
+bool DecodeCache :: get_image(const cache_key_t& key, RawImage* image) {
+  shard_t& shard = get_shard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  entry_t* entry = find(shard, key);
+  if (entry == nullptr) {
+    return false;
+  }
+  *image = entry->image;
+  return true;
+}
+
+void DecodeCache :: put_image(const cache_key_t& key, const RawImage& image, double cost) {
+  entry_t entry;
+  entry.image = image;
+  entry.bytes = image.size_bytes();
+  entry.cost = cost;
+
+  if (entry.bytes > options.max_bytes) {
+    return;
+  }
+  shard_t& shard = get_shard(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    insert(shard, key, std::move(entry));
+  }
+  trim();
+}
+
+cache_stats_t DecodeCache :: get_stats() {
+  cache_stats_t stats;
+  stats.hits = hits;
+  stats.misses = misses;
+  stats.insertions = insertions;
+  stats.evictions = evictions;
+  for (auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.bytes += shard->bytes;
+    stats.entries += shard->entries.size();
+  }
+  return stats;
+}
+
+void DecodeCache :: clear() {
+  for (auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total_bytes -= shard->bytes;
+    shard->entries.clear();
+    shard->order.clear();
+    shard->bytes = 0;
+    shard->clock = 0;
+  }
+}
+
+bool cached_decode(DecodeCache& cache, const std::string& file_path, const decode_options_t& options, RawImage& output) {
+  typedef std::chrono::steady_clock clock;
+  cache_key_t file_key, image_key, raw_key;
+  bool use_cache = options.raw_stats == nullptr && options.output_stats == nullptr && get_cache_key(file_path, &file_key);
+
+  if (use_cache) {
+    image_key = raw_key = file_key;
+    image_key.type = Cache_Entry_Type::IMAGE;
+    image_key.options = hash_decode_options(options);
+    raw_key.type = Cache_Entry_Type::RAW;
+    if (cache.get_image(image_key, &output)) {
+      return true;
+    }
+  }
+
+  std::unique_ptr<RawImageData> img(open_camera_raw(file_path));
+  if (img == nullptr) {
+    return false;
+  }
+  clock::time_point start = clock::now();
+
+  std::shared_ptr<const RawImageData::metadata_t> metadata;
+  if (use_cache && (metadata = cache.get_metadata(file_key)) != nullptr) {
+    img->set_metadata(*metadata);
+  } else {
+    if (!img->open_raw()) {
+      return false;
+    }
+    if (use_cache) {
+      cache.put_metadata(file_key, img->get_metadata(), std::chrono::duration<double>(clock::now() - start).count());
+    }
+  }
+
+  // Half size reads quads straight from the file, no raw buffer to reuse
+  if (use_cache && cache.get_options().cache_raw && !options.half_size) {
+    RawImage raw;
+    if (!cache.get_image(raw_key, &raw)) {
+      clock::time_point load_start = clock::now();
+      if (!img->load_raw()) {
+        return false;
+      }
+      raw = img->take_image();
+      cache.put_image(raw_key, raw, std::chrono::duration<double>(clock::now() - load_start).count());
+    }
+    raw = copy_raw_image(raw);    // decode() normalises in place
+    if (raw.empty()) {
+      return false;
+    }
+    img->set_image(raw);
+  }
+
+  if (!img->decode(options, output)) {
+    return false;
+  }
+  if (use_cache) {
+    cache.put_image(image_key, output, std::chrono::duration<double>(clock::now() - start).count());
+  }
+  return true;
+}
@@ -0,0 +1,128 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimagedata.h"
+
+#define CACHE_SHARDS 16
+
+enum class Cache_Entry_Type {
+  METADATA,
+  IMAGE,
+  RAW
+};
+
+/* Identifies a file's contents: same inode, size and modification time */
+struct cache_key_t {
+  u_int64_t device = 0;
+  u_int64_t inode = 0;
+  u_int64_t size = 0;
+  int64_t mtime_ns = 0;
+  Cache_Entry_Type type = Cache_Entry_Type::METADATA;
+  u_int64_t options = 0;      // Decode options hash, images only
+
+  bool operator==(const cache_key_t& other) const {
+    return device == other.device && inode == other.inode && size == other.size &&
+           mtime_ns == other.mtime_ns && type == other.type && options == other.options;
+  }
+};
+
+struct cache_key_hash_t {
+  size_t operator()(const cache_key_t& key) const;
+};
+
+struct cache_options_t {
+  size_t max_bytes = 512 << 20;   // Over all shards
+  u_int shards = CACHE_SHARDS;
+  bool cache_raw = false;         // Also keep unpacked raw buffers
+};
+
+struct cache_stats_t {
+  u_int64_t hits = 0;
+  u_int64_t misses = 0;
+  u_int64_t insertions = 0;
+  u_int64_t evictions = 0;
+  size_t bytes = 0;
+  size_t entries = 0;
+};
+
+bool get_cache_key(const std::string& file_path, cache_key_t* key);
+/* Hash of the options that change the output image, pool and stats excluded */
+u_int64_t hash_decode_options(const decode_options_t& options);
+
+/*
+ * In-process cache of parsed metadata, decoded images (previews) and raw
+ * buffers under one byte budget. Entries are spread over shards by key,
+ * each with its own lock; an insert evicts from its own shard first and
+ * then from the others until the total fits. Eviction is cost aware
+ * (GreedyDual-Size): an entry's priority is the shard's clock plus the
+ * time it took to build per megabyte, refreshed on every hit, and the
+ * lowest priority goes first, so cheap large images leave before costly
+ * small ones. Cached images share their buffer with the callers, which
+ * must treat them as read only.
+ */
+class DecodeCache {
+
+public:
+  DecodeCache(const cache_options_t& options = cache_options_t());
+
+  std::shared_ptr<const RawImageData::metadata_t> get_metadata(const cache_key_t& key);
+  void put_metadata(const cache_key_t& key, const RawImageData::metadata_t& metadata, double cost);
+
+  bool get_image(const cache_key_t& key, RawImage* image);
+  void put_image(const cache_key_t& key, const RawImage& image, double cost);
+
+  cache_stats_t get_stats();
+  void clear();
+
+  const cache_options_t& get_options() const { return options; }
+
+private:
+  struct entry_t {
+    std::shared_ptr<const RawImageData::metadata_t> metadata;
+    RawImage image;
+    size_t bytes = 0;
+    double cost = 0;            // Seconds to rebuild
+    std::pair<double, u_int64_t> order;
+  };
+
+  struct shard_t {
+    std::mutex mutex;
+    std::unordered_map<cache_key_t, entry_t, cache_key_hash_t> entries;
+    std::map<std::pair<double, u_int64_t>, cache_key_t> order;   // Eviction order, lowest first
+    size_t bytes = 0;
+    double clock = 0;           // Priority of the last entry evicted here
+    u_int64_t next_seq = 0;
+  };
+
+  cache_options_t options;
+  std::vector<std::unique_ptr<shard_t>> shards;
+
+  std::atomic<size_t> total_bytes;
+  std::atomic<u_int64_t> hits, misses, insertions, evictions;
+
+  shard_t& get_shard(const cache_key_t& key);
+  entry_t* find(shard_t& shard, const cache_key_t& key);
+  void insert(shard_t& shard, const cache_key_t& key, entry_t entry);
+  void evict_lowest(shard_t& shard);
+  void trim();
+
+};
+
+/*
+ * decode() through a cache: a cached image is returned as is, otherwise
+ * cached metadata skips the parse and a cached raw buffer (cache_raw)
+ * skips the unpack. Requests for stats and streams bypass the cache.
+ */
+bool cached_decode(DecodeCache& cache, const std::string& file_path, const decode_options_t& options, RawImage& output);
+
+#endif
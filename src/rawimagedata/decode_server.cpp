@@ -0,0 +1,330 @@
+#include "decode_server.h"
+#include "cameras/camera_raw.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static bool send_all(int fd, const void* data, size_t size, int pass_fd = -1) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    struct iovec iov = { const_cast<char*>(bytes), size };
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (pass_fd >= 0) {
+      // The descriptor rides on the first bytes of the message
+      memset(control, 0, sizeof(control));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+    pass_fd = -1;
+  }
+  return true;
+}
+
+static bool recv_all(int fd, void* data, size_t size, int* pass_fd = nullptr) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    struct iovec iov = { bytes, size };
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        int received;
+        memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+        if (pass_fd != nullptr && *pass_fd < 0) {
+          *pass_fd = received;
+        } else {
+          close(received);
+        }
+      }
+    }
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+void get_decode_metadata(const RawImageData::metadata_t& raw_data, decode_metadata_t* metadata) {
+  const auto& main = raw_data.main_ifd;
+  metadata->width = main.frame.width;
+  metadata->height = main.frame.height;
+  metadata->bps = main.frame.bps;
+  metadata->orientation = main.frame.orientation;
+
+  strncpy(metadata->camera_make, raw_data.tags.get_string(Tag_Space::IFD, 271), sizeof(metadata->camera_make) - 1);
+  strncpy(metadata->camera_model, raw_data.tags.get_string(Tag_Space::IFD, 272), sizeof(metadata->camera_model) - 1);
+  strncpy(metadata->lens_model, raw_data.tags.get_string(Tag_Space::EXIF, 0xa434), sizeof(metadata->lens_model) - 1);
+
+  // EXIF usually sits in IFD0 or the EXIF IFD, not the raw IFD
+  for (u_int ifd = 0; ifd <= raw_data.ifd_count && ifd < 8; ++ifd) {
+    const auto& exif = raw_data.ifds[ifd].exif;
+    if (exif.date_time_str[0] != 0) memcpy(metadata->date_time, exif.date_time_str, sizeof(metadata->date_time) - 1);
+    if (exif.iso_sensitivity != 0) metadata->iso = exif.iso_sensitivity;
+    if (exif.exposure != 0) metadata->exposure = exif.exposure;
+    if (exif.f_number != 0) metadata->f_number = exif.f_number;
+    if (exif.focal_length != 0) metadata->focal_length = exif.focal_length;
+  }
+}
+
+static int write_image_memfd(const RawImage& image, decode_response_t* response) {
+  size_t row_bytes = (size_t)image.width * image.channels * image.sample_bytes;
+  size_t size = row_bytes * image.height;
+
+  int fd = memfd_create("rawimagedata", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    return -1;
+  }
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, size) == 0 && size > 0) {
+    mapping = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  for (u_int y = 0; y < image.height; ++y) {
+    memcpy(static_cast<u_char*>(mapping) + row_bytes * y, image.row<u_char>(y), row_bytes);
+  }
+  munmap(mapping, size);
+  // Clients get a read only view that can never change under them
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+  response->width = image.width;
+  response->height = image.height;
+  response->channels = image.channels;
+  response->sample_bytes = image.sample_bytes;
+  response->stride = row_bytes;
+  response->size = size;
+  return fd;
+}
+
+DecodeServer :: DecodeServer(const decode_server_options_t& options)
+  : options(options), cache(options.cache), stopping(false) {}
+
+DecodeServer :: ~DecodeServer() {
+  stop();
+}
+
+bool DecodeServer :: listen(const std::string& socket_path) {
+  struct sockaddr_un address;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    fprintf(stderr, "ERROR: Socket path too long: %s\n", socket_path.c_str());
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path.c_str());
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(socket_path.c_str());
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      ::listen(listen_fd, options.max_clients) != 0) {
+    fprintf(stderr, "ERROR: Unable to listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+    return false;
+  }
+  this->socket_path = socket_path;
+  return true;
+}
+
+void DecodeServer :: run() {
+  while (!stopping) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;    // stop() shut the socket down
+    }
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    if (stopping || client_fds.size() >= options.max_clients) {
+      close(fd);
+      continue;
+    }
+    client_fds.insert(fd);
+    std::thread(&DecodeServer::serve_client, this, fd).detach();
+  }
+}
+
+void DecodeServer :: stop() {
+  if (stopping.exchange(true)) {
+    return;
+  }
+  if (listen_fd >= 0) {
+    shutdown(listen_fd, SHUT_RDWR);
+    close(listen_fd);
+    unlink(socket_path.c_str());
+  }
+  // Wake the client threads out of recv and wait for them to go
+  std::unique_lock<std::mutex> lock(clients_mutex);
+  for (int fd : client_fds) {
+    shutdown(fd, SHUT_RDWR);
+  }
+  clients_done.wait(lock, [this]() { return client_fds.empty(); });
+}
+
+void DecodeServer :: serve_client(int fd) {
+  decode_request_t request;
+  while (recv_all(fd, &request, sizeof(request))) {
+    decode_response_t response;
+    int image_fd = -1;
+    request.path[sizeof(request.path) - 1] = 0;
+    if (request.magic != DECODE_SERVER_MAGIC) {
+      break;
+    }
+    response.ok = handle_request(request, &response, &image_fd);
+    bool sent = send_all(fd, &response, sizeof(response), image_fd);
+    if (image_fd >= 0) {
+      close(image_fd);
+    }
+    if (!sent) {
+      break;
+    }
+  }
+
+  // Close under the lock, run() could otherwise accept a client on the same fd number before the erase
+  std::lock_guard<std::mutex> lock(clients_mutex);
+  client_fds.erase(fd);
+  close(fd);
+  clients_done.notify_all();
+}
+
+bool DecodeServer :: handle_request(const decode_request_t& request, decode_response_t* response, int* image_fd) {
+  std::string path(request.path);
+  cache_key_t key;
+
+  // Enum fields come straight off the wire, out of range values would fall through the switches
+  if ((u_int32_t)request.type > (u_int32_t)Decode_Request_Type::DECODE) {
+    snprintf(response->message, sizeof(response->message), "Invalid request type %u", (u_int32_t)request.type);
+    return false;
+  }
+  if ((u_int32_t)request.demosaic > (u_int32_t)Demosaic_Method::AHD ||
+      (u_int32_t)request.format > (u_int32_t)Output_Format::FLOAT ||
+      (u_int32_t)request.curve > (u_int32_t)Transfer_Curve::LINEAR) {
+    snprintf(response->message, sizeof(response->message), "Invalid decode options (demosaic %u, format %u, curve %u)",
+             (u_int32_t)request.demosaic, (u_int32_t)request.format, (u_int32_t)request.curve);
+    return false;
+  }
+
+  if (request.type == Decode_Request_Type::METADATA) {
+    std::shared_ptr<const RawImageData::metadata_t> metadata;
+    bool cacheable = get_cache_key(path, &key);
+    if (cacheable) {
+      metadata = cache.get_metadata(key);
+    }
+    if (metadata == nullptr) {
+      std::unique_ptr<RawImageData> img(open_camera_raw(path));
+      if (img == nullptr || !img->open_raw()) {
+        snprintf(response->message, sizeof(response->message), "Unable to parse %s", request.path);
+        return false;
+      }
+      metadata = std::make_shared<RawImageData::metadata_t>(img->get_metadata());
+      if (cacheable) {
+        cache.put_metadata(key, *metadata, 0);
+      }
+    }
+    get_decode_metadata(*metadata, &response->metadata);
+    return true;
+  }
+
+  decode_options_t decode_options;
+  decode_options.demosaic = request.demosaic;
+  decode_options.format = request.format;
+  decode_options.curve = request.curve;
+  decode_options.apply_orientation = request.apply_orientation != 0;
+  decode_options.half_size = request.type == Decode_Request_Type::PREVIEW;
+
+  RawImage output;
+  if (!cached_decode(cache, path, decode_options, output)) {
+    snprintf(response->message, sizeof(response->message), "Unable to decode %s", request.path);
+    return false;
+  }
+  if (get_cache_key(path, &key)) {
+    std::shared_ptr<const RawImageData::metadata_t> metadata = cache.get_metadata(key);
+    if (metadata != nullptr) {
+      get_decode_metadata(*metadata, &response->metadata);
+    }
+  }
+  *image_fd = write_image_memfd(output, response);
+  if (*image_fd < 0) {
+    snprintf(response->message, sizeof(response->message), "Unable to share the image: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+mapped_image_t :: ~mapped_image_t() {
+  if (mapping != nullptr) {
+    munmap(mapping, size);
+  }
+}
+
+DecodeClient :: ~DecodeClient() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool DecodeClient :: connect(const std::string& socket_path) {
+  struct sockaddr_un address;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path.c_str());
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || ::connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "ERROR: Unable to connect to %s: %s\n", socket_path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool DecodeClient :: request(const decode_request_t& request, decode_response_t* response, mapped_image_t* image) {
+  int image_fd = -1;
+  if (!send_all(fd, &request, sizeof(request)) || !recv_all(fd, response, sizeof(*response), &image_fd)) {
+    return false;
+  }
+  if (image_fd < 0) {
+    return response->ok;
+  }
+
+  bool ok = response->ok;
+  if (ok && image != nullptr && response->size > 0) {
+    void* mapping = mmap(nullptr, response->size, PROT_READ, MAP_SHARED, image_fd, 0);
+    if (mapping == MAP_FAILED) {
+      ok = false;
+    } else {
+      image->mapping = mapping;
+      image->size = response->size;
+      image->image = RawImage::wrap(mapping, response->width, response->height, response->channels,
+                                    response->stride, response->sample_bytes);
+    }
+  }
+  close(image_fd);
+  return ok;
+}
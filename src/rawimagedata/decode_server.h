@@ -0,0 +1,130 @@
+#ifndef DECODE_SERVER_H
+#define DECODE_SERVER_H
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <condition_variable>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimagedata.h"
+#include "decode_cache.h"
+
+#define DECODE_SERVER_MAGIC 0x52494431  // "RID1"
+#define DECODE_SERVER_PATH_MAX 4096
+
+enum class Decode_Request_Type : u_int32_t {
+  METADATA,
+  PREVIEW,      // Half size decode
+  DECODE
+};
+
+/* Fixed size messages in host byte order, the socket is local only */
+struct decode_request_t {
+  u_int32_t magic = DECODE_SERVER_MAGIC;
+  Decode_Request_Type type = Decode_Request_Type::METADATA;
+  Demosaic_Method demosaic = Demosaic_Method::AHD;
+  Output_Format format = Output_Format::RGB8;
+  Transfer_Curve curve = Transfer_Curve::SRGB;
+  u_int32_t apply_orientation = 1;
+  char path[DECODE_SERVER_PATH_MAX] = { 0 };
+};
+
+struct decode_metadata_t {
+  char camera_make[64] = { 0 };
+  char camera_model[64] = { 0 };
+  char lens_model[64] = { 0 };
+  char date_time[20] = { 0 };
+  u_int32_t width = 0, height = 0;
+  u_int32_t bps = 0;
+  int32_t orientation = 0;
+  double iso = 0;
+  double exposure = 0;
+  double f_number = 0;
+  double focal_length = 0;
+};
+
+/* Summary of parsed metadata, fields filled from whichever IFD carries them */
+void get_decode_metadata(const RawImageData::metadata_t& raw_data, decode_metadata_t* metadata);
+
+/* Pixels of PREVIEW/DECODE come as a sealed memfd passed with the response */
+struct decode_response_t {
+  u_int32_t magic = DECODE_SERVER_MAGIC;
+  int32_t ok = 0;
+  char message[128] = { 0 };
+  decode_metadata_t metadata;
+  u_int32_t width = 0, height = 0;
+  u_int32_t channels = 0, sample_bytes = 0;
+  u_int64_t stride = 0;
+  u_int64_t size = 0;
+};
+
+struct decode_server_options_t {
+  cache_options_t cache;
+  u_int max_clients = 64;
+};
+
+/*
+ * Decode daemon on a Unix domain socket. Each client connection gets a
+ * thread that reads requests in turn; all of them decode on the shared
+ * thread pool and through one DecodeCache, so both stay warm between
+ * requests. Image results are written once into a memfd that is sealed
+ * and handed to the client (SCM_RIGHTS), which maps it without a copy.
+ */
+class DecodeServer {
+
+public:
+  DecodeServer(const decode_server_options_t& options = decode_server_options_t());
+  ~DecodeServer();
+
+  bool listen(const std::string& socket_path);
+  void run();       // Accepts clients until stop()
+  void stop();
+
+  DecodeCache& get_cache() { return cache; }
+
+private:
+  decode_server_options_t options;
+  DecodeCache cache;
+  std::string socket_path;
+  int listen_fd = -1;
+  std::atomic<bool> stopping;
+  std::mutex clients_mutex;
+  std::condition_variable clients_done;
+  std::set<int> client_fds;       // Open connections, each served by a detached thread
+
+  void serve_client(int fd);
+  bool handle_request(const decode_request_t& request, decode_response_t* response, int* image_fd);
+
+};
+
+/* Image mapped from a response memfd, unmapped when destroyed */
+struct mapped_image_t {
+  RawImage image;   // View of the mapping, valid while this lives
+  void* mapping = nullptr;
+  size_t size = 0;
+
+  mapped_image_t() {}
+  mapped_image_t(const mapped_image_t&) = delete;
+  mapped_image_t& operator=(const mapped_image_t&) = delete;
+  ~mapped_image_t();
+};
+
+class DecodeClient {
+
+public:
+  ~DecodeClient();
+
+  bool connect(const std::string& socket_path);
+  bool request(const decode_request_t& request, decode_response_t* response, mapped_image_t* image = nullptr);
+
+private:
+  int fd = -1;
+
+};
+
+#endif
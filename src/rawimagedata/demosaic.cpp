@@ -0,0 +1,204 @@
+#include "demosaic.h"
+#include "cpu_dispatch.h"
+
+#include <cmath>
+#include <mutex>
+#include <unistd.h>
+
+static const double XYZ_RGB[3][3] = {
+  { 0.412453, 0.357580, 0.180423 },
+  { 0.212671, 0.715160, 0.072169 },
+  { 0.019334, 0.119193, 0.950227 }
+};
+static const double D65_WHITE[3] = { 0.950456, 1, 1.088754 };
+
+/* Padded tile in local coordinates, pixel (0, 0) is image (x0, y0) */
+struct demosaic_tile_t {
+  int x0 = 0, y0 = 0;
+  u_int w = 0, h = 0;
+  u_int cfa = 0;
+  std::vector<u_int16_t> raw;         // w * h mosaic
+  std::vector<u_int16_t> img;         // w * h * 3, only the site colour set
+  std::vector<u_int16_t> rgb;         // w * h * 3 output (and AHD direction 0)
+  std::vector<u_int16_t> rgb_v;       // AHD direction 1
+  std::vector<int16_t> lab;           // AHD CIELab, 2 * w * h * 3
+  std::vector<u_char> homo;           // AHD homogeneity, 2 * w * h
+  std::vector<u_int16_t> rows;        // Bilinear row temporaries
+};
+
+u_int get_demosaic_halo(Demosaic_Method method) {
+  switch (method) {
+    case Demosaic_Method::BILINEAR: return 1;
+    case Demosaic_Method::PPG:      return 4;
+    case Demosaic_Method::AHD:      return 5;
+  }
+  return 5;
+}
+
+u_int get_demosaic_tile_size(Demosaic_Method method) {
+  long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  u_int bytes_per_pixel, halo, edge;
+  if (l2_size <= 0) {
+    l2_size = 1 << 20;
+  }
+  switch (method) {
+    case Demosaic_Method::BILINEAR: bytes_per_pixel = 10; break;
+    case Demosaic_Method::PPG:      bytes_per_pixel = 14; break;
+    default:                        bytes_per_pixel = 40; break;
+  }
+  // Leave half of L2 for the input and output rows streaming through
+  halo = get_demosaic_halo(method);
+  edge = (u_int)sqrt((double)l2_size / 2 / bytes_per_pixel);
+  edge = edge > 2 * halo ? (edge - 2 * halo) & ~15u : 0;
+  return std::max(edge, 32u);
+}
+
+static inline int mirror_index(int i, int n) {
+  // Reflection keeps CFA parity: -1 -> 1, n -> n - 2
+  if (i < 0) i = -i;
+  if (i >= n) i = 2 * (n - 1) - i;
+  return std::min(std::max(i, 0), n - 1);
+}
+
+static void load_tile(const RawImage& cfa, demosaic_tile_t* tile) {
+  std::vector<int> col_map(tile->w);
+  for (u_int lx = 0; lx < tile->w; ++lx) {
+    col_map[lx] = mirror_index(tile->x0 + (int)lx, cfa.width);
+  }
+  for (u_int ly = 0; ly < tile->h; ++ly) {
+    const u_int16_t* src = cfa.row(mirror_index(tile->y0 + (int)ly, cfa.height));
+    u_int16_t* dest = &tile->raw[(size_t)ly * tile->w];
+    for (u_int lx = 0; lx < tile->w; ++lx) {
+      dest[lx] = src[col_map[lx]];
+    }
+  }
+}
+
+/* ================ AHD ================ */
+
+static const float* get_cbrt_table() {
+  static float cbrt[0x10000];
+  static std::once_flag cbrt_flag;
+  std::call_once(cbrt_flag, []() {
+    for (u_int i = 0; i < 0x10000; ++i) {
+      double r = i / 65535.0;
+      cbrt[i] = r > 0.008856 ? pow(r, 1 / 3.0) : 7.787 * r + 16 / 116.0;
+    }
+  });
+  return cbrt;
+}
+
+static void cielab_matrix(const float rgb_cam[3][3], float xyz_cam[3][3]) {
+  for (u_int i = 0; i < 3; ++i) {
+    for (u_int j = 0; j < 3; ++j) {
+      xyz_cam[i][j] = 0;
+      for (u_int k = 0; k < 3; ++k) {
+        xyz_cam[i][j] += XYZ_RGB[i][k] * rgb_cam[k][j] / D65_WHITE[i];
+      }
+    }
+  }
+}
+
+/* ================ Engine ================ */
+
+/* Sizes the planes the method works in, the kernels only see raw pointers */
+static void get_tile_planes(demosaic_tile_t* tile, Demosaic_Method method, demosaic_planes_t* planes) {
+  size_t n = (size_t)tile->w * tile->h;
+  memset(planes, 0, sizeof(*planes));
+  planes->w = tile->w;
+  planes->h = tile->h;
+  planes->halo = get_demosaic_halo(method);
+  planes->cfa = tile->cfa;
+  planes->raw = tile->raw.data();
+  planes->rgb = tile->rgb.data();
+  switch (method) {
+    case Demosaic_Method::BILINEAR:
+      tile->rows.resize((size_t)tile->w * 4);
+      planes->rows = tile->rows.data();
+      break;
+    case Demosaic_Method::PPG:
+      tile->img.resize(n * 3);
+      planes->img = tile->img.data();
+      break;
+    case Demosaic_Method::AHD:
+      tile->img.resize(n * 3);
+      tile->rgb_v.resize(n * 3);
+      tile->lab.resize(n * 6);
+      tile->homo.resize(n * 2);
+      planes->img = tile->img.data();
+      planes->rgb_v = tile->rgb_v.data();
+      planes->lab = tile->lab.data();
+      planes->homo = tile->homo.data();
+      break;
+  }
+}
+
+bool demosaic_raw_image(const RawImage& cfa, RawImage& rgb, const demosaic_options_t& options) {
+  if (!cfa.is_cfa() || cfa.sample_bytes != 2) {
+    fprintf(stderr, "ERROR: Demosaic needs a 16 bit CFA image\n");
+    return false;
+  }
+  if (rgb.empty() || rgb.width != cfa.width || rgb.height != cfa.height || rgb.channels != 3 || rgb.sample_bytes != 2) {
+    rgb = RawImage(cfa.width, cfa.height, 3);
+    if (rgb.empty()) {
+      return false;
+    }
+  }
+  rgb.white = cfa.white;
+
+  u_int halo = get_demosaic_halo(options.method);
+  u_int tile_size = options.tile_size ? options.tile_size : get_demosaic_tile_size(options.method);
+  u_int n_tiles_x = (cfa.width + tile_size - 1) / tile_size;
+  u_int n_tiles_y = (cfa.height + tile_size - 1) / tile_size;
+  const kernel_table_t& kernels = get_kernels();
+  const float* cbrt = options.method == Demosaic_Method::AHD ? get_cbrt_table() : nullptr;
+  float xyz_cam[3][3];
+  cielab_matrix(options.rgb_cam, xyz_cam);
+
+  auto run_tile = [&](u_int index) {
+    static thread_local demosaic_tile_t tile;
+    u_int tx = (index % n_tiles_x) * tile_size;
+    u_int ty = (index / n_tiles_x) * tile_size;
+    u_int tw = std::min(tile_size, cfa.width - tx);
+    u_int th = std::min(tile_size, cfa.height - ty);
+
+    tile.x0 = (int)tx - (int)halo;
+    tile.y0 = (int)ty - (int)halo;
+    tile.w = tw + 2 * halo;
+    tile.h = th + 2 * halo;
+    tile.cfa = cfa_shift(cfa.cfa, tile.x0 & 1, tile.y0 & 1);
+    tile.raw.resize((size_t)tile.w * tile.h);
+    tile.rgb.resize((size_t)tile.w * tile.h * 3);
+    load_tile(cfa, &tile);
+
+    demosaic_planes_t planes;
+    get_tile_planes(&tile, options.method, &planes);
+    switch (options.method) {
+      case Demosaic_Method::BILINEAR:
+        kernels.bilinear_tile(&planes);
+        break;
+      case Demosaic_Method::PPG:
+        kernels.ppg_tile(&planes);
+        tile.rgb.swap(tile.img);
+        break;
+      case Demosaic_Method::AHD:
+        planes.cbrt = cbrt;
+        memcpy(planes.xyz_cam, xyz_cam, sizeof(xyz_cam));
+        kernels.ahd_tile(&planes);
+        break;
+    }
+
+    for (u_int y = 0; y < th; ++y) {
+      memcpy(rgb.row(ty + y) + tx * 3, &tile.rgb[((size_t)(y + halo) * tile.w + halo) * 3], (size_t)tw * 3 * sizeof(u_int16_t));
+    }
+  };
+
+  if (options.pool != nullptr) {
+    options.pool->parallel_for(0, n_tiles_x * n_tiles_y, run_tile);
+  } else {
+    for (u_int i = 0; i < n_tiles_x * n_tiles_y; ++i) {
+      run_tile(i);
+    }
+  }
+  return true;
+}
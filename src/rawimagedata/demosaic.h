@@ -0,0 +1,39 @@
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+
+enum class Demosaic_Method {
+  BILINEAR,   // Preview quality
+  PPG,        // Patterned Pixel Grouping
+  AHD         // Adaptive Homogeneity-Directed, export quality
+};
+
+struct demosaic_options_t {
+  Demosaic_Method method = Demosaic_Method::AHD;
+  u_int tile_size = 0;                // Tile edge without halo, 0: sized for L2
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+  float rgb_cam[3][3] = {             // Camera to linear sRGB, for the AHD CIELab metric
+    { 1, 0, 0 },
+    { 0, 1, 0 },
+    { 0, 0, 1 }
+  };
+};
+
+u_int get_demosaic_halo(Demosaic_Method method);
+u_int get_demosaic_tile_size(Demosaic_Method method);
+
+/*
+ * Interpolates a normalised 2x2 CFA mosaic into 3 channel 16 bit RGB.
+ * The frame is cut into overlapping tiles (tile + halo on every side,
+ * mirrored at the frame edges) that are processed independently.
+ */
+bool demosaic_raw_image(const RawImage& cfa, RawImage& rgb, const demosaic_options_t& options);
+
+#endif
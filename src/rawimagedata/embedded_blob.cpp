@@ -0,0 +1,58 @@
+#include "embedded_blob.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* BLOB_NAMES[(int)Blob_Kind::COUNT] = {
+  "icc_profile", "xmp", "iptc", "makernote", "linearization_table", "contrast_curve"
+};
+
+const char* get_blob_name(Blob_Kind kind) {
+  return kind < Blob_Kind::COUNT ? BLOB_NAMES[(int)kind] : "unknown";
+}
+
+u_int64_t get_blob_hash(const void* data, size_t size) {
+  const u_char* bytes = static_cast<const u_char*>(data);
+  u_int64_t hash = 0xcbf29ce484222325ull;
+  u_int64_t word;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  hash = (hash ^ size) * 0x100000001b3ull;
+  return hash ^ (hash >> 29);
+}
+
+FileMapping :: ~FileMapping() {
+  if (mapping != nullptr) {
+    munmap(mapping, length);
+  }
+}
+
+bool FileMapping :: map(const std::string& path) {
+  struct stat st;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: Unable to open file: %s\n", path.c_str());
+    return false;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  void* address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    fprintf(stderr, "ERROR: Unable to map file: %s\n", path.c_str());
+    return false;
+  }
+  mapping = static_cast<u_char*>(address);
+  length = st.st_size;
+  return true;
+}
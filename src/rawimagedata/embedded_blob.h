@@ -0,0 +1,53 @@
+#ifndef EMBEDDED_BLOB_H
+#define EMBEDDED_BLOB_H
+
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+enum class Blob_Kind {
+  ICC_PROFILE,          // InterColorProfile, else AsShotICCProfile
+  XMP,
+  IPTC,
+  MAKERNOTE,            // The whole makernote, header included
+  LINEARIZATION_TABLE,  // Nikon makernote curves
+  CONTRAST_CURVE,
+  COUNT
+};
+
+const char* get_blob_name(Blob_Kind kind);
+
+/* Span of an embedded blob in the mapped file or the caller's memory, valid while the parser lives */
+struct blob_t {
+  Blob_Kind kind = Blob_Kind::COUNT;
+  const u_char* data = nullptr;
+  size_t size = 0;
+  off_t offset = 0;         // In the file
+  u_int64_t hash = 0;       // Of the bytes (get_blob_hash()), equal blobs of any file hash the same
+};
+
+/* 64 bit FNV-1a over 8 byte words and the length, a cache key rather than a checksum */
+u_int64_t get_blob_hash(const void* data, size_t size);
+
+/* Read only mapping of a whole file, the pages are read as the spans are touched */
+class FileMapping {
+
+public:
+  FileMapping() {}
+  ~FileMapping();
+  FileMapping(const FileMapping&) = delete;
+  FileMapping& operator=(const FileMapping&) = delete;
+
+  bool map(const std::string& path);
+  const u_char* data() const { return mapping; }
+  size_t size() const { return length; }
+
+private:
+  u_char* mapping = nullptr;
+  size_t length = 0;
+
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "file_prefetch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+FilePrefetcher :: FilePrefetcher(const std::vector<std::string>& paths, const prefetch_options_t& options)
+  : paths(paths), options(options), file_bytes(paths.size(), 0), released(paths.size(), false) {
+  if (options.queue_depth > 0 && !paths.empty()) {
+    limit = std::min((size_t)options.queue_depth, paths.size());
+    thread = std::thread(&FilePrefetcher::prefetch_loop, this);
+  }
+}
+
+FilePrefetcher :: ~FilePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_one();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void FilePrefetcher :: start(size_t index) {
+  if (!thread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = std::max(limit, std::min(index + 1 + options.queue_depth, paths.size()));
+  }
+  wake.notify_one();
+}
+
+void FilePrefetcher :: release(size_t index) {
+  if (!thread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes_in_flight -= file_bytes[index];
+    file_bytes[index] = 0;
+    released[index] = true;
+  }
+  wake.notify_one();
+}
+
+size_t FilePrefetcher :: get_bytes_requested() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return bytes_requested;
+}
+
+void FilePrefetcher :: prefetch_loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this]() {
+      return stop || (next < limit && (options.max_bytes == 0 || bytes_in_flight < options.max_bytes));
+    });
+    if (stop) {
+      return;
+    }
+    size_t index = next++;
+    lock.unlock();
+    size_t bytes = prefetch_file(paths[index]);
+    lock.lock();
+    // Released before the read ahead finished: nothing left to count
+    if (!released[index]) {
+      file_bytes[index] = bytes;
+      bytes_in_flight += bytes;
+    }
+    bytes_requested += bytes;
+  }
+}
+
+size_t FilePrefetcher :: prefetch_file(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);   // Does not wait for a FIFO writer
+  struct stat st;
+  size_t bytes = 0;
+
+  if (fd < 0) {
+    return 0;   // Reported by the decode that opens it
+  }
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    bytes = st.st_size;
+    if (options.header_bytes) {
+      bytes = std::min(bytes, options.header_bytes);
+    }
+    // Chunks keep each call short, so a stop is not held up by a large file
+    for (size_t offset = 0; offset < bytes && !stop; offset += PREFETCH_CHUNK_BYTES) {
+      posix_fadvise(fd, offset, std::min((size_t)PREFETCH_CHUNK_BYTES, bytes - offset), POSIX_FADV_WILLNEED);
+    }
+  }
+  close(fd);
+  return bytes;
+}
@@ -0,0 +1,64 @@
+#ifndef FILE_PREFETCH_H
+#define FILE_PREFETCH_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define PREFETCH_CHUNK_BYTES (8 << 20)
+#define PREFETCH_HEADER_BYTES (256 << 10)
+
+struct prefetch_options_t {
+  u_int queue_depth = 2;              // Files read ahead of the ones being decoded, 0: off
+  size_t max_bytes = 512 << 20;       // Bytes read ahead and not yet released, 0: no limit
+  size_t header_bytes = 0;            // Read only this much of each file (metadata scans), 0: whole file
+};
+
+/*
+ * Warms the page cache for files a batch is about to open. A background
+ * thread asks the kernel to read each file ahead (posix_fadvise WILLNEED in
+ * large chunks), so disk or network reads of the next files overlap with the
+ * decode of the current ones. Files are read ahead in order, at most
+ * queue_depth past the last one started, while the files read ahead and not
+ * yet released stay under max_bytes (the next file is admitted as long as
+ * the budget is not already used up).
+ */
+class FilePrefetcher {
+
+public:
+  FilePrefetcher(const std::vector<std::string>& paths, const prefetch_options_t& options);
+  ~FilePrefetcher();
+
+  void start(size_t index);       // File index is being opened, read ahead of it
+  void release(size_t index);     // File index is done, its bytes leave the budget
+
+  size_t get_bytes_requested();
+
+private:
+  const std::vector<std::string>& paths;
+  prefetch_options_t options;
+  std::vector<size_t> file_bytes;   // Bytes read ahead per file, counted until released
+  std::vector<bool> released;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stop { false };
+  size_t next = 0;                  // Next file to read ahead
+  size_t limit = 0;                 // Read ahead up to (excluding) this file
+  size_t bytes_in_flight = 0;
+  size_t bytes_requested = 0;
+
+  void prefetch_loop();
+  size_t prefetch_file(const std::string& path);
+
+};
+
+#endif
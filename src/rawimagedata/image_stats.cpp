@@ -0,0 +1,299 @@
+#include "image_stats.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define STATS_MIN_CHUNK_ROWS 16
+
+u_int image_stats_t :: get_percentile(u_int channel, double percent) const {
+  if (!set || channel >= n_channels || channels[channel].count == 0) {
+    return 0;
+  }
+  const channel_stats_t& ch = channels[channel];
+  u_int64_t target = (u_int64_t)ceil(ch.count * std::min(std::max(percent, 0.0), 100.0) / 100);
+  u_int64_t total = 0;
+  for (u_int bin = 0; bin < bins; ++bin) {
+    total += ch.histogram[bin];
+    if (total >= std::max(target, (u_int64_t)1)) {
+      // Centre of the bin, clamped to the observed range
+      u_int value = (bin << shift) + ((1u << shift) >> 1);
+      return std::min(std::max(value, ch.min), ch.max);
+    }
+  }
+  return ch.max;
+}
+
+bool stats_accumulator_t :: init(const RawImage& image, u_int bins) {
+  u_int white, levels;
+
+  if (!image.is_cfa() && (image.channels == 0 || image.channels > STATS_MAX_CHANNELS)) {
+    fprintf(stderr, "ERROR: Statistics need a CFA or up to %d channel image\n", STATS_MAX_CHANNELS);
+    return false;
+  }
+  stats = image_stats_t();
+  stats.cfa_domain = image.is_cfa();
+  stats.n_channels = stats.cfa_domain ? 4 : image.channels;
+
+  // Float samples are binned as 16 bit
+  white = image.sample_bytes == 4 ? 0xffff : image.white;
+  if (white == 0) {
+    white = image.sample_bytes == 1 ? 0xff : 0xffff;
+  }
+  stats.white = white;
+
+  // Power of two bins covering 0 - white, no finer than one value per bin
+  for (levels = 1; levels <= white && levels < 0x10000; levels <<= 1);
+  for (stats.bins = 1; stats.bins * 2 <= std::max(bins, 2u) && stats.bins < levels; stats.bins <<= 1);
+  for (stats.shift = 0; (levels >> stats.shift) > stats.bins; ++stats.shift);
+
+  for (u_int site = 0; site < 4; ++site) {
+    black[site] = stats.cfa_domain ? image.black[site] : 0;
+  }
+  for (u_int c = 0; c < stats.n_channels; ++c) {
+    stats.channels[c].histogram.assign(stats.bins, 0);
+  }
+  counters.assign((size_t)stats.n_channels * STATS_COPIES * stats.bins, 0);
+  stats.set = true;
+  return true;
+}
+
+/*
+ * Two interleaved channels (a CFA row): even samples to a, odd to b.
+ * Bins are computed eight at a time and each sample of a group goes to its
+ * own copy of the histogram, so runs of equal values do not serialise on
+ * one counter.
+ */
+static void add_cfa_row(const u_int16_t* src, u_int width, stats_accumulator_t* acc, u_int a, u_int b) {
+  image_stats_t& stats = acc->stats;
+  channel_stats_t& ch_a = stats.channels[a];
+  channel_stats_t& ch_b = stats.channels[b];
+  u_int32_t* hist_a = acc->counters.data() + (size_t)a * STATS_COPIES * stats.bins;
+  u_int32_t* hist_b = acc->counters.data() + (size_t)b * STATS_COPIES * stats.bins;
+  const u_int bins = stats.bins, top = bins - 1, shift = stats.shift;
+  const u_int white = stats.white;
+  const u_int black_a = acc->black[a], black_b = acc->black[b];
+  u_int x = 0;
+
+#if defined(__SSE2__)
+  const __m128i top_v = _mm_set1_epi16((short)top);
+  const __m128i white_v = _mm_set1_epi16((short)white);
+  const __m128i black_v = _mm_set1_epi32(black_a | black_b << 16);
+  const __m128i low_mask = _mm_set1_epi32(0xffff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i shift_v = _mm_cvtsi32_si128(shift);
+  __m128i sum_a = zero, sum_b = zero;
+  __m128i min_v = _mm_set1_epi16(-1), max_v = zero;
+  alignas(16) u_int16_t bin[8];
+  u_int64_t high_a = 0, high_b = 0, low_a = 0, low_b = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    // min(v >> shift, top) without SSE4.1 unsigned min
+    __m128i index = _mm_srl_epi16(v, shift_v);
+    index = _mm_sub_epi16(index, _mm_subs_epu16(index, top_v));
+    _mm_store_si128(reinterpret_cast<__m128i*>(bin), index);
+
+    ++hist_a[0 * bins + bin[0]];
+    ++hist_b[0 * bins + bin[1]];
+    ++hist_a[1 * bins + bin[2]];
+    ++hist_b[1 * bins + bin[3]];
+    ++hist_a[2 * bins + bin[4]];
+    ++hist_b[2 * bins + bin[5]];
+    ++hist_a[3 * bins + bin[6]];
+    ++hist_b[3 * bins + bin[7]];
+
+    sum_a = _mm_add_epi32(sum_a, _mm_and_si128(v, low_mask));
+    sum_b = _mm_add_epi32(sum_b, _mm_srli_epi32(v, 16));
+    min_v = _mm_sub_epi16(min_v, _mm_subs_epu16(min_v, v));
+    max_v = _mm_add_epi16(max_v, _mm_subs_epu16(v, max_v));
+
+    // Two mask bits per sample: even samples 0x3333, odd 0xcccc
+    u_int high = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(white_v, v), zero));
+    u_int low = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, black_v), zero));
+    high_a += __builtin_popcount(high & 0x3333) >> 1;
+    high_b += __builtin_popcount(high & 0xcccc) >> 1;
+    low_a += __builtin_popcount(low & 0x3333) >> 1;
+    low_b += __builtin_popcount(low & 0xcccc) >> 1;
+  }
+
+  alignas(16) u_int32_t sums[8];
+  alignas(16) u_int16_t extremes[16];
+  _mm_store_si128(reinterpret_cast<__m128i*>(sums), sum_a);
+  _mm_store_si128(reinterpret_cast<__m128i*>(sums + 4), sum_b);
+  _mm_store_si128(reinterpret_cast<__m128i*>(extremes), min_v);
+  _mm_store_si128(reinterpret_cast<__m128i*>(extremes + 8), max_v);
+  if (x > 0) {
+    for (u_int i = 0; i < 4; ++i) {
+      ch_a.sum += sums[i];
+      ch_b.sum += sums[4 + i];
+    }
+    for (u_int i = 0; i < 8; i += 2) {
+      ch_a.min = std::min(ch_a.min, (u_int)extremes[i]);
+      ch_b.min = std::min(ch_b.min, (u_int)extremes[i + 1]);
+      ch_a.max = std::max(ch_a.max, (u_int)extremes[8 + i]);
+      ch_b.max = std::max(ch_b.max, (u_int)extremes[8 + i + 1]);
+    }
+    ch_a.count += x / 2;
+    ch_b.count += x / 2;
+    ch_a.clipped_high += high_a;
+    ch_b.clipped_high += high_b;
+    ch_a.clipped_low += low_a;
+    ch_b.clipped_low += low_b;
+  }
+#endif
+  for (; x < width; ++x) {
+    u_int value = src[x];
+    bool odd = x & 1;
+    channel_stats_t& ch = odd ? ch_b : ch_a;
+    u_int32_t* hist = odd ? hist_b : hist_a;
+    u_int index = std::min(value >> shift, top);
+    ++hist[index];
+    ch.sum += value;
+    ch.min = std::min(ch.min, value);
+    ch.max = std::max(ch.max, value);
+    ch.clipped_high += value >= white;
+    ch.clipped_low += value <= (odd ? black_b : black_a);
+    ++ch.count;
+  }
+}
+
+/* Interleaved pixels, consecutive pixels spread over the histogram copies */
+template <typename T>
+static void add_pixel_row(const T* src, u_int width, stats_accumulator_t* acc) {
+  image_stats_t& stats = acc->stats;
+  const u_int channels = stats.n_channels;
+  const u_int bins = stats.bins, top = bins - 1, shift = stats.shift;
+  const u_int white = stats.white;
+  u_int64_t sum[STATS_MAX_CHANNELS] = { 0 };
+  u_int64_t high[STATS_MAX_CHANNELS] = { 0 }, low[STATS_MAX_CHANNELS] = { 0 };
+  u_int min[STATS_MAX_CHANNELS], max[STATS_MAX_CHANNELS] = { 0 };
+  u_int value;
+
+  for (u_int c = 0; c < channels; ++c) {
+    min[c] = UINT32_MAX;
+  }
+  for (u_int x = 0; x < width; ++x) {
+    u_int32_t* copy = acc->counters.data() + (size_t)(x & (STATS_COPIES - 1)) * bins;
+    for (u_int c = 0; c < channels; ++c) {
+      if (sizeof(T) == 4) {
+        value = (u_int)lrintf(std::min(std::max((float)src[x * channels + c], 0.0f), 1.0f) * 65535.0f);
+      } else {
+        value = (u_int)src[x * channels + c];
+      }
+      ++copy[(size_t)c * STATS_COPIES * bins + std::min(value >> shift, top)];
+      sum[c] += value;
+      min[c] = std::min(min[c], value);
+      max[c] = std::max(max[c], value);
+      high[c] += value >= white;
+      low[c] += value == 0;
+    }
+  }
+  for (u_int c = 0; c < channels; ++c) {
+    channel_stats_t& ch = stats.channels[c];
+    ch.count += width;
+    ch.sum += sum[c];
+    ch.min = std::min(ch.min, min[c]);
+    ch.max = std::max(ch.max, max[c]);
+    ch.clipped_high += high[c];
+    ch.clipped_low += low[c];
+  }
+}
+
+void stats_accumulator_t :: add_rows(const RawImage& rows, u_int y0) {
+  for (u_int y = 0; y < rows.height; ++y) {
+    if (stats.cfa_domain) {
+      u_int site = cfa_site(y0 + y, 0);
+      add_cfa_row(rows.row(y), rows.width, this, site, site + 1);
+      continue;
+    }
+    switch (rows.sample_bytes) {
+      case 1:  add_pixel_row(rows.row<u_int8_t>(y), rows.width, this); break;
+      case 4:  add_pixel_row(rows.row<float>(y), rows.width, this); break;
+      default: add_pixel_row(rows.row<u_int16_t>(y), rows.width, this); break;
+    }
+  }
+}
+
+void stats_accumulator_t :: finish(image_stats_t* result) {
+  for (u_int c = 0; c < stats.n_channels; ++c) {
+    const u_int32_t* copies = counters.data() + (size_t)c * STATS_COPIES * stats.bins;
+    std::vector<u_int64_t>& histogram = stats.channels[c].histogram;
+    for (u_int copy = 0; copy < STATS_COPIES; ++copy) {
+      for (u_int bin = 0; bin < stats.bins; ++bin) {
+        histogram[bin] += copies[copy * stats.bins + bin];
+      }
+    }
+  }
+  counters.assign(counters.size(), 0);
+  merge_image_stats(result, stats);
+  for (u_int c = 0; c < stats.n_channels; ++c) {
+    stats.channels[c] = channel_stats_t();
+    stats.channels[c].histogram.assign(stats.bins, 0);
+  }
+}
+
+void merge_image_stats(image_stats_t* dest, const image_stats_t& src) {
+  if (!dest->set) {
+    *dest = src;
+  } else {
+    for (u_int c = 0; c < dest->n_channels; ++c) {
+      channel_stats_t& d = dest->channels[c];
+      const channel_stats_t& s = src.channels[c];
+      for (u_int bin = 0; bin < dest->bins; ++bin) {
+        d.histogram[bin] += s.histogram[bin];
+      }
+      d.count += s.count;
+      d.sum += s.sum;
+      d.clipped_high += s.clipped_high;
+      d.clipped_low += s.clipped_low;
+      d.min = std::min(d.min, s.min);
+      d.max = std::max(d.max, s.max);
+    }
+  }
+  for (u_int c = 0; c < dest->n_channels; ++c) {
+    channel_stats_t& ch = dest->channels[c];
+    ch.mean = ch.count ? (double)ch.sum / ch.count : 0;
+  }
+}
+
+bool compute_image_stats(const RawImage& image, image_stats_t* stats, const stats_options_t& options) {
+  stats_accumulator_t first;
+  if (!first.init(image, options.bins)) {
+    return false;
+  }
+  *stats = image_stats_t();
+
+  // One sub-histogram per chunk of rows, chunks in even row pairs
+  u_int n_chunks = options.pool != nullptr ? options.pool->size() + 1 : 1;
+  n_chunks = std::max(1u, std::min(n_chunks, image.height / STATS_MIN_CHUNK_ROWS));
+  u_int chunk_rows = ((image.height + n_chunks - 1) / n_chunks + 1) & ~1u;
+  std::vector<stats_accumulator_t> partials(n_chunks);
+  partials[0] = std::move(first);
+
+  auto run_chunk = [&](u_int chunk) {
+    u_int y = chunk * chunk_rows;
+    if (y >= image.height) {
+      return;
+    }
+    if (chunk > 0) {
+      partials[chunk].init(image, options.bins);
+    }
+    partials[chunk].add_rows(image.view(0, y, image.width, std::min(chunk_rows, image.height - y)), y);
+  };
+  if (options.pool != nullptr && n_chunks > 1) {
+    options.pool->parallel_for(0, n_chunks, run_chunk);
+  } else {
+    for (u_int chunk = 0; chunk < n_chunks; ++chunk) {
+      run_chunk(chunk);
+    }
+  }
+  for (stats_accumulator_t& partial : partials) {
+    if (partial.stats.set) {
+      partial.finish(stats);
+    }
+  }
+  return true;
+}
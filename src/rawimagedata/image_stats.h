@@ -0,0 +1,62 @@
+#ifndef IMAGE_STATS_H
+#define IMAGE_STATS_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+
+#define STATS_MAX_CHANNELS 4
+#define STATS_COPIES 4        // Replicated counters per channel, merged at the end
+
+struct channel_stats_t {
+  std::vector<u_int64_t> histogram;
+  u_int64_t count = 0;
+  u_int64_t sum = 0;
+  u_int64_t clipped_high = 0;   // At or above the white level
+  u_int64_t clipped_low = 0;    // At or below the black level
+  u_int min = UINT32_MAX;
+  u_int max = 0;
+  double mean = 0;
+};
+
+/*
+ * Per channel statistics of an image. For a CFA image channels are the
+ * four 2x2 sites (so both greens are kept apart), for RGB the colours.
+ */
+struct image_stats_t {
+  bool set = false;
+  bool cfa_domain = false;
+  u_int n_channels = 0;
+  u_int bins = 0;
+  u_int shift = 0;              // Sample value >> shift = bin
+  u_int white = 0;
+  channel_stats_t channels[STATS_MAX_CHANNELS];
+
+  u_int get_percentile(u_int channel, double percent) const;
+};
+
+struct stats_options_t {
+  u_int bins = 4096;
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+};
+
+bool compute_image_stats(const RawImage& image, image_stats_t* stats, const stats_options_t& options);
+
+/* Row level accumulation, for stages that feed rows while they are in cache */
+struct stats_accumulator_t {
+  image_stats_t stats;
+  u_int black[4] = { 0 };
+  std::vector<u_int32_t> counters;   // [channel][copy][bin]
+
+  bool init(const RawImage& image, u_int bins);
+  void add_rows(const RawImage& rows, u_int y0);
+  void finish(image_stats_t* result);
+};
+
+void merge_image_stats(image_stats_t* dest, const image_stats_t& src);
+
+#endif
@@ -0,0 +1,422 @@
+#include "image_writer.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+
+struct tiff_entry_t {
+  u_int16_t tag;
+  u_int16_t type;
+  u_int32_t count;
+  std::vector<u_char> value;
+};
+
+static tiff_entry_t tiff_entry(u_int16_t tag, u_int16_t type, const void* values, u_int32_t count) {
+  tiff_entry_t entry = { tag, type, count, {} };
+  size_t size = (size_t)count * (type == TIFF_SHORT ? 2 : 4);
+  entry.value.assign(reinterpret_cast<const u_char*>(values), reinterpret_cast<const u_char*>(values) + size);
+  return entry;
+}
+
+static tiff_entry_t tiff_short(u_int16_t tag, u_int16_t value) {
+  return tiff_entry(tag, TIFF_SHORT, &value, 1);
+}
+
+static tiff_entry_t tiff_long(u_int16_t tag, u_int32_t value) {
+  return tiff_entry(tag, TIFF_LONG, &value, 1);
+}
+
+ImageWriter :: ImageWriter() {
+}
+
+ImageWriter :: ~ImageWriter() {
+  if (fd >= 0) {
+    close();
+  }
+  free(buffer);
+}
+
+bool ImageWriter :: open(const char* path, u_int width, u_int height, u_int channels, u_int sample_bytes, const image_writer_options_t& options) {
+  if (fd >= 0) {
+    fprintf(stderr, "ERROR: Writer already open\n");
+    return false;
+  }
+  if (width == 0 || height == 0 || (channels != 1 && channels != 3)) {
+    fprintf(stderr, "ERROR: Can only write 1 or 3 channel images\n");
+    return false;
+  }
+  if (sample_bytes != 1 && sample_bytes != 2 && (sample_bytes != 4 || options.format != Image_File_Format::TIFF)) {
+    fprintf(stderr, "ERROR: Unsupported sample size: %d bytes\n", sample_bytes);
+    return false;
+  }
+#ifndef HAVE_ZLIB
+  if (options.deflate) {
+    fprintf(stderr, "ERROR: Built without zlib, deflate not available\n");
+    return false;
+  }
+#endif
+
+  this->options = options;
+  this->path = path;
+  this->width = width;
+  this->height = height;
+  this->channels = channels;
+  this->sample_bytes = sample_bytes;
+  row_bytes = (size_t)width * channels * sample_bytes;
+  rows_per_strip = options.rows_per_strip;
+  if (rows_per_strip == 0) {
+    rows_per_strip = std::max((size_t)1, WRITER_STRIP_BYTES / row_bytes);
+  }
+  rows_per_strip = std::min(rows_per_strip, height);
+  rows_written = 0;
+  failed = false;
+
+  // Enough strips per batch to keep every worker busy
+  batch.resize(options.pool != nullptr ? std::max(1u, options.pool->size() * 2) : 1);
+  for (strip_t& strip : batch) {
+    strip.data.resize(rows_per_strip * row_bytes);
+    strip.rows = 0;
+  }
+  n_filled = 0;
+  strip_offsets.clear();
+  strip_byte_counts.clear();
+
+  buffer_size = std::max(options.buffer_size, (size_t)WRITER_IO_ALIGN) / WRITER_IO_ALIGN * WRITER_IO_ALIGN;
+  free(buffer);
+  buffer = static_cast<u_char*>(aligned_alloc(WRITER_IO_ALIGN, buffer_size));
+  buffer_used = 0;
+  file_offset = 0;
+  if (buffer == nullptr) {
+    fprintf(stderr, "ERROR: Unable to allocate write buffer\n");
+    return false;
+  }
+
+  direct = false;
+  fd = -1;
+#ifdef O_DIRECT
+  if (options.direct_io) {
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    direct = fd >= 0;
+  }
+#endif
+  if (fd < 0) {
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: Unable to open file for writing: %s\n", path);
+    return false;
+  }
+
+  if (options.format == Image_File_Format::PNM) {
+    return write_pnm_header();
+  }
+  // Samples are written in host order, the header says which one that is
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const char header[8] = { 'I', 'I', 42, 0, 0, 0, 0, 0 };
+#else
+  const char header[8] = { 'M', 'M', 0, 42, 0, 0, 0, 0 };
+#endif
+  return append(header, sizeof(header));
+}
+
+bool ImageWriter :: write_pnm_header() {
+  char header[64];
+  int length = snprintf(header, sizeof(header), "P%c\n%u %u\n%u\n", channels == 3 ? '6' : '5', width, height, sample_bytes == 1 ? 255 : 65535);
+  return append(header, length);
+}
+
+bool ImageWriter :: write_rows(const RawImage& rows) {
+  if (fd < 0 || failed) {
+    return false;
+  }
+  if (rows.width != width || rows.channels != channels || rows.sample_bytes != sample_bytes) {
+    fprintf(stderr, "ERROR: Rows do not match the image being written\n");
+    return false;
+  }
+  if (rows_written + rows.height > height) {
+    fprintf(stderr, "ERROR: More rows than the image height %d\n", height);
+    return false;
+  }
+
+  for (u_int y = 0; y < rows.height; ++y) {
+    strip_t& strip = batch[n_filled];
+    memcpy(strip.data.data() + strip.rows * row_bytes, rows.row<u_char>(y), row_bytes);
+    ++rows_written;
+    if (++strip.rows == rows_per_strip && ++n_filled == batch.size() && !flush_batch()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ImageWriter :: encode_strip(strip_t* strip) {
+  size_t size = strip->rows * row_bytes;
+
+  strip->ok = true;
+  if (options.format == Image_File_Format::PNM) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // 16 bit PNM samples are big endian
+    if (sample_bytes == 2) {
+      u_int16_t* s = reinterpret_cast<u_int16_t*>(strip->data.data());
+      for (size_t i = 0; i < size / 2; ++i) {
+        s[i] = __builtin_bswap16(s[i]);
+      }
+    }
+#endif
+    return;
+  }
+  if (!options.deflate) {
+    return;
+  }
+
+#ifdef HAVE_ZLIB
+  // Horizontal differencing (TIFF predictor 2), right to left so it works in place
+  if (sample_bytes == 1) {
+    for (u_int y = 0; y < strip->rows; ++y) {
+      u_int8_t* s = strip->data.data() + y * row_bytes;
+      for (size_t i = (size_t)width * channels - 1; i >= channels; --i) {
+        s[i] -= s[i - channels];
+      }
+    }
+  } else if (sample_bytes == 2) {
+    for (u_int y = 0; y < strip->rows; ++y) {
+      u_int16_t* s = reinterpret_cast<u_int16_t*>(strip->data.data() + y * row_bytes);
+      for (size_t i = (size_t)width * channels - 1; i >= channels; --i) {
+        s[i] -= s[i - channels];
+      }
+    }
+  }
+
+  uLongf length = compressBound(size);
+  strip->encoded.resize(length);
+  strip->ok = compress2(strip->encoded.data(), &length, strip->data.data(), size, options.deflate_level) == Z_OK;
+  strip->encoded.resize(length);
+#endif
+}
+
+bool ImageWriter :: flush_batch() {
+  if (n_filled == 0) {
+    return true;
+  }
+  auto run_strip = [&](u_int index) {
+    encode_strip(&batch[index]);
+  };
+  if (options.pool != nullptr && n_filled > 1) {
+    options.pool->parallel_for(0, n_filled, run_strip);
+  } else {
+    for (u_int index = 0; index < n_filled; ++index) {
+      run_strip(index);
+    }
+  }
+
+  for (u_int index = 0; index < n_filled; ++index) {
+    strip_t& strip = batch[index];
+    bool encoded = options.deflate && options.format == Image_File_Format::TIFF;
+    const u_char* data = encoded ? strip.encoded.data() : strip.data.data();
+    size_t size = encoded ? strip.encoded.size() : strip.rows * row_bytes;
+
+    if (!strip.ok) {
+      fprintf(stderr, "ERROR: Strip compression failed\n");
+      failed = true;
+      return false;
+    }
+    if (options.format == Image_File_Format::TIFF && get_position() + size > UINT32_MAX) {
+      fprintf(stderr, "ERROR: TIFF output over 4GB\n");
+      failed = true;
+      return false;
+    }
+    strip_offsets.push_back((u_int32_t)get_position());
+    strip_byte_counts.push_back((u_int32_t)size);
+    if (!append(data, size)) {
+      return false;
+    }
+    strip.rows = 0;
+  }
+  n_filled = 0;
+  return true;
+}
+
+bool ImageWriter :: append(const void* data, size_t size) {
+  const u_char* p = static_cast<const u_char*>(data);
+  while (size > 0) {
+    size_t chunk = std::min(size, buffer_size - buffer_used);
+    memcpy(buffer + buffer_used, p, chunk);
+    buffer_used += chunk;
+    p += chunk;
+    size -= chunk;
+    if (buffer_used == buffer_size && !flush_buffer(false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ImageWriter :: flush_buffer(bool final) {
+  size_t size = buffer_used;
+  off_t length = get_position();
+
+  // O_DIRECT writes whole aligned blocks, the padding is truncated away after
+  if (direct && final && size % WRITER_IO_ALIGN) {
+    size_t padded = (size + WRITER_IO_ALIGN - 1) / WRITER_IO_ALIGN * WRITER_IO_ALIGN;
+    memset(buffer + size, 0, padded - size);
+    size = padded;
+  }
+  for (size_t done = 0; done < size; ) {
+    ssize_t n = ::write(fd, buffer + done, size - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "ERROR: Write failed: %s\n", strerror(errno));
+      failed = true;
+      return false;
+    }
+    done += n;
+  }
+  file_offset = length;
+  buffer_used = 0;
+  if (direct && final && ftruncate(fd, length) != 0) {
+    failed = true;
+    return false;
+  }
+  return true;
+}
+
+bool ImageWriter :: write_tiff_ifd() {
+  u_int16_t bits[3], formats[3];
+  u_int32_t n_strips = strip_offsets.size();
+  std::vector<tiff_entry_t> entries;
+
+  for (u_int c = 0; c < channels; ++c) {
+    bits[c] = sample_bytes * 8;
+    formats[c] = sample_bytes == 4 ? 3 : 1;     // IEEE float or unsigned integer
+  }
+  entries.push_back(tiff_long(256, width));
+  entries.push_back(tiff_long(257, height));
+  entries.push_back(tiff_entry(258, TIFF_SHORT, bits, channels));
+  entries.push_back(tiff_short(259, options.deflate ? 8 : 1));
+  entries.push_back(tiff_short(262, channels == 3 ? 2 : 1));
+  entries.push_back(tiff_entry(273, TIFF_LONG, strip_offsets.data(), n_strips));
+  if (options.orientation > 1 && options.orientation <= 8) {
+    entries.push_back(tiff_short(274, options.orientation));
+  }
+  entries.push_back(tiff_short(277, channels));
+  entries.push_back(tiff_long(278, rows_per_strip));
+  entries.push_back(tiff_entry(279, TIFF_LONG, strip_byte_counts.data(), n_strips));
+  entries.push_back(tiff_short(284, 1));
+  if (options.deflate && sample_bytes != 4) {
+    entries.push_back(tiff_short(317, 2));
+  }
+  entries.push_back(tiff_entry(339, TIFF_SHORT, formats, channels));
+
+  // IFD on a word boundary, values too long for an entry follow it
+  if (get_position() & 1) {
+    const u_char pad = 0;
+    if (!append(&pad, 1)) {
+      return false;
+    }
+  }
+  u_int32_t ifd_offset = get_position();
+  u_int32_t value_offset = ifd_offset + 2 + entries.size() * 12 + 4;
+  u_int16_t n_entries = entries.size();
+  u_int32_t next_ifd = 0;
+  std::vector<u_char> values;
+
+  if (!append(&n_entries, 2)) {
+    return false;
+  }
+  for (tiff_entry_t& entry : entries) {
+    u_char field[12] = { 0 };
+    memcpy(field, &entry.tag, 2);
+    memcpy(field + 2, &entry.type, 2);
+    memcpy(field + 4, &entry.count, 4);
+    if (entry.value.size() <= 4) {
+      memcpy(field + 8, entry.value.data(), entry.value.size());
+    } else {
+      u_int32_t offset = value_offset + values.size();
+      memcpy(field + 8, &offset, 4);
+      values.insert(values.end(), entry.value.begin(), entry.value.end());
+      if (values.size() & 1) {
+        values.push_back(0);
+      }
+    }
+    if (!append(field, sizeof(field))) {
+      return false;
+    }
+  }
+  if (!append(&next_ifd, 4) || !append(values.data(), values.size())) {
+    return false;
+  }
+  if (!flush_buffer(true)) {
+    return false;
+  }
+  return patch_tiff_header(ifd_offset);
+}
+
+bool ImageWriter :: patch_tiff_header(u_int32_t ifd_offset) {
+  int patch_fd = fd;
+
+  // O_DIRECT cannot do a 4 byte write, go through the page cache for it
+  if (direct) {
+    patch_fd = ::open(path.c_str(), O_WRONLY);
+    if (patch_fd < 0) {
+      failed = true;
+      return false;
+    }
+  }
+  bool ok = pwrite(patch_fd, &ifd_offset, 4, 4) == 4;
+  if (patch_fd != fd) {
+    ::close(patch_fd);
+  }
+  if (!ok) {
+    fprintf(stderr, "ERROR: Unable to write TIFF header\n");
+    failed = true;
+  }
+  return ok;
+}
+
+bool ImageWriter :: close() {
+  if (fd < 0) {
+    return false;
+  }
+  if (!failed) {
+    if (n_filled < batch.size() && batch[n_filled].rows > 0) {
+      ++n_filled;
+    }
+    if (rows_written != height) {
+      fprintf(stderr, "ERROR: Image closed after %d of %d rows\n", rows_written, height);
+      failed = true;
+    } else if (flush_batch()) {
+      if (options.format == Image_File_Format::TIFF) {
+        write_tiff_ifd();
+      } else {
+        flush_buffer(true);
+      }
+    }
+  }
+  if (::close(fd) != 0) {
+    failed = true;
+  }
+  fd = -1;
+  batch.clear();
+  return !failed;
+}
+
+bool write_image(const char* path, const RawImage& image, const image_writer_options_t& options) {
+  ImageWriter writer;
+  if (!writer.open(path, image.width, image.height, image.channels, image.sample_bytes, options)) {
+    return false;
+  }
+  if (!writer.write_rows(image)) {
+    writer.close();
+    return false;
+  }
+  return writer.close();
+}
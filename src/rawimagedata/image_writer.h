@@ -0,0 +1,98 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+
+#define WRITER_STRIP_BYTES (256 << 10)   // Target strip size when rows_per_strip is 0
+#define WRITER_IO_ALIGN 4096
+
+enum class Image_File_Format {
+  TIFF,       // Baseline TIFF, 8/16 bit integer or 32 bit float samples
+  PNM         // PPM (RGB) or PGM (grey), 8/16 bit
+};
+
+struct image_writer_options_t {
+  Image_File_Format format = Image_File_Format::TIFF;
+  bool deflate = false;       // TIFF only: per strip, with horizontal predictor
+  int deflate_level = 6;
+  u_int rows_per_strip = 0;
+  size_t buffer_size = (size_t)4 << 20;
+  bool direct_io = false;     // O_DIRECT, plain buffered writes if the file system refuses
+  int orientation = 1;        // TIFF only, EXIF orientation tag for rows written in sensor order
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+};
+
+/*
+ * Streaming image file writer. Rows are fed in bands as they are produced
+ * and cut into strips; a batch of strips is encoded in parallel, then
+ * appended in order through one large aligned write buffer. Only the
+ * batch is held in memory, never the whole image. The TIFF IFD goes at
+ * the end, once every strip size is known.
+ */
+class ImageWriter {
+
+public:
+  ImageWriter();
+  ~ImageWriter();
+
+  bool open(const char* path, u_int width, u_int height, u_int channels, u_int sample_bytes,
+            const image_writer_options_t& options = image_writer_options_t());
+  bool write_rows(const RawImage& rows);
+  bool close();
+
+  u_int get_rows_written() const { return rows_written; }
+
+private:
+  struct strip_t {
+    std::vector<u_char> data;
+    std::vector<u_char> encoded;
+    u_int rows = 0;
+    bool ok = true;
+  };
+
+  image_writer_options_t options;
+  int fd = -1;
+  bool direct = false;
+  bool failed = false;
+  std::string path;
+
+  u_int width = 0, height = 0;
+  u_int channels = 0, sample_bytes = 0;
+  size_t row_bytes = 0;
+  u_int rows_per_strip = 0;
+  u_int rows_written = 0;
+
+  std::vector<strip_t> batch;
+  u_int n_filled = 0;         // Strips of the batch holding rows
+
+  u_char* buffer = nullptr;
+  size_t buffer_size = 0, buffer_used = 0;
+  off_t file_offset = 0;      // Bytes handed to the kernel
+
+  std::vector<u_int32_t> strip_offsets;
+  std::vector<u_int32_t> strip_byte_counts;
+
+  bool append(const void* data, size_t size);
+  bool flush_buffer(bool final);
+  bool flush_batch();
+  void encode_strip(strip_t* strip);
+
+  bool write_pnm_header();
+  bool write_tiff_ifd();
+  bool patch_tiff_header(u_int32_t ifd_offset);
+
+  off_t get_position() const { return file_offset + buffer_used; }
+
+};
+
+bool write_image(const char* path, const RawImage& image, const image_writer_options_t& options = image_writer_options_t());
+
+#endif
@@ -1,5 +1,6 @@
 
 #include "jpegimagedata.h"
+#include "rawimagedata_utils.h"
 
 /**
  * https://yasoob.me/posts/understanding-and-writing-jpeg-decoder-in-python/
@@ -30,7 +31,7 @@ bool parse_jpeg_info(std::ifstream& file, jpeg_info_t* jpeg_info, bool info_only
     
     file.read(reinterpret_cast<char*>(&data), length);
     dp = data;
-    printf("JPEG Marker: 0x%x, length: %d\n", marker, length);
+    DEBUG_PRINT("JPEG Marker: 0x%x, length: %d\n", marker, length);
     switch (marker) {
       case 0xffe0:  // APP0 (Application 0)
         break;
@@ -68,7 +69,7 @@ bool parse_jpeg_info(std::ifstream& file, jpeg_info_t* jpeg_info, bool info_only
     return true;
   }
   if (!c_dht || !c_sos || !c_dqt || !c_dri) {
-    printf("ERROR: JPEG HEADER NOT FULL");
+    fprintf(stderr, "ERROR: JPEG header not full\n");
     return false;
   }
 
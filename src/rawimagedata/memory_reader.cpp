@@ -0,0 +1,23 @@
+#include "memory_reader.h"
+
+MemoryReader :: MemoryReader(const void* data, size_t size) {
+  char* begin = const_cast<char*>(static_cast<const char*>(data));
+  setg(begin, begin, begin + size);
+}
+
+std::streambuf::pos_type MemoryReader :: seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) {
+  if (dir == std::ios::cur) {
+    offset += gptr() - eback();
+  } else if (dir == std::ios::end) {
+    offset += egptr() - eback();
+  }
+  return seekpos(offset, mode);
+}
+
+std::streambuf::pos_type MemoryReader :: seekpos(pos_type pos, std::ios::openmode) {
+  if (pos < 0 || pos > egptr() - eback()) {
+    return pos_type(off_type(-1));
+  }
+  setg(eback(), eback() + (off_type)pos, egptr());
+  return pos;
+}
@@ -0,0 +1,21 @@
+#ifndef MEMORY_READER_H
+#define MEMORY_READER_H
+
+#include <iostream>
+#include <streambuf>
+#include <cstdint>
+#include <cstring>
+
+/* Seekable stream buffer over caller memory, nothing is copied */
+class MemoryReader : public std::streambuf {
+
+public:
+  MemoryReader(const void* data, size_t size);
+
+protected:
+  pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) override;
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override;
+
+};
+
+#endif
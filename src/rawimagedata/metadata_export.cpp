@@ -0,0 +1,593 @@
+#include "metadata_export.h"
+#include "cameras/camera_raw.h"
+
+#include <time.h>
+
+// Arrow IPC buffers and FlatBuffers are little endian, both are written from memory as is
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "metadata_export.cpp writes little endian Arrow buffers"
+#endif
+
+#define ARROW_ALIGN 8
+#define ARROW_METADATA_V5 4
+#define ARROW_CONTINUATION 0xffffffff
+
+static const char ARROW_MAGIC[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+
+enum class Export_Type { UTF8, DICTIONARY, UINT32, INT32, FLOAT64, TIMESTAMP };
+
+// Arrow schema enums (Schema.fbs, Message.fbs)
+enum Arrow_Type : u_char { ARROW_INT = 2, ARROW_FLOATING_POINT = 3, ARROW_UTF8 = 5, ARROW_TIMESTAMP = 10 };
+enum Arrow_Header : u_char { ARROW_SCHEMA = 1, ARROW_DICTIONARY_BATCH = 2, ARROW_RECORD_BATCH = 3 };
+
+struct export_column_spec_t {
+  const char* name;
+  Export_Type type;
+  bool nullable;
+};
+
+static const export_column_spec_t COLUMNS[(int)Export_Column::COUNT] = {
+  { "path", Export_Type::UTF8, false },
+  { "make", Export_Type::DICTIONARY, true },
+  { "model", Export_Type::DICTIONARY, true },
+  { "lens_model", Export_Type::DICTIONARY, true },
+  { "width", Export_Type::UINT32, false },
+  { "height", Export_Type::UINT32, false },
+  { "bps", Export_Type::UINT32, false },
+  { "compression", Export_Type::UINT32, false },
+  { "sample_pixel", Export_Type::UINT32, false },
+  { "orientation", Export_Type::INT32, false },
+  { "date_time", Export_Type::TIMESTAMP, true },
+  { "exposure", Export_Type::FLOAT64, true },
+  { "f_number", Export_Type::FLOAT64, true },
+  { "focal_length", Export_Type::FLOAT64, true },
+  { "iso", Export_Type::FLOAT64, true },
+  { "image_count", Export_Type::UINT32, true },
+  { "shutter_count", Export_Type::UINT32, true },
+  { "lens_type", Export_Type::UINT32, true },
+  { "min_focal_length", Export_Type::FLOAT64, true },
+  { "max_focal_length", Export_Type::FLOAT64, true },
+  { "min_f_number", Export_Type::FLOAT64, true },
+  { "max_f_number", Export_Type::FLOAT64, true },
+  { "gps_latitude", Export_Type::FLOAT64, true },
+  { "gps_longitude", Export_Type::FLOAT64, true },
+  { "gps_altitude", Export_Type::FLOAT64, true },
+};
+
+/* Column of one record batch: validity bits, fixed width values or UTF8 offsets and bytes */
+struct export_column_t {
+  std::vector<u_char> validity;
+  std::vector<u_char> values;
+  std::vector<int32_t> offsets;
+  std::vector<char> data;
+  int64_t null_count = 0;
+};
+
+struct export_batch_t {
+  u_int rows = 0;
+  export_column_t columns[(int)Export_Column::COUNT];
+
+  void clear() {
+    rows = 0;
+    for (export_column_t& column : columns) {
+      column.validity.clear();
+      column.values.clear();
+      column.offsets.assign(1, 0);
+      column.data.clear();
+      column.null_count = 0;
+    }
+  }
+};
+
+/*
+ * Minimal FlatBuffers builder for the Arrow metadata, built back to front
+ * as the format expects: children first, references are distances from
+ * the end of the buffer until finish().
+ */
+class FlatBuilder {
+
+public:
+  FlatBuilder() : buffer(1024), head(1024) {}
+
+  u_int32_t size() const { return buffer.size() - head; }
+
+  // Pads so the buffer is aligned once `extra` more bytes are in
+  void align(size_t alignment, size_t extra = 0) {
+    zeros((alignment - (size() + extra) % alignment) % alignment);
+  }
+
+  void zeros(size_t n) {
+    reserve(n);
+    head -= n;
+    memset(&buffer[head], 0, n);
+  }
+
+  void bytes(const void* data, size_t n) {
+    reserve(n);
+    head -= n;
+    memcpy(&buffer[head], data, n);
+  }
+
+  template <typename T> u_int32_t scalar(T value) {
+    align(sizeof(T));
+    bytes(&value, sizeof(T));
+    return size();
+  }
+
+  u_int32_t offset(u_int32_t ref) {
+    align(4);
+    return scalar<u_int32_t>(size() + 4 - ref);
+  }
+
+  u_int32_t string(const char* s) {
+    size_t n = strlen(s);
+    align(4, n + 1);
+    zeros(1);
+    bytes(s, n);
+    return scalar<u_int32_t>(n);
+  }
+
+  u_int32_t offsets(const std::vector<u_int32_t>& refs) {
+    align(4, refs.size() * 4);
+    for (size_t i = refs.size(); i-- > 0;) {
+      offset(refs[i]);
+    }
+    return scalar<u_int32_t>(refs.size());
+  }
+
+  // Structs of int64 fields (Block, FieldNode, Buffer)
+  u_int32_t structs(const void* data, size_t count, size_t struct_size) {
+    align(8, count * struct_size);
+    bytes(data, count * struct_size);
+    return scalar<u_int32_t>(count);
+  }
+
+  void start_table() {
+    fields.clear();
+    table_start = size();
+  }
+
+  template <typename T> void add_field(u_int id, T value) {
+    fields.push_back({ id, scalar(value) });
+  }
+
+  void add_offset(u_int id, u_int32_t ref) {
+    fields.push_back({ id, offset(ref) });
+  }
+
+  u_int32_t end_table() {
+    u_int32_t table = scalar<int32_t>(0);
+    u_int n_fields = 0;
+    for (const field_t& field : fields) {
+      n_fields = std::max(n_fields, field.id + 1);
+    }
+    std::vector<u_int16_t> vtable(n_fields, 0);
+    for (const field_t& field : fields) {
+      vtable[field.id] = table - field.at;
+    }
+    for (size_t i = vtable.size(); i-- > 0;) {
+      scalar<u_int16_t>(vtable[i]);
+    }
+    scalar<u_int16_t>(table - table_start);
+    u_int32_t vtable_ref = scalar<u_int16_t>((vtable.size() + 2) * 2);
+    int32_t soffset = vtable_ref - table;
+    memcpy(&buffer[buffer.size() - table], &soffset, sizeof(soffset));
+    return table;
+  }
+
+  std::vector<u_char> finish(u_int32_t root) {
+    align(ARROW_ALIGN, 4);
+    offset(root);
+    return std::vector<u_char>(buffer.begin() + head, buffer.end());
+  }
+
+private:
+  struct field_t {
+    u_int id;
+    u_int32_t at;
+  };
+
+  std::vector<u_char> buffer;
+  size_t head;
+  u_int32_t table_start = 0;
+  std::vector<field_t> fields;
+
+  void reserve(size_t n) {
+    if (head >= n) {
+      return;
+    }
+    size_t used = size();
+    std::vector<u_char> grown(std::max(buffer.size() * 2, used + n));
+    memcpy(grown.data() + grown.size() - used, buffer.data() + head, used);
+    buffer.swap(grown);
+    head = buffer.size() - used;
+  }
+
+};
+
+/* Message body with the Buffer and FieldNode structs that describe it */
+struct export_body_t {
+  std::vector<u_char> bytes;
+  std::vector<int64_t> buffers;   // Offset and length pairs
+  std::vector<int64_t> nodes;     // Length and null count pairs
+
+  void add_buffer(const void* data, size_t size) {
+    buffers.push_back(bytes.size());
+    buffers.push_back(size);
+    bytes.insert(bytes.end(), (const u_char*)data, (const u_char*)data + size);
+    bytes.resize((bytes.size() + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN, 0);
+  }
+
+  void add_node(int64_t length, int64_t null_count) {
+    nodes.push_back(length);
+    nodes.push_back(null_count);
+  }
+};
+
+static u_int32_t add_int_type(FlatBuilder& fb, int32_t bit_width, bool is_signed) {
+  fb.start_table();
+  fb.add_field<int32_t>(0, bit_width);
+  fb.add_field<u_char>(1, is_signed);
+  return fb.end_table();
+}
+
+static u_int32_t add_schema(FlatBuilder& fb) {
+  std::vector<u_int32_t> fields;
+  for (int i = 0; i < (int)Export_Column::COUNT; ++i) {
+    const export_column_spec_t& spec = COLUMNS[i];
+    u_int32_t name = fb.string(spec.name);
+    u_int32_t type, dictionary = 0;
+    u_char type_type;
+
+    switch (spec.type) {
+      case Export_Type::UINT32:
+      case Export_Type::INT32:
+        type_type = ARROW_INT;
+        type = add_int_type(fb, 32, spec.type == Export_Type::INT32);
+        break;
+      case Export_Type::FLOAT64:
+        type_type = ARROW_FLOATING_POINT;
+        fb.start_table();
+        fb.add_field<int16_t>(0, 2);    // DOUBLE
+        type = fb.end_table();
+        break;
+      case Export_Type::TIMESTAMP:
+        type_type = ARROW_TIMESTAMP;
+        fb.start_table();
+        fb.add_field<int16_t>(0, 0);    // SECOND, no time zone: camera wall clock
+        type = fb.end_table();
+        break;
+      default:
+        type_type = ARROW_UTF8;
+        fb.start_table();
+        type = fb.end_table();
+        break;
+    }
+    if (spec.type == Export_Type::DICTIONARY) {
+      u_int32_t index_type = add_int_type(fb, 32, true);
+      fb.start_table();
+      fb.add_field<int64_t>(0, i - (int)Export_Column::MAKE);
+      fb.add_offset(1, index_type);
+      dictionary = fb.end_table();
+    }
+    u_int32_t children = fb.offsets({});
+
+    fb.start_table();
+    fb.add_offset(0, name);
+    fb.add_offset(3, type);
+    if (dictionary) {
+      fb.add_offset(4, dictionary);
+    }
+    fb.add_offset(5, children);
+    fb.add_field<u_char>(1, spec.nullable);
+    fb.add_field<u_char>(2, type_type);
+    fields.push_back(fb.end_table());
+  }
+  u_int32_t field_vector = fb.offsets(fields);
+
+  fb.start_table();
+  fb.add_offset(1, field_vector);
+  fb.add_field<int16_t>(0, 0);    // Little endian
+  return fb.end_table();
+}
+
+static u_int32_t add_record_batch(FlatBuilder& fb, int64_t length, const export_body_t& body) {
+  u_int32_t buffers = fb.structs(body.buffers.data(), body.buffers.size() / 2, 16);
+  u_int32_t nodes = fb.structs(body.nodes.data(), body.nodes.size() / 2, 16);
+  fb.start_table();
+  fb.add_field<int64_t>(0, length);
+  fb.add_offset(1, nodes);
+  fb.add_offset(2, buffers);
+  return fb.end_table();
+}
+
+static std::vector<u_char> get_message(FlatBuilder& fb, u_char header_type, u_int32_t header, int64_t body_length) {
+  fb.start_table();
+  fb.add_field<int64_t>(3, body_length);
+  fb.add_offset(2, header);
+  fb.add_field<int16_t>(0, ARROW_METADATA_V5);
+  fb.add_field<u_char>(1, header_type);
+  return fb.finish(fb.end_table());
+}
+
+static void add_utf8(export_body_t& body, const std::vector<int32_t>& offsets, const std::vector<char>& data) {
+  body.add_buffer(offsets.data(), offsets.size() * sizeof(int32_t));
+  body.add_buffer(data.data(), data.size());
+}
+
+/* Wall clock of the camera as seconds, DateTime has no time zone */
+static bool get_date_time(const char* date_time_str, int64_t* seconds) {
+  struct tm t;
+  memset(&t, 0, sizeof(t));
+  if (sscanf(date_time_str, "%d:%d:%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) {
+    return false;
+  }
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  *seconds = timegm(&t);
+  return true;
+}
+
+static void set_valid(export_column_t& column, u_int row, bool valid) {
+  if (row % 8 == 0) {
+    column.validity.push_back(0);
+  }
+  if (valid) {
+    column.validity.back() |= 1 << (row % 8);
+  } else {
+    column.null_count++;
+  }
+}
+
+template <typename T> static void add_value(export_batch_t& batch, Export_Column id, T value, bool valid = true) {
+  export_column_t& column = batch.columns[(int)id];
+  set_valid(column, batch.rows, valid);
+  if (!valid) {
+    value = 0;
+  }
+  const u_char* bytes = reinterpret_cast<const u_char*>(&value);
+  column.values.insert(column.values.end(), bytes, bytes + sizeof(T));
+}
+
+static void add_string(export_batch_t& batch, Export_Column id, const std::string& value) {
+  export_column_t& column = batch.columns[(int)id];
+  set_valid(column, batch.rows, true);
+  column.data.insert(column.data.end(), value.begin(), value.end());
+  column.offsets.push_back(column.data.size());
+}
+
+MetadataWriter :: MetadataWriter(const std::string& path, u_int batch_rows) : batch_rows(std::max(batch_rows, 1u)) {
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "ERROR: Unable to write metadata export: %s\n", path.c_str());
+    return;
+  }
+
+  FlatBuilder fb;
+  u_int32_t schema = add_schema(fb);
+  std::vector<u_char> message = get_message(fb, ARROW_SCHEMA, schema, 0);
+  block_t block;
+  if (!write_bytes(ARROW_MAGIC, sizeof(ARROW_MAGIC)) || !write_message(message, std::vector<u_char>(), &block)) {
+    ok = false;
+  }
+}
+
+MetadataWriter :: ~MetadataWriter() {
+  close();
+}
+
+int32_t MetadataWriter :: get_dictionary_index(u_int dictionary, const char* value) {
+  std::lock_guard<std::mutex> lock(dictionary_mutex);
+  dictionary_t& dict = dictionaries[dictionary];
+  auto inserted = dict.index.emplace(value, (int32_t)dict.values.size());
+  if (inserted.second) {
+    dict.values.push_back(value);
+  }
+  return inserted.first->second;
+}
+
+void MetadataWriter :: add(const std::string& path, const RawImageData::metadata_t& metadata) {
+  const auto& frame = metadata.main_ifd.frame;
+  const auto& exif = metadata.main_ifd.exif;
+  const auto& lens = exif.lens_info;
+  const TagStore& tags = metadata.tags;
+  const char* strings[3] = {
+    tags.get_string(Tag_Space::IFD, 271),     // Make
+    tags.get_string(Tag_Space::IFD, 272),     // Model
+    tags.get_string(Tag_Space::EXIF, 0xa434)  // LensModel
+  };
+  std::unique_ptr<export_batch_t> batch;
+  int64_t date_time = 0;
+
+  if (!is_open()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    if (!idle.empty()) {
+      batch = std::move(idle.back());
+      idle.pop_back();
+    }
+  }
+  if (batch == nullptr) {
+    batch.reset(new export_batch_t());
+    batch->clear();
+  }
+
+  export_batch_t& b = *batch;
+  add_string(b, Export_Column::PATH, path);
+  for (u_int i = 0; i < 3; ++i) {
+    bool set = strings[i][0] != 0;
+    add_value<int32_t>(b, (Export_Column)((int)Export_Column::MAKE + i), set ? get_dictionary_index(i, strings[i]) : 0, set);
+  }
+  add_value<u_int32_t>(b, Export_Column::WIDTH, frame.width);
+  add_value<u_int32_t>(b, Export_Column::HEIGHT, frame.height);
+  add_value<u_int32_t>(b, Export_Column::BPS, frame.bps);
+  add_value<u_int32_t>(b, Export_Column::COMPRESSION, frame.compression);
+  add_value<u_int32_t>(b, Export_Column::SAMPLE_PIXEL, frame.sample_pixel);
+  add_value<int32_t>(b, Export_Column::ORIENTATION, frame.orientation);
+  bool date_time_set = get_date_time(exif.date_time_str, &date_time);
+  add_value<int64_t>(b, Export_Column::DATE_TIME, date_time, date_time_set);
+
+  // Zero is unset, as when the IFDs are merged
+  add_value<double>(b, Export_Column::EXPOSURE, exif.exposure, exif.exposure != 0);
+  add_value<double>(b, Export_Column::F_NUMBER, exif.f_number, exif.f_number != 0);
+  add_value<double>(b, Export_Column::FOCAL_LENGTH, exif.focal_length, exif.focal_length != 0);
+  add_value<double>(b, Export_Column::ISO, exif.iso_sensitivity, exif.iso_sensitivity != 0);
+  add_value<u_int32_t>(b, Export_Column::IMAGE_COUNT, exif.image_count, exif.image_count != 0);
+  add_value<u_int32_t>(b, Export_Column::SHUTTER_COUNT, exif.shutter_count, exif.shutter_count != 0);
+  add_value<u_int32_t>(b, Export_Column::LENS_TYPE, lens.lens_type, lens.set);
+  add_value<double>(b, Export_Column::MIN_FOCAL_LENGTH, lens.min_focal_length, lens.set);
+  add_value<double>(b, Export_Column::MAX_FOCAL_LENGTH, lens.max_focal_length, lens.set);
+  add_value<double>(b, Export_Column::MIN_F_NUMBER, lens.min_f_number, lens.set);
+  add_value<double>(b, Export_Column::MAX_F_NUMBER, lens.max_f_number, lens.set);
+
+  // South and west as negative degrees
+  add_value<double>(b, Export_Column::GPS_LATITUDE, exif.gps_latitude_reference == 'S' ? -exif.gps_latitude : exif.gps_latitude,
+                    exif.gps_latitude_reference != 0);
+  add_value<double>(b, Export_Column::GPS_LONGITUDE, exif.gps_longitude_reference == 'W' ? -exif.gps_longitude : exif.gps_longitude,
+                    exif.gps_longitude_reference != 0);
+  add_value<double>(b, Export_Column::GPS_ALTITUDE, exif.gps_altitude, tags.find(Tag_Space::GPS, 6) != nullptr);
+  b.rows++;
+  rows++;
+
+  if (b.rows >= batch_rows) {
+    write_batch(b);
+  }
+  std::lock_guard<std::mutex> lock(batch_mutex);
+  idle.push_back(std::move(batch));
+}
+
+/* Encodes on the calling thread, only the append holds the file */
+void MetadataWriter :: write_batch(export_batch_t& batch) {
+  export_body_t body;
+  for (int i = 0; i < (int)Export_Column::COUNT; ++i) {
+    const export_column_t& column = batch.columns[i];
+    body.add_node(batch.rows, column.null_count);
+    body.add_buffer(column.validity.data(), column.null_count ? column.validity.size() : 0);
+    if (COLUMNS[i].type == Export_Type::UTF8) {
+      add_utf8(body, column.offsets, column.data);
+    } else {
+      body.add_buffer(column.values.data(), column.values.size());
+    }
+  }
+
+  FlatBuilder fb;
+  u_int32_t record_batch = add_record_batch(fb, batch.rows, body);
+  std::vector<u_char> message = get_message(fb, ARROW_RECORD_BATCH, record_batch, body.bytes.size());
+  block_t block;
+  if (write_message(message, body.bytes, &block)) {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    batches.push_back(block);
+  } else {
+    ok = false;
+  }
+  batch.clear();
+}
+
+bool MetadataWriter :: write_bytes(const void* data, size_t size) {
+  if (size != 0 && fwrite(data, 1, size, file) != size) {
+    fprintf(stderr, "ERROR: Metadata export write failed\n");
+    return false;
+  }
+  position += size;
+  return true;
+}
+
+bool MetadataWriter :: write_message(const std::vector<u_char>& metadata, const std::vector<u_char>& body, block_t* block) {
+  static const u_char padding[ARROW_ALIGN] = { 0 };
+  u_int32_t prefix[2] = { ARROW_CONTINUATION, 0 };
+  size_t pad = (ARROW_ALIGN - (sizeof(prefix) + metadata.size()) % ARROW_ALIGN) % ARROW_ALIGN;
+  prefix[1] = metadata.size() + pad;
+
+  std::lock_guard<std::mutex> lock(file_mutex);
+  block->offset = position;
+  block->metadata_length = sizeof(prefix) + prefix[1];
+  block->body_length = body.size();
+  return write_bytes(prefix, sizeof(prefix)) && write_bytes(metadata.data(), metadata.size()) &&
+         write_bytes(padding, pad) && write_bytes(body.data(), body.size());
+}
+
+/*
+ * Dictionaries go after the record batches: readers of the file format
+ * load them from the footer before any batch.
+ */
+bool MetadataWriter :: close() {
+  if (file == nullptr) {
+    return false;
+  }
+  for (std::unique_ptr<export_batch_t>& batch : idle) {
+    if (batch->rows != 0) {
+      write_batch(*batch);
+    }
+  }
+  idle.clear();
+
+  for (u_int i = 0; i < 3; ++i) {
+    const dictionary_t& dict = dictionaries[i];
+    std::vector<int32_t> offsets(1, 0);
+    std::vector<char> data;
+    for (const std::string& value : dict.values) {
+      data.insert(data.end(), value.begin(), value.end());
+      offsets.push_back(data.size());
+    }
+    export_body_t body;
+    body.add_node(dict.values.size(), 0);
+    body.add_buffer(nullptr, 0);
+    add_utf8(body, offsets, data);
+
+    FlatBuilder fb;
+    u_int32_t record_batch = add_record_batch(fb, dict.values.size(), body);
+    fb.start_table();
+    fb.add_field<int64_t>(0, i);
+    fb.add_offset(1, record_batch);
+    u_int32_t dictionary_batch = fb.end_table();
+    std::vector<u_char> message = get_message(fb, ARROW_DICTIONARY_BATCH, dictionary_batch, body.bytes.size());
+    block_t block;
+    if (!write_message(message, body.bytes, &block)) {
+      ok = false;
+    }
+    dictionary_blocks.push_back(block);
+  }
+
+  // End of stream, then the footer with its length and the magic
+  FlatBuilder fb;
+  std::vector<int64_t> blocks[2];
+  for (int k = 0; k < 2; ++k) {
+    for (const block_t& block : k == 0 ? dictionary_blocks : batches) {
+      blocks[k].push_back(block.offset);
+      blocks[k].push_back((u_int32_t)block.metadata_length);
+      blocks[k].push_back(block.body_length);
+    }
+  }
+  u_int32_t record_batches = fb.structs(blocks[1].data(), blocks[1].size() / 3, 24);
+  u_int32_t dictionary_list = fb.structs(blocks[0].data(), blocks[0].size() / 3, 24);
+  u_int32_t schema = add_schema(fb);
+  fb.start_table();
+  fb.add_offset(1, schema);
+  fb.add_offset(2, dictionary_list);
+  fb.add_offset(3, record_batches);
+  fb.add_field<int16_t>(0, ARROW_METADATA_V5);
+  std::vector<u_char> footer = fb.finish(fb.end_table());
+
+  u_int32_t end_of_stream[2] = { ARROW_CONTINUATION, 0 };
+  int32_t footer_length = footer.size();
+  bool written = write_bytes(end_of_stream, sizeof(end_of_stream)) && write_bytes(footer.data(), footer.size()) &&
+                 write_bytes(&footer_length, sizeof(footer_length)) && write_bytes(ARROW_MAGIC, 6);
+  written = fclose(file) == 0 && written;
+  file = nullptr;
+  return written && ok;
+}
+
+bool export_metadata(const std::vector<std::string>& paths, const std::string& output_path, const export_options_t& options) {
+  MetadataWriter writer(output_path, options.batch_rows);
+  if (!writer.is_open()) {
+    return false;
+  }
+  open_many(paths, options.pool, [&](size_t index, RawImageData* img) {
+    if (img != nullptr) {
+      writer.add(paths[index], img->get_metadata());
+    }
+  }, options.batch);
+  return writer.close();
+}
@@ -0,0 +1,97 @@
+#ifndef METADATA_EXPORT_H
+#define METADATA_EXPORT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimagedata.h"
+#include "batch_decode.h"
+
+#define EXPORT_BATCH_ROWS 65536
+
+enum class Export_Column {
+  PATH,
+  MAKE, MODEL, LENS_MODEL,    // Dictionary encoded
+  WIDTH, HEIGHT, BPS, COMPRESSION, SAMPLE_PIXEL, ORIENTATION,
+  DATE_TIME,
+  EXPOSURE, F_NUMBER, FOCAL_LENGTH, ISO,
+  IMAGE_COUNT, SHUTTER_COUNT,
+  LENS_TYPE, MIN_FOCAL_LENGTH, MAX_FOCAL_LENGTH, MIN_F_NUMBER, MAX_F_NUMBER,
+  GPS_LATITUDE, GPS_LONGITUDE, GPS_ALTITUDE,   // Signed degrees, metres
+  COUNT
+};
+
+struct export_batch_t;
+
+struct export_options_t {
+  u_int batch_rows = EXPORT_BATCH_ROWS;  // Rows per record batch, the last of each worker can be short
+  ThreadPool* pool = &ThreadPool::shared();   // nullptr: scan on the calling thread
+  batch_options_t batch;                 // Files in flight and header read ahead
+};
+
+/*
+ * Metadata table as an Arrow IPC file (Feather v2), one row per file. Any
+ * thread can add rows: each fills its own batch, and a full batch is
+ * encoded on that thread and appended under a short lock, so the row order
+ * in the file is the order batches fill, not the order files were added.
+ * Make, model and lens strings share one dictionary per column, written
+ * with the footer once every batch is in.
+ */
+class MetadataWriter {
+
+public:
+  MetadataWriter(const std::string& path, u_int batch_rows = EXPORT_BATCH_ROWS);
+  ~MetadataWriter();
+
+  bool is_open() const { return file != nullptr; }
+  void add(const std::string& path, const RawImageData::metadata_t& metadata);
+  bool close();     // Flushes the open batches, dictionaries and footer
+
+  u_int64_t get_rows() const { return rows; }
+  u_int get_batches() const { return (u_int)batches.size(); }
+
+private:
+  struct block_t {
+    int64_t offset;
+    int32_t metadata_length;
+    int64_t body_length;
+  };
+
+  struct dictionary_t {
+    std::unordered_map<std::string, int32_t> index;
+    std::vector<std::string> values;
+  };
+
+  FILE* file = nullptr;
+  u_int batch_rows;
+  std::atomic<bool> ok { true };
+  std::atomic<u_int64_t> rows { 0 };
+
+  std::mutex batch_mutex;     // Batches no thread is filling
+  std::vector<std::unique_ptr<export_batch_t>> idle;
+  std::mutex dictionary_mutex;
+  dictionary_t dictionaries[3];
+  std::mutex file_mutex;      // Appends and the block lists
+  int64_t position = 0;
+  std::vector<block_t> batches;
+  std::vector<block_t> dictionary_blocks;
+
+  int32_t get_dictionary_index(u_int dictionary, const char* value);
+  void write_batch(export_batch_t& batch);
+  bool write_message(const std::vector<u_char>& metadata, const std::vector<u_char>& body, block_t* block);
+  bool write_bytes(const void* data, size_t size);
+
+};
+
+/* Scans every file with open_many() and writes its metadata row. Files that fail to open are skipped */
+bool export_metadata(const std::vector<std::string>& paths, const std::string& output_path,
+                     const export_options_t& options = export_options_t());
+
+#endif
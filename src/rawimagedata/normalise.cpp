@@ -0,0 +1,77 @@
+#include "normalise.h"
+#include "cpu_dispatch.h"
+
+#include <cmath>
+
+bool get_normalise_params(const RawImage& image, const double wb_multi[3], normalise_params_t* params) {
+  double wb[3], wb_min;
+  u_int colour;
+
+  if (!image.is_cfa() || image.white == 0) {
+    return false;
+  }
+
+  for (u_int c = 0; c < 3; ++c) {
+    wb[c] = wb_multi[c] > 0 ? wb_multi[c] : 1;
+  }
+  // Smallest multiplier maps to 1 so every channel clips together at white
+  wb_min = std::min(wb[0], std::min(wb[1], wb[2]));
+
+  for (u_int site = 0; site < 4; ++site) {
+    colour = cfa_colour(image.cfa, site >> 1, site & 1);
+    if (image.black[site] >= image.white) {
+      fprintf(stderr, "ERROR: Black level %d above white level %d\n", image.black[site], image.white);
+      return false;
+    }
+    params->black[site] = image.black[site];
+    params->scale[site] = wb[colour] / wb_min * params->out_max / (image.white - image.black[site]);
+  }
+  return true;
+}
+
+void normalise_row(const u_int16_t* src, u_int16_t* dest, u_int count, const u_int black[2], const float scale[2], u_int out_max) {
+  get_kernels().normalise_row(src, dest, count, black, scale, out_max);
+}
+
+bool normalise_raw_image(RawImage& image, const normalise_params_t& params) {
+  if (!image.is_cfa() || image.sample_bytes != 2) {
+    return false;
+  }
+
+  for (u_int y = 0; y < image.height; ++y) {
+    const u_int* black = &params.black[(y & 1) << 1];
+    const float* scale = &params.scale[(y & 1) << 1];
+    normalise_row(image.row(y), image.row(y), image.width, black, scale, params.out_max);
+  }
+
+  memset(image.black, 0, sizeof(image.black));
+  image.white = params.out_max;
+  return true;
+}
+
+void collapse_quad_rows(const u_int16_t* row0, const u_int16_t* row1, u_int16_t* dest, u_int width, u_int cfa, const normalise_params_t& params) {
+  // Normalise both rows in L1 sized chunks, then fold each quad into RGB (greens averaged)
+  static const u_int CHUNK = 512;
+  u_int16_t norm[2][CHUNK];
+  u_int colour[4], sum[3];
+
+  for (u_int site = 0; site < 4; ++site) {
+    colour[site] = cfa_colour(cfa, site >> 1, site & 1);
+  }
+  for (u_int x0 = 0; x0 + 1 < width; x0 += CHUNK) {
+    u_int count = std::min(CHUNK, (width - x0) & ~1u);
+    normalise_row(row0 + x0, norm[0], count, &params.black[0], &params.scale[0], params.out_max);
+    normalise_row(row1 + x0, norm[1], count, &params.black[2], &params.scale[2], params.out_max);
+    u_int16_t* d = dest + x0 / 2 * 3;
+    for (u_int x = 0; x < count; x += 2, d += 3) {
+      sum[0] = sum[1] = sum[2] = 0;
+      sum[colour[0]] += norm[0][x];
+      sum[colour[1]] += norm[0][x + 1];
+      sum[colour[2]] += norm[1][x];
+      sum[colour[3]] += norm[1][x + 1];
+      d[0] = sum[0];
+      d[1] = (sum[1] + 1) >> 1;
+      d[2] = sum[2];
+    }
+  }
+}
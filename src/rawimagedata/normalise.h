@@ -0,0 +1,25 @@
+#ifndef NORMALISE_H
+#define NORMALISE_H
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimage.h"
+
+/*
+ * Raw domain normalisation: black subtraction, white balance and scaling
+ * of the white point to 16 bit full scale, with clipping, per 2x2 CFA site.
+ */
+struct normalise_params_t {
+  u_int black[4] = { 0 };     // Per site black level
+  float scale[4] = { 1, 1, 1, 1 };  // Per site multiplier (white balance * white point)
+  u_int out_max = 0xffff;
+};
+
+bool get_normalise_params(const RawImage& image, const double wb_multi[3], normalise_params_t* params);
+void normalise_row(const u_int16_t* src, u_int16_t* dest, u_int count, const u_int black[2], const float scale[2], u_int out_max);
+bool normalise_raw_image(RawImage& image, const normalise_params_t& params);
+void collapse_quad_rows(const u_int16_t* row0, const u_int16_t* row1, u_int16_t* dest, u_int width, u_int cfa, const normalise_params_t& params);
+
+#endif
@@ -0,0 +1,93 @@
+#include "orientation.h"
+
+bool orientation_swaps_axes(int orientation) {
+  return orientation >= 5 && orientation <= 8;
+}
+
+void get_oriented_size(int orientation, u_int width, u_int height, u_int* out_width, u_int* out_height) {
+  if (orientation_swaps_axes(orientation)) {
+    *out_width = height;
+    *out_height = width;
+  } else {
+    *out_width = width;
+    *out_height = height;
+  }
+}
+
+template <size_t PIXEL_BYTES>
+static void orient_block(const u_char* src, size_t src_stride, u_char* dest, ptrdiff_t step_x, ptrdiff_t step_y, u_int w, u_int h) {
+  for (u_int y = 0; y < h; ++y) {
+    const u_char* s = src + y * src_stride;
+    u_char* d = dest + y * step_y;
+    for (u_int x = 0; x < w; ++x, s += PIXEL_BYTES, d += step_x) {
+      memcpy(d, s, PIXEL_BYTES);
+    }
+  }
+}
+
+void orient_copy(const RawImage& src, RawImage& dest, u_int src_x, u_int src_y, u_int full_width, u_int full_height, int orientation) {
+  ptrdiff_t pixel = (ptrdiff_t)src.channels * src.sample_bytes;
+  ptrdiff_t stride = dest.stride;
+  ptrdiff_t step_x, step_y;
+  u_int dest_x, dest_y;   // Destination of source pixel (0, 0) in frame coordinates
+
+  // Destination address of frame pixel (x, y) is origin + x * step_x + y * step_y
+  switch (orientation) {
+    case 2:  step_x = -pixel;  step_y = stride;   dest_x = full_width - 1;  dest_y = 0; break;
+    case 3:  step_x = -pixel;  step_y = -stride;  dest_x = full_width - 1;  dest_y = full_height - 1; break;
+    case 4:  step_x = pixel;   step_y = -stride;  dest_x = 0;               dest_y = full_height - 1; break;
+    case 5:  step_x = stride;  step_y = pixel;    dest_x = 0;               dest_y = 0; break;
+    case 6:  step_x = stride;  step_y = -pixel;   dest_x = full_height - 1; dest_y = 0; break;
+    case 7:  step_x = -stride; step_y = -pixel;   dest_x = full_height - 1; dest_y = full_width - 1; break;
+    case 8:  step_x = -stride; step_y = pixel;    dest_x = 0;               dest_y = full_width - 1; break;
+    default: step_x = pixel;   step_y = stride;   dest_x = 0;               dest_y = 0; break;
+  }
+  u_char* origin = dest.row<u_char>(dest_y) + dest_x * pixel;
+
+  for (u_int by = 0; by < src.height; by += ORIENT_BLOCK) {
+    u_int bh = std::min((u_int)ORIENT_BLOCK, src.height - by);
+    for (u_int bx = 0; bx < src.width; bx += ORIENT_BLOCK) {
+      u_int bw = std::min((u_int)ORIENT_BLOCK, src.width - bx);
+      const u_char* s = src.row<u_char>(by) + bx * pixel;
+      u_char* d = origin + (ptrdiff_t)(src_x + bx) * step_x + (ptrdiff_t)(src_y + by) * step_y;
+      switch (pixel) {
+        case 3:  orient_block<3>(s, src.stride, d, step_x, step_y, bw, bh); break;
+        case 6:  orient_block<6>(s, src.stride, d, step_x, step_y, bw, bh); break;
+        case 12: orient_block<12>(s, src.stride, d, step_x, step_y, bw, bh); break;
+        default:
+          for (u_int y = 0; y < bh; ++y) {
+            for (u_int x = 0; x < bw; ++x) {
+              memcpy(d + x * step_x + y * step_y, s + y * src.stride + x * pixel, pixel);
+            }
+          }
+          break;
+      }
+    }
+  }
+}
+
+bool orient_image(const RawImage& src, RawImage& dest, int orientation, ThreadPool* pool) {
+  u_int width, height;
+  get_oriented_size(orientation, src.width, src.height, &width, &height);
+  if (dest.empty() || dest.width != width || dest.height != height || dest.channels != src.channels || dest.sample_bytes != src.sample_bytes) {
+    dest = RawImage(width, height, src.channels, src.sample_bytes);
+    if (dest.empty()) {
+      return false;
+    }
+  }
+  dest.copy_info(src);
+
+  u_int n_bands = (src.height + ORIENT_BLOCK - 1) / ORIENT_BLOCK;
+  auto run_band = [&](u_int band) {
+    u_int y = band * ORIENT_BLOCK;
+    orient_copy(src.view(0, y, src.width, ORIENT_BLOCK), dest, 0, y, src.width, src.height, orientation);
+  };
+  if (pool != nullptr) {
+    pool->parallel_for(0, n_bands, run_band);
+  } else {
+    for (u_int band = 0; band < n_bands; ++band) {
+      run_band(band);
+    }
+  }
+  return true;
+}
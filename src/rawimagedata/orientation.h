@@ -0,0 +1,31 @@
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+
+#define ORIENT_BLOCK 32
+
+/*
+ * EXIF orientation (tag 274)
+ * 1: Normal               5: Transpose
+ * 2: Mirror horizontal    6: Rotate 90 CW
+ * 3: Rotate 180           7: Transverse
+ * 4: Mirror vertical      8: Rotate 270 CW
+ */
+bool orientation_swaps_axes(int orientation);
+void get_oriented_size(int orientation, u_int width, u_int height, u_int* out_width, u_int* out_height);
+
+/*
+ * Copies src, the region at (src_x, src_y) of a full_width x full_height
+ * frame, to its oriented place in dest, in ORIENT_BLOCK sized blocks so
+ * both the source rows and the destination columns stay cache resident.
+ */
+void orient_copy(const RawImage& src, RawImage& dest, u_int src_x, u_int src_y, u_int full_width, u_int full_height, int orientation);
+bool orient_image(const RawImage& src, RawImage& dest, int orientation, ThreadPool* pool = nullptr);
+
+#endif
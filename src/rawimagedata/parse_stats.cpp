@@ -0,0 +1,168 @@
+#include "parse_stats.h"
+
+#include <atomic>
+#include <time.h>
+#include <unistd.h>
+
+static const char* STAGE_NAMES[(int)Parse_Stage::COUNT] = {
+  "identify", "ifd_walk", "exif", "makernote", "jpeg_sniff",
+  "unpack", "normalise", "demosaic", "colour", "stats", "bands"
+};
+
+// Small per thread ids for the trace, in order of first use
+static std::atomic<u_int> next_trace_tid(1);
+static thread_local u_int trace_tid = 0;
+
+const char* get_stage_name(Parse_Stage stage) {
+  return stage < Parse_Stage::COUNT ? STAGE_NAMES[(int)stage] : "unknown";
+}
+
+static double get_cpu_ms() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+TraceRecorder :: TraceRecorder() : epoch(std::chrono::steady_clock::now()) {}
+
+void TraceRecorder :: add(const char* name, const std::string& file, std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end) {
+  if (trace_tid == 0) {
+    trace_tid = next_trace_tid++;
+  }
+  trace_event_t event;
+  event.name = name;
+  event.file = file;
+  event.start_us = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch).count();
+  event.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  event.tid = trace_tid;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  events.push_back(event);
+}
+
+std::string TraceRecorder :: to_json() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string json = "{\"traceEvents\":[\n";
+  char buffer[256];
+
+  for (size_t i = 0; i < events.size(); ++i) {
+    const trace_event_t& event = events[i];
+    snprintf(buffer, sizeof(buffer), "{\"name\":\"%s\",\"cat\":\"rawimagedata\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"file\":\"",
+             event.name, (long long)event.start_us, (long long)event.duration_us, (int)getpid(), event.tid);
+    json += buffer;
+    for (char c : event.file) {
+      if (c == '"' || c == '\\') {
+        json += '\\';
+      } else if ((u_char)c < 0x20) {
+        continue;
+      }
+      json += c;
+    }
+    json += i + 1 < events.size() ? "\"}},\n" : "\"}}\n";
+  }
+  json += "],\"displayTimeUnit\":\"ms\"}\n";
+  return json;
+}
+
+bool TraceRecorder :: write(const char* path) {
+  std::string json = to_json();
+  FILE* f = fopen(path, "w");
+  if (f == nullptr) {
+    fprintf(stderr, "ERROR: Unable to write trace: %s\n", path);
+    return false;
+  }
+  bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+  return fclose(f) == 0 && ok;
+}
+
+StageTimer :: StageTimer(parse_stats_t* stats, Parse_Stage stage, TraceRecorder* trace, const std::string* file)
+  : stats(stats), stage(stage), trace(trace), file(file), start(std::chrono::steady_clock::now()), cpu_start(get_cpu_ms()) {}
+
+StageTimer :: ~StageTimer() {
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  stage_time_t& time = stats->stages[(int)stage];
+  time.calls++;
+  time.wall_ms += std::chrono::duration<double, std::milli>(end - start).count();
+  time.cpu_ms += get_cpu_ms() - cpu_start;
+  if (trace != nullptr) {
+    trace->add(get_stage_name(stage), *file, start, end);
+  }
+}
+
+IoCounter :: IoCounter(std::streambuf* source, io_stats_t* stats) : source(source), stats(stats) {}
+
+std::streambuf* IoCounter :: set_source(std::streambuf* new_source) {
+  std::streambuf* old_source = source;
+  source = new_source;
+  // Each source keeps its own position, the next read comes from there
+  pos_type pos = source->pubseekoff(0, std::ios::cur, std::ios::in);
+  if (pos != pos_type(off_type(-1))) {
+    position = pos;
+  }
+  return old_source;
+}
+
+void IoCounter :: reset() {
+  *stats = io_stats_t();
+  pages.clear();
+}
+
+void IoCounter :: add_read(std::streamsize count) {
+  stats->read_calls++;
+  if (count <= 0) {
+    return;
+  }
+  stats->bytes_read += count;
+  for (u_int64_t page = position / PARSE_STATS_PAGE_SIZE; page <= (u_int64_t)(position + count - 1) / PARSE_STATS_PAGE_SIZE; ++page) {
+    if (page / 64 >= pages.size()) {
+      pages.resize(page / 64 + 1, 0);
+    }
+    u_int64_t bit = (u_int64_t)1 << (page % 64);
+    if (!(pages[page / 64] & bit)) {
+      pages[page / 64] |= bit;
+      stats->pages_touched++;
+    }
+  }
+  position += count;
+}
+
+void IoCounter :: move_to(pos_type pos) {
+  if (pos == pos_type(off_type(-1))) {
+    return;
+  }
+  if ((off_t)pos != position) {
+    stats->seeks++;
+    position = pos;
+  }
+}
+
+IoCounter::int_type IoCounter :: underflow() {
+  return source->sgetc();
+}
+
+IoCounter::int_type IoCounter :: uflow() {
+  int_type c = source->sbumpc();
+  add_read(traits_type::eq_int_type(c, traits_type::eof()) ? 0 : 1);
+  return c;
+}
+
+std::streamsize IoCounter :: xsgetn(char* s, std::streamsize count) {
+  std::streamsize n = source->sgetn(s, count);
+  add_read(n);
+  return n;
+}
+
+IoCounter::pos_type IoCounter :: seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) {
+  pos_type pos = source->pubseekoff(offset, dir, mode);
+  move_to(pos);
+  return pos;
+}
+
+IoCounter::pos_type IoCounter :: seekpos(pos_type pos, std::ios::openmode mode) {
+  pos_type result = source->pubseekpos(pos, mode);
+  move_to(result);
+  return result;
+}
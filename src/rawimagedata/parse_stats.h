@@ -0,0 +1,153 @@
+#ifndef PARSE_STATS_H
+#define PARSE_STATS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define PARSE_STATS_PAGE_SIZE 4096
+
+enum class Parse_Stage {
+  IDENTIFY,     // Header and byte order
+  IFD_WALK,     // TIFF IFD chain and SubIFDs, EXIF and makernote included
+  EXIF,
+  MAKERNOTE,
+  JPEG_SNIFF,   // JPEG headers of embedded previews and lossless data
+  UNPACK,       // Raw data to the CFA buffer, half size collapse included
+  NORMALISE,
+  DEMOSAIC,
+  COLOUR,
+  STATS,
+  BANDS,        // decode_bands(), the stages interleaved over bands
+  COUNT
+};
+
+const char* get_stage_name(Parse_Stage stage);
+
+struct stage_time_t {
+  u_int calls = 0;
+  double wall_ms = 0;
+  double cpu_ms = 0;          // Process CPU time, pool threads (and other decodes) included
+};
+
+/* Reads and seeks the parser issued on its stream, not system calls */
+struct io_stats_t {
+  u_int64_t read_calls = 0;
+  u_int64_t bytes_read = 0;
+  u_int64_t seeks = 0;        // Jumps to a different position
+  u_int64_t pages_touched = 0;  // Distinct PARSE_STATS_PAGE_SIZE pages read from
+};
+
+/*
+ * Timing and I/O of one parse, from open_raw() up to the next one. Stage
+ * times are inclusive: EXIF and makernote also count towards the IFD walk.
+ */
+struct parse_stats_t {
+  bool set = false;           // false: built without RAWIMAGEDATA_INSTRUMENT
+  stage_time_t stages[(int)Parse_Stage::COUNT];
+  io_stats_t io;
+
+  // Image buffers charged to the parser, kept with or without instrumentation
+  size_t memory_current = 0;  // Still held, by the parser or images it handed out
+  size_t memory_peak = 0;     // Most held at once
+  u_int64_t memory_refused = 0;  // Allocations refused at the limit
+
+  const stage_time_t& get(Parse_Stage stage) const { return stages[(int)stage]; }
+};
+
+/*
+ * Chrome trace-event timeline (chrome://tracing, Perfetto). One recorder
+ * can be shared by many parsers on many threads.
+ */
+class TraceRecorder {
+
+public:
+  TraceRecorder();
+
+  void add(const char* name, const std::string& file, std::chrono::steady_clock::time_point start,
+           std::chrono::steady_clock::time_point end);
+  std::string to_json();
+  bool write(const char* path);
+
+private:
+  struct trace_event_t {
+    const char* name;
+    std::string file;
+    int64_t start_us, duration_us;
+    u_int tid;
+  };
+
+  std::mutex mutex;
+  std::vector<trace_event_t> events;
+  std::chrono::steady_clock::time_point epoch;
+
+};
+
+/* Adds the wall and CPU time of its scope to a stage */
+class StageTimer {
+
+public:
+  StageTimer(parse_stats_t* stats, Parse_Stage stage, TraceRecorder* trace, const std::string* file);
+  ~StageTimer();
+
+private:
+  parse_stats_t* stats;
+  Parse_Stage stage;
+  TraceRecorder* trace;
+  const std::string* file;
+  std::chrono::steady_clock::time_point start;
+  double cpu_start;
+
+};
+
+/*
+ * Unbuffered pass-through stream buffer that counts the parser's reads,
+ * seeks and touched pages. The source can be swapped mid-parse (read
+ * planner, file buffer) without losing the counts.
+ */
+class IoCounter : public std::streambuf {
+
+public:
+  IoCounter(std::streambuf* source, io_stats_t* stats);
+
+  std::streambuf* set_source(std::streambuf* source);
+  void reset();
+
+protected:
+  int_type underflow() override;
+  int_type uflow() override;
+  std::streamsize xsgetn(char* s, std::streamsize count) override;
+  pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) override;
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override;
+
+private:
+  std::streambuf* source;
+  io_stats_t* stats;
+  off_t position = 0;
+  std::vector<u_int64_t> pages;   // Bitmap of touched pages
+
+  void add_read(std::streamsize count);
+  void move_to(pos_type pos);
+
+};
+
+/*
+ * PARSE_STAGE(stage) times the rest of the enclosing scope, TIMED_STAGE(stage, expr)
+ * one expression. Both expect parse_stats, trace and file_path in scope (RawImageData)
+ * and compile to nothing without RAWIMAGEDATA_INSTRUMENT.
+ */
+#ifdef RAWIMAGEDATA_INSTRUMENT
+#define PARSE_STAGE(stage) StageTimer stage_timer(&parse_stats, stage, trace, &file_path)
+#define TIMED_STAGE(stage, ...) (StageTimer(&parse_stats, stage, trace, &file_path), (__VA_ARGS__))
+#else
+#define PARSE_STAGE(stage)
+#define TIMED_STAGE(stage, ...) (__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+#include "pipeline.h"
+
+size_t get_pipeline_bytes(u_int width, u_int band_rows, u_int bands, u_int halo, u_int output_bytes, bool half_size) {
+  size_t window = (size_t)(bands * band_rows + 2 * halo) * width * 2;
+  size_t out_width = half_size ? width / 2 : width;
+  size_t out_rows = half_size ? band_rows / 2 : band_rows;
+  size_t rgb = (size_t)bands * (half_size ? out_rows * out_width : (size_t)(band_rows + 2 * halo) * width) * 6;
+  size_t output = (size_t)bands * out_rows * out_width * 3 * output_bytes;
+  return window + rgb + output;
+}
+
+bool run_band_pipeline(const RawImage& frame, const row_source_t& source, const pipeline_stages_t& stages,
+                       const pipeline_options_t& options, const band_sink_t& sink) {
+  const normalise_params_t& params = stages.normalise;
+  bool half_size = stages.half_size;
+  u_int width = frame.width;
+  u_int height = half_size ? frame.height & ~1u : frame.height;
+  u_int out_width = half_size ? width / 2 : width;
+  u_int output_bytes = get_output_sample_bytes(stages.colour.format);
+
+  if (!frame.is_cfa() || width < 2 || height < 2) {
+    fprintf(stderr, "ERROR: Band pipeline needs a CFA raw\n");
+    return false;
+  }
+
+  // Even halo and band heights keep every window and band on the same CFA phase
+  u_int halo = half_size ? 0 : (get_demosaic_halo(stages.demosaic.method) + 1) & ~1u;
+  u_int band_rows = std::max(2u, options.band_rows) & ~1u;
+  u_int bands = options.bands_in_flight;
+  if (bands == 0) {
+    bands = options.pool != nullptr ? options.pool->size() + 1 : 1;
+  }
+  bands = std::max(1u, std::min(bands, (height + band_rows - 1) / band_rows));
+  if (options.memory_limit) {
+    while (get_pipeline_bytes(width, band_rows, bands, halo, output_bytes, half_size) > options.memory_limit) {
+      if (bands > 1) {
+        --bands;
+      } else if (band_rows > 2) {
+        band_rows = std::max(2u, band_rows / 2) & ~1u;
+      } else {
+        fprintf(stderr, "ERROR: Memory limit of %zu bytes too small for a %d pixel wide band\n", options.memory_limit, width);
+        return false;
+      }
+    }
+  }
+  u_int out_rows = half_size ? band_rows / 2 : band_rows;
+
+  RawImage window(width, bands * band_rows + 2 * halo, 1);
+  if (window.empty()) {
+    return false;
+  }
+  window.copy_info(frame);
+  if (!half_size) {
+    memset(window.black, 0, sizeof(window.black));
+    window.white = params.out_max;
+  }
+
+  std::vector<RawImage> rgb_slots(bands), out_slots(bands);
+  for (u_int k = 0; k < bands; ++k) {
+    rgb_slots[k] = RawImage(out_width, half_size ? out_rows : band_rows + 2 * halo, 3);
+    out_slots[k] = RawImage(out_width, out_rows, 3, output_bytes);
+    if (rgb_slots[k].empty() || out_slots[k].empty()) {
+      return false;
+    }
+  }
+
+  stats_accumulator_t raw_stats, output_stats;
+  if (stages.raw_stats != nullptr && !raw_stats.init(frame, stats_options_t().bins)) {
+    return false;
+  }
+  if (stages.output_stats != nullptr) {
+    RawImage output_info = out_slots[0];
+    output_info.white = stages.colour.format == Output_Format::RGB8 ? 0xff : 0xffff;
+    if (!output_stats.init(output_info, stats_options_t().bins)) {
+      return false;
+    }
+  }
+
+  demosaic_options_t demosaic_options = stages.demosaic;
+  colour_options_t colour_options = stages.colour;
+  demosaic_options.pool = nullptr;      // Parallel over bands instead
+  colour_options.pool = nullptr;
+  colour_options.orientation = 1;
+
+  std::vector<char> band_ok(bands);
+  u_int w0 = 0, w1 = 0;                 // Frame rows held by the window
+
+  for (u_int a = 0; a < height; ) {
+    u_int b = std::min(a + bands * band_rows, height);
+    u_int need0 = a > halo ? a - halo : 0;
+    u_int need1 = std::min(b + halo, frame.height);
+
+    // Rows still needed move to the top of the window, the rest are read fresh
+    u_int kept = 0;
+    if (need0 >= w0 && need0 < w1) {
+      kept = w1 - need0;
+      memmove(window.row(0), window.row(need0 - w0), kept * window.stride);
+    }
+    w0 = need0;
+    RawImage fresh = window.view(0, kept, width, need1 - need0 - kept);
+    if (!source(fresh, need0 + kept)) {
+      return false;
+    }
+    if (stages.raw_stats != nullptr) {
+      raw_stats.add_rows(fresh, need0 + kept);
+    }
+    if (!half_size) {
+      for (u_int y = 0; y < fresh.height; ++y) {
+        u_int site = ((need0 + kept + y) & 1) << 1;
+        normalise_row(fresh.row(y), fresh.row(y), width, &params.black[site], &params.scale[site], params.out_max);
+      }
+    }
+    w1 = need1;
+
+    u_int n_bands = (b - a + band_rows - 1) / band_rows;
+    auto run_band = [&](u_int k) {
+      u_int ba = a + k * band_rows;
+      u_int bb = std::min(ba + band_rows, b);
+      RawImage rgb;
+
+      band_ok[k] = false;
+      if (half_size) {
+        rgb = rgb_slots[k].view(0, 0, out_width, (bb - ba) / 2);
+        rgb.white = params.out_max;
+        for (u_int y = ba; y < bb; y += 2) {
+          collapse_quad_rows(window.row(y - w0), window.row(y + 1 - w0), rgb.row((y - ba) / 2), width, window.cfa, params);
+        }
+      } else {
+        // Band plus halo, demosaiced on its own and cropped back to the band
+        u_int s = ba > halo ? ba - halo : 0;
+        u_int e = std::min(bb + halo, frame.height);
+        RawImage demosaiced = rgb_slots[k].view(0, 0, width, e - s);
+        if (!demosaic_raw_image(window.view(0, s - w0, width, e - s), demosaiced, demosaic_options)) {
+          return;
+        }
+        rgb = demosaiced.view(0, ba - s, width, bb - ba);
+      }
+      RawImage output = out_slots[k].view(0, 0, out_width, rgb.height);
+      band_ok[k] = convert_colour(rgb, output, demosaic_options.rgb_cam, colour_options);
+    };
+    if (options.pool != nullptr && n_bands > 1) {
+      options.pool->parallel_for(0, n_bands, run_band);
+    } else {
+      for (u_int k = 0; k < n_bands; ++k) {
+        run_band(k);
+      }
+    }
+
+    for (u_int k = 0; k < n_bands; ++k) {
+      u_int ba = a + k * band_rows;
+      u_int rows = std::min(band_rows, b - ba);
+      if (!band_ok[k]) {
+        return false;
+      }
+      RawImage output = out_slots[k].view(0, 0, out_width, half_size ? rows / 2 : rows);
+      if (stages.output_stats != nullptr) {
+        output_stats.add_rows(output, half_size ? ba / 2 : ba);
+      }
+      if (!sink(output, half_size ? ba / 2 : ba)) {
+        return false;
+      }
+    }
+    a = b;
+  }
+
+  if (stages.raw_stats != nullptr) {
+    *stages.raw_stats = image_stats_t();
+    raw_stats.finish(stages.raw_stats);
+  }
+  if (stages.output_stats != nullptr) {
+    *stages.output_stats = image_stats_t();
+    output_stats.finish(stages.output_stats);
+  }
+  return true;
+}
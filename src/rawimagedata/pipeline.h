@@ -0,0 +1,54 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+
+#include "rawimage.h"
+#include "thread_pool.h"
+#include "normalise.h"
+#include "demosaic.h"
+#include "colour.h"
+#include "image_stats.h"
+
+#define PIPELINE_BAND_ROWS 64
+
+/* Fills rows (full frame width) with raw rows starting at frame row y */
+typedef std::function<bool(RawImage& rows, u_int y)> row_source_t;
+/* Receives output bands in order, y is the first output row of the band */
+typedef std::function<bool(const RawImage& rows, u_int y)> band_sink_t;
+
+struct pipeline_options_t {
+  u_int band_rows = PIPELINE_BAND_ROWS;
+  u_int bands_in_flight = 0;  // 0: one per pool thread plus the caller
+  size_t memory_limit = 0;    // Bytes for all band buffers, 0: no limit
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+};
+
+struct pipeline_stages_t {
+  normalise_params_t normalise;
+  demosaic_options_t demosaic;
+  colour_options_t colour;    // Orientation is not applied, rows stream in sensor order
+  bool half_size = false;
+  image_stats_t* raw_stats = nullptr;
+  image_stats_t* output_stats = nullptr;
+};
+
+/* Bytes held by the band buffers, not counting per thread demosaic tiles */
+size_t get_pipeline_bytes(u_int width, u_int band_rows, u_int bands, u_int halo, u_int output_bytes, bool half_size);
+
+/*
+ * Runs unpack -> normalise -> demosaic -> colour -> sink over horizontal
+ * bands. Raw rows are read once into a window of bands_in_flight bands
+ * plus the demosaic halo above and below; the halo rows are carried into
+ * the next window instead of being read again. Bands of a window are
+ * demosaiced and converted in parallel and handed to the sink in order.
+ * Band count and height shrink until the buffers fit memory_limit.
+ */
+bool run_band_pipeline(const RawImage& frame, const row_source_t& source, const pipeline_stages_t& stages,
+                       const pipeline_options_t& options, const band_sink_t& sink);
+
+#endif
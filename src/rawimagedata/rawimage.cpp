@@ -0,0 +1,245 @@
+#include "rawimage.h"
+
+u_int cfa_shift(u_int cfa, u_int x, u_int y) {
+  u_int shifted = 0;
+  for (u_int row = 0; row < 8; ++row) {
+    for (u_int col = 0; col < 2; ++col) {
+      shifted |= cfa_colour(cfa, row + y, col + x) << ((((row << 1) & 14) | col) << 1);
+    }
+  }
+  return shifted;
+}
+
+/* ================ RawImagePool ================ */
+
+RawImagePool :: RawImagePool(size_t max_cached_bytes) : max_cached_bytes(max_cached_bytes) {}
+
+RawImagePool :: ~RawImagePool() {
+  trim();
+}
+
+RawImagePool& RawImagePool :: global() {
+  static RawImagePool pool;
+  return pool;
+}
+
+u_int RawImagePool :: size_class(size_t size, size_t* block_size) {
+  if (size <= MIN_BLOCK_SIZE) {
+    *block_size = MIN_BLOCK_SIZE;
+    return 0;
+  }
+  // Four classes per power of two: 2^p + n * 2^(p-2), n = 1..4
+  u_int p = 63 - __builtin_clzll(size - 1);
+  size_t step = (size_t)1 << (p - 2);
+  size_t n = (size - ((size_t)1 << p) + step - 1) / step;
+  *block_size = ((size_t)1 << p) + n * step;
+  return (p - 12) * 4 + n;
+}
+
+void* RawImagePool :: allocate(size_t size, size_t* block_size) {
+  u_int size_cls = size_class(size, block_size);
+  if (size_cls >= N_SIZE_CLASSES) {
+    return nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!free_blocks[size_cls].empty()) {
+      void* block = free_blocks[size_cls].back();
+      free_blocks[size_cls].pop_back();
+      cached_bytes -= *block_size;
+      return block;
+    }
+  }
+  return aligned_alloc(RAW_IMAGE_ALIGN, *block_size);
+}
+
+void RawImagePool :: deallocate(void* block, size_t block_size) {
+  if (block == nullptr) return;
+  size_t class_size;
+  u_int size_cls = size_class(block_size, &class_size);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (class_size == block_size && cached_bytes + block_size <= max_cached_bytes) {
+      // Called from ~storage_t, a free list that cannot grow must not throw
+      try {
+        free_blocks[size_cls].push_back(block);
+        cached_bytes += block_size;
+        return;
+      } catch (const std::bad_alloc&) {
+      }
+    }
+  }
+  free(block);
+}
+
+void RawImagePool :: trim() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (u_int i = 0; i < N_SIZE_CLASSES; ++i) {
+    for (void* block : free_blocks[i]) {
+      free(block);
+    }
+    free_blocks[i].clear();
+  }
+  cached_bytes = 0;
+}
+
+size_t RawImagePool :: get_block_size(size_t size) {
+  size_t block_size;
+  size_class(size, &block_size);
+  return block_size;
+}
+
+size_t RawImagePool :: get_cached_bytes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return cached_bytes;
+}
+
+/* ================ MemoryAccount ================ */
+
+static thread_local std::shared_ptr<MemoryAccount> thread_account;
+
+MemoryAccount :: MemoryAccount(size_t limit) : current(0), peak(0), refused(0), limit(limit) {}
+
+bool MemoryAccount :: reserve(size_t bytes) {
+  size_t used = current.load();
+  do {
+    if (limit != 0 && used + bytes > limit) {
+      refused++;
+      return false;
+    }
+  } while (!current.compare_exchange_weak(used, used + bytes));
+
+  size_t high = peak.load();
+  while (used + bytes > high && !peak.compare_exchange_weak(high, used + bytes));
+  return true;
+}
+
+void MemoryAccount :: release(size_t bytes) {
+  current -= bytes;
+}
+
+const std::shared_ptr<MemoryAccount>& MemoryAccount :: get_thread_account() {
+  return thread_account;
+}
+
+MemoryAccountScope :: MemoryAccountScope(const std::shared_ptr<MemoryAccount>& account) : previous(thread_account) {
+  thread_account = account;
+}
+
+MemoryAccountScope :: ~MemoryAccountScope() {
+  thread_account = previous;
+}
+
+/* ================ RawImage ================ */
+
+RawImage :: storage_t :: ~storage_t() {
+  if (pool != nullptr) {
+    pool->deallocate(block, block_size);
+  }
+  if (account) {
+    account->release(charged);
+  }
+}
+
+RawImage :: RawImage() {}
+
+RawImage :: RawImage(u_int width, u_int height, u_int channels, u_int sample_bytes, RawImagePool* pool) :
+  width(width), height(height), channels(channels), sample_bytes(sample_bytes) {
+  size_t bytes;
+  if (!get_layout(width, height, channels, sample_bytes, &stride, &bytes)) {
+    fprintf(stderr, "ERROR: %ux%u image with %u channels is too large\n", width, height, channels);
+    stride = 0;
+    return;
+  }
+  if (bytes == 0) {
+    return;
+  }
+
+  // Checked before the allocation, with the pool's rounded block size
+  const std::shared_ptr<MemoryAccount>& account = MemoryAccount::get_thread_account();
+  size_t charged = RawImagePool::get_block_size(bytes);
+  size_t block_size = 0;
+  if (account && !account->reserve(charged)) {
+    fprintf(stderr, "ERROR: Memory limit of %zu bytes reached, %ux%u image refused\n", account->get_limit(), width, height);
+    return;
+  }
+
+  storage = std::make_shared<storage_t>();
+  storage->account = account;
+  storage->charged = account ? charged : 0;
+  storage->block = pool->allocate(bytes, &block_size);
+  storage->block_size = block_size;
+  if (storage->block == nullptr) {
+    fprintf(stderr, "ERROR: Unable to allocate %zu bytes for %ux%u image\n", bytes, width, height);
+    storage.reset();
+    return;
+  }
+  storage->pool = pool;
+  data = static_cast<u_char*>(storage->block);
+}
+
+bool RawImage :: get_layout(u_int width, u_int height, u_int channels, u_int sample_bytes, size_t* stride, size_t* bytes) {
+  size_t row;
+  if (__builtin_mul_overflow((size_t)width, (size_t)channels, &row) || __builtin_mul_overflow(row, (size_t)sample_bytes, &row) ||
+      row > RAW_IMAGE_MAX_BYTES) {
+    return false;
+  }
+  *stride = (row + RAW_IMAGE_ALIGN - 1) & ~(size_t)(RAW_IMAGE_ALIGN - 1);
+  return !__builtin_mul_overflow(*stride, (size_t)height, bytes) && *bytes <= RAW_IMAGE_MAX_BYTES;
+}
+
+RawImage RawImage :: wrap(void* data, u_int width, u_int height, u_int channels, size_t stride, u_int sample_bytes) {
+  RawImage image;
+  image.width = width;
+  image.height = height;
+  image.channels = channels;
+  image.sample_bytes = sample_bytes;
+  image.stride = stride;
+  image.data = static_cast<u_char*>(data);
+  return image;
+}
+
+RawImage RawImage :: view(u_int x, u_int y, u_int w, u_int h) const {
+  RawImage image;
+  if (x >= width || y >= height) {
+    return image;
+  }
+  image = *this;
+  image.width = std::min(w, width - x);
+  image.height = std::min(h, height - y);
+  image.data = data + stride * y + (size_t)x * channels * sample_bytes;
+  if (cfa != 0) {
+    image.cfa = cfa_shift(cfa, x, y);
+  }
+  for (u_int site = 0; site < 4; ++site) {
+    image.black[site] = black[cfa_site((site >> 1) + y, (site & 1) + x)];
+  }
+  return image;
+}
+
+void* RawImage :: release() {
+  // Ownership can only be handed over for a whole, unshared pool buffer.
+  // The returned pointer is aligned_alloc'ed and must be passed to free().
+  if (!storage || storage.use_count() != 1 || is_view()) {
+    return nullptr;
+  }
+  void* block = storage->block;
+  storage->pool = nullptr;
+  if (storage->account) {   // No longer the decode's to count
+    storage->account->release(storage->charged);
+    storage->account.reset();
+  }
+  storage.reset();
+  data = nullptr;
+  return block;
+}
+
+bool RawImage :: is_view() const {
+  return storage && data != storage->block;
+}
+
+void RawImage :: copy_info(const RawImage& src) {
+  cfa = src.cfa;
+  memcpy(black, src.black, sizeof(black));
+  white = src.white;
+}
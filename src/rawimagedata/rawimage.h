@@ -0,0 +1,167 @@
+#ifndef RAWIMAGE_H
+#define RAWIMAGE_H
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define RAW_IMAGE_ALIGN 64
+#define RAW_IMAGE_MAX_BYTES ((size_t)1 << 48)   // Larger geometry is hostile or corrupt
+
+/* Colour (0: R, 1: G, 2: B) of a CFA site, cfa packed as 2 bits per site */
+inline u_int cfa_colour(u_int cfa, u_int row, u_int col) {
+  return cfa >> ((((row << 1) & 14) | (col & 1)) << 1) & 3;
+}
+
+/* Index (0-3) of a site within the repeating 2x2 quad */
+inline u_int cfa_site(u_int row, u_int col) {
+  return (row & 1) << 1 | (col & 1);
+}
+
+/* CFA pattern as seen from a window starting at (x, y) */
+u_int cfa_shift(u_int cfa, u_int x, u_int y);
+
+/*
+ * Size-class pool for image buffers. Sizes are rounded up to one of four
+ * classes per power of two and released blocks are parked on a free list,
+ * so a batch of same-sized decodes reuses the same memory instead of
+ * mapping and unmapping 100MB per file.
+ */
+class RawImagePool {
+
+public:
+  RawImagePool(size_t max_cached_bytes = (size_t)1 << 30);
+  ~RawImagePool();
+
+  void* allocate(size_t size, size_t* block_size);
+  void deallocate(void* block, size_t block_size);
+  void trim();
+
+  size_t get_cached_bytes();
+  static size_t get_block_size(size_t size);   // Bytes allocate() hands out for size
+
+  static RawImagePool& global();
+
+private:
+  static const u_int N_SIZE_CLASSES = 256;
+  static const size_t MIN_BLOCK_SIZE = 4096;
+
+  std::mutex mutex;
+  std::vector<void*> free_blocks[N_SIZE_CLASSES];
+  size_t cached_bytes = 0;
+  size_t max_cached_bytes;
+
+  static u_int size_class(size_t size, size_t* block_size);
+
+};
+
+/*
+ * Image buffer bytes held by one decode. RawImage charges its block to the
+ * account current on the allocating thread and gives it back when the last
+ * copy goes; an allocation that would go over the limit is not made and
+ * the image stays empty.
+ */
+class MemoryAccount {
+
+public:
+  MemoryAccount(size_t limit = 0);    // 0: no limit
+
+  bool reserve(size_t bytes);
+  void release(size_t bytes);
+  bool fits(size_t bytes) const { return limit == 0 || current.load() + bytes <= limit; }
+
+  void set_limit(size_t bytes) { limit = bytes; }
+  size_t get_limit() const { return limit; }
+  size_t get_current() const { return current.load(); }
+  size_t get_peak() const { return peak.load(); }
+  u_int64_t get_refused() const { return refused.load(); }
+
+  static const std::shared_ptr<MemoryAccount>& get_thread_account();
+
+private:
+  std::atomic<size_t> current;
+  std::atomic<size_t> peak;
+  std::atomic<u_int64_t> refused;
+  size_t limit;
+
+};
+
+/* Charges images allocated on this thread to account for the scope, nullptr: none */
+class MemoryAccountScope {
+
+public:
+  MemoryAccountScope(const std::shared_ptr<MemoryAccount>& account);
+  ~MemoryAccountScope();
+
+private:
+  std::shared_ptr<MemoryAccount> previous;
+
+};
+
+/*
+ * 2D image buffer, either a single channel CFA mosaic or N interleaved
+ * channels. Rows start on RAW_IMAGE_ALIGN byte boundaries and stride is
+ * in bytes. Views and copies share the underlying storage.
+ */
+class RawImage {
+
+public:
+  /* Public Variables */
+  u_int width = 0, height = 0;
+  u_int channels = 0;
+  u_int sample_bytes = 2;
+  size_t stride = 0;
+
+  u_int cfa = 0;                // 2 bits per site, 0 if not a mosaic
+  u_int black[4] = { 0 };       // Black level per 2x2 site
+  u_int white = 0;              // Saturation level
+
+  /* Public Functions */
+  RawImage();
+  RawImage(u_int width, u_int height, u_int channels, u_int sample_bytes = 2, RawImagePool* pool = &RawImagePool::global());
+
+  static RawImage wrap(void* data, u_int width, u_int height, u_int channels, size_t stride, u_int sample_bytes = 2);
+  // Row stride and buffer size of an image, false if they overflow or pass RAW_IMAGE_MAX_BYTES
+  static bool get_layout(u_int width, u_int height, u_int channels, u_int sample_bytes, size_t* stride, size_t* bytes);
+
+  RawImage view(u_int x, u_int y, u_int w, u_int h) const;
+  // Hands over a whole pool buffer (free() it); nullptr for views and shared buffers, copies included
+  void* release();
+
+  bool empty() const { return data == nullptr; }
+  bool is_cfa() const { return channels == 1 && cfa != 0; }
+  bool is_view() const;
+  size_t size_bytes() const { return stride * height; }
+  void copy_info(const RawImage& src);
+
+  template <typename T = u_int16_t>
+  T* row(u_int y) const {
+    return reinterpret_cast<T*>(data + stride * y);
+  }
+
+  u_int16_t& at(u_int x, u_int y, u_int c = 0) const {
+    return row<u_int16_t>(y)[x * channels + c];
+  }
+
+private:
+  struct storage_t {
+    void* block = nullptr;
+    size_t block_size = 0;
+    size_t charged = 0;           // Bytes reserved on the account
+    RawImagePool* pool = nullptr;
+    std::shared_ptr<MemoryAccount> account;
+    ~storage_t();
+  };
+
+  std::shared_ptr<storage_t> storage;
+  u_char* data = nullptr;
+
+};
+
+#endif
@@ -1,41 +1,532 @@
 
 #include "rawimagedata.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Bytes the pool hands out for an image, as RawImage allocates it. Geometry it refuses counts as the largest image */
+static size_t get_image_bytes(u_int width, u_int height, u_int channels, u_int sample_bytes) {
+  size_t stride, bytes;
+  if (!RawImage::get_layout(width, height, channels, sample_bytes, &stride, &bytes)) {
+    return RAW_IMAGE_MAX_BYTES;
+  }
+  return bytes != 0 ? RawImagePool::get_block_size(bytes) : 0;
+}
+
 RawImageData :: RawImageData(const std::string& file_path) : file_path(file_path), file(file_path, std::ios::binary) {
+  struct stat st;
   if (!file) {
     throw std::runtime_error("Unable to open file: " + file_path);
   }
+  // Pipes and sockets (/dev/stdin, tar or upload streams) are read in order
+  if (stat(file_path.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open stream: " + file_path);
+    }
+    stream.reset(new StreamReader(fd));
+    file.std::ios::rdbuf(stream.get());
+  }
+  start_parse_stats();
+}
+
+RawImageData :: RawImageData(const std::string& file_path, std::unique_ptr<StreamReader> stream)
+  : file_path(file_path), stream(std::move(stream)) {
+  // The bytes read so far are still held, so the header can be read again
+  this->stream->pubseekpos(0, std::ios::in);
+  file.std::ios::rdbuf(this->stream.get());
+  start_parse_stats();
+}
+
+RawImageData :: RawImageData(const void* data, size_t size)
+  : memory(new MemoryReader(data, size)), memory_data(static_cast<const u_char*>(data)), memory_size(size) {
+  file.std::ios::rdbuf(memory.get());
+  start_parse_stats();
 }
 
 RawImageData :: ~RawImageData() {}
 
-bool RawImageData :: load_raw() {
+bool RawImageData :: open_raw() {
+  bool ok;
+
+  // Metadata is scattered over the file, read it in planned waves of coalesced ranges
+  ReadPlanner read_planner(is_streaming() ? std::string() : file_path);
+  std::streambuf* file_buffer = nullptr;
+  start_parse_stats();
+  blobs_found = false;
+  if (read_planner.is_open()) {
+    file_buffer = set_read_buffer(&read_planner);
+    planner = &read_planner;
+  }
+
   raw_identify();
-  if (!init_parse_raw(raw_data.base)) {
+  ok = init_parse_raw(raw_data.base) && apply_raw_data();
+
+  // Raw data is read in large sequential runs, straight through the file buffer
+  if (file_buffer != nullptr) {
+    set_read_buffer(file_buffer);
+  }
+  planner = nullptr;
+  read_stats = read_planner.get_stats();
+  if (!ok) {
     return false;
   }
-  if (!apply_raw_data()) {
+  if (is_streaming()) {
+    stream->pin();    // Metadata and offset tables stay while the raw data streams past
+  }
+  return true;
+}
+
+bool RawImageData :: load_raw() {
+  // Metadata may already be there from open_raw() or a cache
+  if (raw_data.main_ifd.frame.width == 0 && !open_raw()) {
     return false;
   }
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  MemoryAccountScope memory_scope(memory_account);
+  if (!check_memory(memory_limit, get_image_bytes(frame.width, frame.height, frame.sample_pixel ? frame.sample_pixel : 1, 2))) {
+    return false;
+  }
+  if (!TIMED_STAGE(Parse_Stage::UNPACK, load_raw_data())) {
+    return false;
+  }
+
+  return true;
+}
 
-  print_data(true, false);
+const RawImage& RawImageData :: image() const {
+  return raw_image;
+}
+
+RawImage RawImageData :: take_image() {
+  RawImage image = raw_image;
+  raw_image = RawImage();
+  return image;
+}
 
-  if (!load_raw_data()) {
+bool RawImageData :: decode(const decode_options_t& options, RawImage& output) {
+  demosaic_options_t demosaic_options;
+  colour_options_t colour_options;
+  stats_options_t stats_options;
+  RawImage rgb;
+
+  // Runs after open_raw() or on the buffer from load_raw(), which is consumed
+  if (raw_data.main_ifd.frame.width == 0) {
+    fprintf(stderr, "ERROR: No raw data opened\n");
     return false;
   }
+  MemoryAccountScope memory_scope(memory_account);
+  if (!check_memory(options.memory_limit ? options.memory_limit : memory_limit, get_decode_bytes(options))) {
+    return false;
+  }
+
+  get_camera_matrix(demosaic_options.rgb_cam);
+  colour_options.format = options.format;
+  colour_options.curve = options.curve;
+  colour_options.pool = options.pool;
+  stats_options.pool = options.pool;
+  if (options.apply_orientation) {
+    colour_options.orientation = raw_data.main_ifd.frame.orientation;
+  }
 
+  if (options.half_size) {
+    if (!TIMED_STAGE(Parse_Stage::UNPACK, load_raw_half_size(rgb, options.raw_stats))) {
+      return false;
+    }
+    raw_image = RawImage();
+    if (!TIMED_STAGE(Parse_Stage::COLOUR, convert_colour(rgb, output, demosaic_options.rgb_cam, colour_options))) {
+      return false;
+    }
+    return options.output_stats == nullptr || TIMED_STAGE(Parse_Stage::STATS, compute_image_stats(output, options.output_stats, stats_options));
+  }
+
+  if (raw_image.empty() && !TIMED_STAGE(Parse_Stage::UNPACK, load_raw_data())) {
+    return false;
+  }
+  if (options.raw_stats != nullptr && !TIMED_STAGE(Parse_Stage::STATS, compute_image_stats(raw_image, options.raw_stats, stats_options))) {
+    return false;
+  }
+  if (!normalise_raw()) {
+    return false;
+  }
+
+  demosaic_options.method = options.demosaic;
+  demosaic_options.pool = options.pool;
+  if (!TIMED_STAGE(Parse_Stage::DEMOSAIC, demosaic_raw_image(raw_image, rgb, demosaic_options))) {
+    return false;
+  }
+  raw_image = RawImage();
+
+  if (!TIMED_STAGE(Parse_Stage::COLOUR, convert_colour(rgb, output, demosaic_options.rgb_cam, colour_options))) {
+    return false;
+  }
+  return options.output_stats == nullptr || TIMED_STAGE(Parse_Stage::STATS, compute_image_stats(output, options.output_stats, stats_options));
+}
+
+bool RawImageData :: decode_region(u_int x, u_int y, u_int width, u_int height, const decode_options_t& options, RawImage& output) {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  demosaic_options_t demosaic_options;
+  colour_options_t colour_options;
+  stats_options_t stats_options;
+  normalise_params_t params;
+  double wb_multi[3];
+  RawImage cfa, rgb;
+
+  if (frame.width == 0) {
+    fprintf(stderr, "ERROR: No raw data opened\n");
+    return false;
+  }
+  if (x >= frame.width || y >= frame.height || width == 0 || height == 0) {
+    fprintf(stderr, "ERROR: Region %dx%d+%d+%d outside the %dx%d frame\n", width, height, x, y, frame.width, frame.height);
+    return false;
+  }
+  width = std::min(width, frame.width - x);
+  height = std::min(height, frame.height - y);
+
+  // Region plus the demosaic halo, on even coordinates so the CFA pattern is unchanged
+  u_int halo = options.half_size ? 0 : get_demosaic_halo(options.demosaic);
+  u_int x0 = (x > halo ? x - halo : 0) & ~1u;
+  u_int y0 = (y > halo ? y - halo : 0) & ~1u;
+  u_int x1 = std::min((x + width + halo + 1) & ~1u, frame.width & ~1u);
+  u_int y1 = std::min((y + height + halo + 1) & ~1u, frame.height & ~1u);
+  if (x1 <= x0 || y1 <= y0) {
+    return false;
+  }
+  // Window (and its normalised copy), interpolated window, output
+  u_int channels = frame.sample_pixel ? frame.sample_pixel : 1;
+  size_t window_bytes = get_image_bytes(x1 - x0, y1 - y0, channels, 2);
+  size_t region_bytes = (raw_image.empty() ? window_bytes : options.half_size ? 0 : window_bytes) +
+                        get_image_bytes(options.half_size ? (x1 - x0) / 2 : x1 - x0, options.half_size ? (y1 - y0) / 2 : y1 - y0, 3, 2) +
+                        get_image_bytes(width, height, 3, get_output_sample_bytes(options.format));
+  MemoryAccountScope memory_scope(memory_account);
+  if (!check_memory(options.memory_limit ? options.memory_limit : memory_limit, region_bytes)) {
+    return false;
+  }
+
+  // Rows come from the loaded buffer if there is one, else only the needed part of the file
+  if (!raw_image.empty()) {
+    cfa = raw_image.view(x0, y0, x1 - x0, y1 - y0);
+  } else {
+    cfa = RawImage(x1 - x0, y1 - y0, frame.sample_pixel ? frame.sample_pixel : 1);
+    if (cfa.empty()) {
+      return false;
+    }
+    apply_image_info(cfa);
+    if (!TIMED_STAGE(Parse_Stage::UNPACK, load_raw_rect(cfa, x0, y0))) {
+      return false;
+    }
+  }
+
+  get_camera_matrix(demosaic_options.rgb_cam);
+  colour_options.format = options.format;
+  colour_options.curve = options.curve;
+  colour_options.pool = options.pool;
+  stats_options.pool = options.pool;
+  if (options.apply_orientation) {
+    colour_options.orientation = frame.orientation;
+  }
+  if (options.raw_stats != nullptr && !TIMED_STAGE(Parse_Stage::STATS, compute_image_stats(cfa.view(x - x0, y - y0, width, height), options.raw_stats, stats_options))) {
+    return false;
+  }
+
+  get_white_balance(wb_multi);
+  if (!get_normalise_params(cfa, wb_multi, &params)) {
+    fprintf(stderr, "ERROR: Region decode needs a CFA raw\n");
+    return false;
+  }
+
+  if (options.half_size) {
+    PARSE_STAGE(Parse_Stage::NORMALISE);
+    rgb = RawImage(cfa.width / 2, cfa.height / 2, 3);
+    if (rgb.empty()) {
+      return false;
+    }
+    rgb.white = params.out_max;
+    for (u_int row = 0; row < rgb.height; ++row) {
+      collapse_quad_rows(cfa.row(row * 2), cfa.row(row * 2 + 1), rgb.row(row), cfa.width, cfa.cfa, params);
+    }
+  } else {
+    // The buffer from load_raw() stays as it is, the region is normalised into a copy
+    if (!raw_image.empty()) {
+      PARSE_STAGE(Parse_Stage::NORMALISE);
+      RawImage copy(cfa.width, cfa.height, 1);
+      if (copy.empty()) {
+        return false;
+      }
+      copy.cfa = cfa.cfa;
+      copy.white = params.out_max;
+      for (u_int row = 0; row < cfa.height; ++row) {
+        normalise_row(cfa.row(row), copy.row(row), cfa.width, &params.black[(row & 1) << 1], &params.scale[(row & 1) << 1], params.out_max);
+      }
+      cfa = copy;
+    } else if (!TIMED_STAGE(Parse_Stage::NORMALISE, normalise_raw_image(cfa, params))) {
+      return false;
+    }
+    demosaic_options.method = options.demosaic;
+    demosaic_options.pool = options.pool;
+    RawImage full_rgb;
+    if (!TIMED_STAGE(Parse_Stage::DEMOSAIC, demosaic_raw_image(cfa, full_rgb, demosaic_options))) {
+      return false;
+    }
+    // Drop the halo
+    rgb = full_rgb.view(x - x0, y - y0, width, height);
+  }
+
+  if (!TIMED_STAGE(Parse_Stage::COLOUR, convert_colour(rgb, output, demosaic_options.rgb_cam, colour_options))) {
+    return false;
+  }
+  return options.output_stats == nullptr || TIMED_STAGE(Parse_Stage::STATS, compute_image_stats(output, options.output_stats, stats_options));
+}
+
+bool RawImageData :: decode_bands(const decode_options_t& options, const pipeline_options_t& pipeline_options, const band_sink_t& sink) {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  pipeline_stages_t stages;
+  RawImage info;
+  double wb_multi[3];
+
+  if (frame.width == 0) {
+    fprintf(stderr, "ERROR: No raw data opened\n");
+    return false;
+  }
+  // Frame description only, rows are read band by band
+  info.width = frame.width;
+  info.height = frame.height;
+  info.channels = frame.sample_pixel ? frame.sample_pixel : 1;
+  apply_image_info(info);
+
+  get_white_balance(wb_multi);
+  if (!get_normalise_params(info, wb_multi, &stages.normalise)) {
+    fprintf(stderr, "ERROR: Band decode needs a CFA raw\n");
+    return false;
+  }
+  get_camera_matrix(stages.demosaic.rgb_cam);
+  stages.demosaic.method = options.demosaic;
+  stages.colour.format = options.format;
+  stages.colour.curve = options.curve;
+  stages.half_size = options.half_size;
+  stages.raw_stats = options.raw_stats;
+  stages.output_stats = options.output_stats;
+
+  // Band count and height shrink to what is left of the memory limit
+  size_t limit = options.memory_limit ? options.memory_limit : memory_limit;
+  pipeline_options_t band_options = pipeline_options;
+  if (band_options.pool == &ThreadPool::shared()) {
+    band_options.pool = options.pool;   // Left at the default, options.pool (nullptr included) decides
+  }
+  MemoryAccountScope memory_scope(memory_account);
+  if (!check_memory(limit, 0)) {
+    return false;
+  }
+  if (limit != 0) {
+    size_t available = limit - std::min(limit, memory_account->get_current());
+    band_options.memory_limit = band_options.memory_limit ? std::min(band_options.memory_limit, available) : available;
+  }
+
+  auto source = [this](RawImage& rows, u_int y) {
+    if (raw_image.empty()) {
+      return load_raw_rect(rows, 0, y);
+    }
+    for (u_int row = 0; row < rows.height; ++row) {
+      memcpy(rows.row(row), raw_image.row(y + row), (size_t)rows.width * rows.channels * 2);
+    }
+    return true;
+  };
+  return TIMED_STAGE(Parse_Stage::BANDS, run_band_pipeline(info, source, stages, band_options, sink));
+}
+
+size_t RawImageData :: get_decode_bytes(const decode_options_t& options) const {
+  const img_frame_t& frame = raw_data.main_ifd.frame;
+  u_int channels = frame.sample_pixel ? frame.sample_pixel : 1;
+  u_int output_bytes = get_output_sample_bytes(options.format);
+  size_t raw = raw_image.empty() ? get_image_bytes(frame.width, frame.height, channels, 2) : 0;
+
+  // Half size: quad rows and the half size RGB, then the output
+  if (options.half_size) {
+    size_t quads = raw_image.empty() ? get_image_bytes(frame.width, 2, 1, 2) : 0;
+    size_t rgb = get_image_bytes(frame.width / 2, frame.height / 2, 3, 2);
+    return std::max(quads + rgb, rgb + get_image_bytes(frame.width / 2, frame.height / 2, 3, output_bytes));
+  }
+  // The raw buffer goes once demosaiced, before the output is allocated
+  size_t rgb = get_image_bytes(frame.width, frame.height, 3, 2);
+  return std::max(raw + rgb, rgb + get_image_bytes(frame.width, frame.height, 3, output_bytes));
+}
+
+/* Refuses a decode whose declared geometry cannot fit before anything is allocated */
+bool RawImageData :: check_memory(size_t limit, size_t bytes) {
+  memory_account->set_limit(limit);
+  if (!memory_account->fits(bytes)) {
+    fprintf(stderr, "ERROR: %ux%u frame needs %zu bytes, over the memory limit of %zu (%zu in use)\n",
+            raw_data.main_ifd.frame.width, raw_data.main_ifd.frame.height, bytes, limit, memory_account->get_current());
+    return false;
+  }
   return true;
 }
 
+parse_stats_t RawImageData :: get_parse_stats() const {
+  parse_stats_t stats = parse_stats;
+  stats.memory_current = memory_account->get_current();
+  stats.memory_peak = memory_account->get_peak();
+  stats.memory_refused = memory_account->get_refused();
+  return stats;
+}
+
+/* Tags of each blob kind, in order of preference */
+static const struct {
+  Blob_Kind kind;
+  Tag_Space space;
+  u_int tag;
+} BLOB_TAGS[] = {
+  { Blob_Kind::ICC_PROFILE, Tag_Space::IFD, 34675 },          // InterColorProfile
+  { Blob_Kind::ICC_PROFILE, Tag_Space::IFD, 50831 },          // AsShotICCProfile
+  { Blob_Kind::XMP, Tag_Space::IFD, 700 },
+  { Blob_Kind::IPTC, Tag_Space::IFD, 33723 },
+  { Blob_Kind::MAKERNOTE, Tag_Space::EXIF, 0x927c },
+  { Blob_Kind::LINEARIZATION_TABLE, Tag_Space::MAKERNOTE, 0x0096 },
+  { Blob_Kind::CONTRAST_CURVE, Tag_Space::MAKERNOTE, 0x008c },
+};
+
+/*
+ * Spans are found from the tag store and hashed the first time they are
+ * asked for after a parse. A stream has no bytes left to point into.
+ */
+const std::vector<blob_t>& RawImageData :: get_blobs() {
+  const u_char* data;
+  size_t size;
+  if (blobs_found) {
+    return blobs;
+  }
+  blobs_found = true;
+  blobs.clear();
+
+  if (memory) {
+    data = memory_data;
+    size = memory_size;
+  } else if (is_streaming()) {
+    fprintf(stderr, "ERROR: Embedded blobs need a seekable file: %s\n", file_path.c_str());
+    return blobs;
+  } else {
+    if (!mapping) {
+      mapping.reset(new FileMapping());
+      if (!mapping->map(file_path)) {
+        mapping.reset();
+        return blobs;
+      }
+    }
+    data = mapping->data();
+    size = mapping->size();
+  }
+
+  for (const auto& blob_tag : BLOB_TAGS) {
+    for (size_t i = 0; i < raw_data.tags.size(); ++i) {
+      const tag_entry_t& entry = raw_data.tags[i];
+      if (entry.tag != blob_tag.tag || entry.space != blob_tag.space || entry.size == 0) {
+        continue;
+      }
+      if (entry.offset < 0 || (u_int64_t)entry.offset > size || entry.size > size - entry.offset) {
+        fprintf(stderr, "ERROR: %s of %llu bytes at %lld is outside the file\n", get_blob_name(blob_tag.kind),
+                (unsigned long long)entry.size, (long long)entry.offset);
+        continue;
+      }
+      // IFDs parsed twice (a preview reached from two places) give the same span
+      bool seen = false;
+      for (const blob_t& blob : blobs) {
+        seen = seen || (blob.kind == blob_tag.kind && blob.offset == entry.offset);
+      }
+      if (seen) {
+        continue;
+      }
+      blob_t blob;
+      blob.kind = blob_tag.kind;
+      blob.data = data + entry.offset;
+      blob.size = entry.size;
+      blob.offset = entry.offset;
+      blob.hash = get_blob_hash(blob.data, blob.size);
+      blobs.push_back(blob);
+    }
+  }
+  return blobs;
+}
+
+bool RawImageData :: get_blob(Blob_Kind kind, blob_t* blob) {
+  for (const blob_t& found : get_blobs()) {
+    if (found.kind == kind) {
+      *blob = found;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Swaps the buffer the parser reads through, keeping the I/O counter on top */
+std::streambuf* RawImageData :: set_read_buffer(std::streambuf* buffer) {
+  if (io_counter) {
+    return io_counter->set_source(buffer);
+  }
+  return file.std::ios::rdbuf(buffer);
+}
+
+void RawImageData :: start_parse_stats() {
+#ifdef RAWIMAGEDATA_INSTRUMENT
+  parse_stats = parse_stats_t();
+  parse_stats.set = true;
+  if (!io_counter) {
+    io_counter.reset(new IoCounter(file.std::ios::rdbuf(), &parse_stats.io));
+    file.std::ios::rdbuf(io_counter.get());
+  }
+  io_counter->reset();
+#endif
+}
+
+int RawImageData :: get_orientation() const {
+  return raw_data.main_ifd.frame.orientation;
+}
+
+bool RawImageData :: normalise_raw() {
+  PARSE_STAGE(Parse_Stage::NORMALISE);
+  normalise_params_t params;
+  double wb_multi[3];
+
+  get_white_balance(wb_multi);
+  if (!get_normalise_params(raw_image, wb_multi, &params)) {
+    return false;
+  }
+  return normalise_raw_image(raw_image, params);
+}
+
+bool RawImageData :: demosaic_raw(const demosaic_options_t& options) {
+  RawImage rgb;
+  if (!TIMED_STAGE(Parse_Stage::DEMOSAIC, demosaic_raw_image(raw_image, rgb, options))) {
+    return false;
+  }
+  raw_image = rgb;
+  return true;
+}
+
+bool RawImageData :: get_camera_matrix(float rgb_cam[3][3]) {
+  return get_rgb_cam(raw_data.tags.get_string(Tag_Space::IFD, 271), raw_data.tags.get_string(Tag_Space::IFD, 272), rgb_cam);
+}
+
+void RawImageData :: get_white_balance(double wb_multi[3]) {
+  white_balance_multiplier_t& wb = raw_data.main_ifd.util.white_balance_multi_cam;
+  wb_multi[0] = wb.set && wb.r > 0 ? wb.r : 1;
+  wb_multi[1] = wb.set && wb.g > 0 ? wb.g : 1;
+  wb_multi[2] = wb.set && wb.b > 0 ? wb.b : 1;
+}
+
 
 bool RawImageData :: raw_identify() {
+  PARSE_STAGE(Parse_Stage::IDENTIFY);
   char raw_image_header[32];
   raw_data.bitorder = read_2_bytes_unsigned(file, raw_data.bitorder);
   file.seekg(0, std::ios::beg);
   file.read(raw_image_header, sizeof(raw_image_header)/sizeof(raw_image_header[0]));
 
-  file.seekg(0, std::ios::end);
-  raw_data.file_size = file.tellg();
+  if (is_streaming()) {
+    raw_data.file_size = 0;   // Unknown until the stream ends
+  } else {
+    file.seekg(0, std::ios::end);
+    raw_data.file_size = file.tellg();
+  }
 
   if (raw_data.bitorder == 0x4949 || raw_data.bitorder == 0x4D4D) {
     // II or MM at the beginng of the file
@@ -50,17 +541,17 @@ bool RawImageData :: raw_identify() {
 bool RawImageData :: apply_raw_data() {
   u_int max_size = 0, cur_size = 0;
   /* Apply Main Raw IFD */
-  for (u_int ifd = 0; ifd < raw_data.ifd_count; ++ifd) {
-    printf("Apply IFD: %d |",ifd);
+  for (u_int ifd = 1; ifd <= raw_data.ifd_count; ++ifd) {
+    DEBUG_PRINT("Apply IFD: %d |",ifd);
     if (!raw_data.ifds[ifd]._id == -1) continue;  // Skip unset ifd
 
     cur_size = raw_data.ifds[ifd].frame.width * raw_data.ifds[ifd].frame.height * raw_data.ifds[ifd].frame.bps;
     if (cur_size > max_size && (raw_data.ifds[ifd].frame.bps != 6 || raw_data.ifds[ifd].frame.sample_pixel != 3)) {
       memcpy(&raw_data.main_ifd, &raw_data.ifds[ifd], sizeof(raw_data.main_ifd));
       max_size = cur_size;
-      printf(" Max IFD Set ");
+      DEBUG_PRINT(" Max IFD Set ");
     }
-    printf("\n");
+    DEBUG_PRINT("\n");
   }
   /* End of Main Raw IFD */
 
@@ -69,30 +560,26 @@ bool RawImageData :: apply_raw_data() {
   }
 
   /* Apply Rest of the Data to Main Raw IFD */
-  for (u_int ifd = 0; ifd < raw_data.ifd_count; ++ifd) {
+  for (u_int ifd = 1; ifd <= raw_data.ifd_count; ++ifd) {
     if (!raw_data.ifds[ifd]._id == -1) continue;  // Skip unset ifd
 
     /* Orientation */
     ASSIGN_IF_SET(raw_data.main_ifd.frame, raw_data.ifds[ifd].frame, orientation);
 
     /* APPLY EXIF */
-    COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, camera_make);
-    COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, camera_model);
-    COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, software);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, focal_length);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, exposure);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, f_number);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, iso_sensitivity);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, image_count);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, shutter_count);
-    COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, artist);
-    COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, copyright);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, icc_profile_offset);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, icc_profile_count);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, gps_latitude_reference);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, gps_latitude);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, gps_longitude_reference);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, gps_longitude);
+    ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, gps_altitude);
     ASSIGN_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, date_time);
     COPY_IF_SET(raw_data.main_ifd.exif, raw_data.ifds[ifd].exif, date_time_str);
     if (raw_data.ifds[ifd].exif.lens_info.set) {
@@ -125,9 +612,259 @@ bool RawImageData :: apply_raw_data() {
   return true;
 }
 
+bool RawImageData :: load_uncompressed_raw_data() {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  if (frame.width == 0 || frame.height == 0 || frame.bps == 0 || frame.bps > 16) {
+    fprintf(stderr, "ERROR: Invalid raw frame %dx%d bps: %d\n", frame.width, frame.height, frame.bps);
+    return false;
+  }
+  if (raw_data.main_ifd.data_offset == 0 && raw_data.main_ifd.n_tiles == 0) {
+    fprintf(stderr, "ERROR: Raw data offset not set\n");
+    return false;
+  }
+
+  raw_image = RawImage(frame.width, frame.height, frame.sample_pixel ? frame.sample_pixel : 1);
+  if (raw_image.empty()) {
+    return false;
+  }
+  apply_image_info(raw_image);
+
+  return load_raw_rect(raw_image, 0, 0);
+}
+
+off_t RawImageData :: get_offset_entry(off_t array, u_int type, u_int index) {
+  file.seekg(array + (off_t)index * (type == 3 ? 2 : 4), std::ios::beg);
+  off_t value = type == 3 ? read_2_bytes_unsigned(file, raw_data.bitorder) : read_4_bytes_unsigned(file, raw_data.bitorder);
+  return value + raw_data.main_ifd.offsets_base;
+}
+
+off_t RawImageData :: get_raw_row_offset(u_int row, size_t row_bytes) {
+  raw_data_ifd_t& ifd = raw_data.main_ifd;
+  u_int rows = ifd.rows_per_strip;
+  if (ifd.n_strips <= 1 || rows == 0 || rows >= ifd.frame.height) {
+    return ifd.data_offset + (off_t)row * row_bytes;
+  }
+  return get_offset_entry(ifd.strip_offsets_array, ifd.strip_offsets_type, row / rows) + (off_t)(row % rows) * row_bytes;
+}
+
+bool RawImageData :: load_raw_rect(RawImage& image, u_int x, u_int y) {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  u_int channels = frame.sample_pixel ? frame.sample_pixel : 1;
+
+  if (x + image.width > frame.width || y + image.height > frame.height || image.channels != channels) {
+    return false;
+  }
+  if (frame.tile_width != UINT32_MAX && raw_data.main_ifd.n_tiles > 0) {
+    return unpack_raw_tiles(image, x, y);
+  }
+  if (x == 0 && image.width == frame.width) {
+    return load_raw_rows(image, y, image.height);
+  }
+
+  // Only the needed rows are read, whole rows at a time, then cropped
+  RawImage band(frame.width, std::min(image.height, 16u), channels);
+  for (u_int row = 0; row < image.height; row += band.height) {
+    u_int count = std::min(band.height, image.height - row);
+    if (!load_raw_rows(band, y + row, count)) {
+      return false;
+    }
+    for (u_int i = 0; i < count; ++i) {
+      memcpy(image.row(row + i), band.row(i) + x * channels, (size_t)image.width * channels * 2);
+    }
+  }
+  return true;
+}
+
+bool RawImageData :: unpack_raw_tiles(RawImage& image, u_int x, u_int y) {
+  raw_data_ifd_t& ifd = raw_data.main_ifd;
+  img_frame_t& frame = ifd.frame;
+  u_int channels = frame.sample_pixel ? frame.sample_pixel : 1;
+  u_int tiles_across = (frame.width + frame.tile_width - 1) / frame.tile_width;
+  size_t tile_row_samples = (size_t)frame.tile_width * channels;
+  size_t tile_row_bytes = (tile_row_samples * frame.bps + 7) / 8;
+  off_t tile_offset;
+
+  if (frame.compression != 1) {
+    fprintf(stderr, "ERROR: Tiled raw not supported for compression: %d\n", frame.compression);
+    return false;
+  }
+  // Tile byte count decides between 16 bit containers and packed rows, as for strips
+  if (ifd.tile_byte_counts / frame.tile_length >= tile_row_bytes) {
+    tile_row_bytes = ifd.tile_byte_counts / frame.tile_length;
+  }
+  bool container_16 = tile_row_bytes >= tile_row_samples * 2;
+  std::vector<u_char> buffer(tile_row_bytes + 8, 0);
+  std::vector<u_int16_t> samples(tile_row_samples);
+
+  // Only tiles intersecting the rectangle are read
+  for (u_int ty = y / frame.tile_length; ty <= (y + image.height - 1) / frame.tile_length; ++ty) {
+    for (u_int tx = x / frame.tile_width; tx <= (x + image.width - 1) / frame.tile_width; ++tx) {
+      u_int tile = ty * tiles_across + tx;
+      if (tile >= ifd.n_tiles) {
+        fprintf(stderr, "ERROR: Tile %d missing\n", tile);
+        return false;
+      }
+      tile_offset = ifd.n_tiles > 1 ? get_offset_entry(ifd.tile_offsets_array, ifd.tile_offsets_type, tile) : ifd.tile_offset;
+      u_int row_begin = std::max(y, ty * frame.tile_length);
+      u_int row_end = std::min(y + image.height, (ty + 1) * frame.tile_length);
+      u_int col_begin = std::max(x, tx * frame.tile_width);
+      u_int col_end = std::min(x + image.width, (tx + 1) * frame.tile_width);
+
+      file.seekg(tile_offset + (off_t)(row_begin - ty * frame.tile_length) * tile_row_bytes, std::ios::beg);
+      for (u_int row = row_begin; row < row_end; ++row) {
+        if (!file.read(reinterpret_cast<char*>(buffer.data()), tile_row_bytes)) {
+          fprintf(stderr, "ERROR: Raw tile %d truncated\n", tile);
+          file.clear();
+          return false;
+        }
+        if (container_16) {
+          unpack_16_bits(buffer.data(), samples.data(), tile_row_samples, raw_data.bitorder);
+        } else {
+          unpack_bits_msb(buffer.data(), samples.data(), tile_row_samples, frame.bps);
+        }
+        memcpy(image.row(row - y) + (size_t)(col_begin - x) * channels,
+               samples.data() + (size_t)(col_begin - tx * frame.tile_width) * channels,
+               (size_t)(col_end - col_begin) * channels * 2);
+      }
+    }
+  }
+  return true;
+}
+
+size_t RawImageData :: get_raw_row_bytes() {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  size_t row_samples = (size_t)frame.width * (frame.sample_pixel ? frame.sample_pixel : 1);
+  size_t packed_bytes = (row_samples * frame.bps + 7) / 8;
+  u_int rows = raw_data.main_ifd.rows_per_strip;
+  if (rows == 0 || rows > frame.height) {
+    rows = frame.height;
+  }
+  // Strip byte count decides between 16 bit containers, padded and packed rows
+  if (raw_data.main_ifd.strip_byte_counts / rows >= packed_bytes) {
+    return raw_data.main_ifd.strip_byte_counts / rows;
+  }
+  return packed_bytes;
+}
+
+bool RawImageData :: load_raw_rows(RawImage& image, u_int row_start, u_int row_count) {
+  if (raw_data.main_ifd.frame.compression != 1) {
+    fprintf(stderr, "ERROR: Row access not supported for compression: %d\n", raw_data.main_ifd.frame.compression);
+    return false;
+  }
+  return unpack_raw_rows(image, row_start, row_count);
+}
+
+bool RawImageData :: load_raw_half_size(RawImage& output, image_stats_t* raw_stats) {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  normalise_params_t params;
+  stats_accumulator_t stats;
+  RawImage quad_rows;
+  double wb_multi[3];
+
+  // Quads come from the loaded buffer if there is one, else straight from the file
+  bool loaded = !raw_image.empty();
+  if (loaded) {
+    quad_rows = raw_image;
+  } else {
+    quad_rows = RawImage(frame.width, 2, 1);
+    if (quad_rows.empty()) {
+      return false;
+    }
+    apply_image_info(quad_rows);
+  }
+  get_white_balance(wb_multi);
+  if (!get_normalise_params(quad_rows, wb_multi, &params)) {
+    fprintf(stderr, "ERROR: Half size decode needs a CFA raw\n");
+    return false;
+  }
+
+  output = RawImage(frame.width / 2, frame.height / 2, 3);
+  if (output.empty()) {
+    return false;
+  }
+  output.white = params.out_max;
+  if (raw_stats != nullptr && !stats.init(quad_rows, stats_options_t().bins)) {
+    return false;
+  }
+
+  for (u_int y = 0; y < output.height; ++y) {
+    RawImage rows = loaded ? raw_image.view(0, y * 2, frame.width, 2) : quad_rows;
+    if (!loaded && !load_raw_rect(rows, 0, y * 2)) {
+      return false;
+    }
+    // Statistics come from the quad rows while they are still in cache
+    if (raw_stats != nullptr) {
+      stats.add_rows(rows, y * 2);
+    }
+    collapse_quad_rows(rows.row(0), rows.row(1), output.row(y), frame.width, rows.cfa, params);
+  }
+  if (raw_stats != nullptr) {
+    *raw_stats = image_stats_t();
+    stats.finish(raw_stats);
+  }
+  return true;
+}
+
+bool RawImageData :: unpack_raw_rows(RawImage& image, u_int row_start, u_int row_count) {
+  img_frame_t& frame = raw_data.main_ifd.frame;
+  size_t row_samples = (size_t)frame.width * (frame.sample_pixel ? frame.sample_pixel : 1);
+  size_t row_bytes = get_raw_row_bytes();
+  bool container_16 = row_bytes >= row_samples * 2;
+
+  if (row_start + row_count > frame.height || image.width * image.channels < row_samples) {
+    return false;
+  }
+
+  std::vector<u_char> buffer(row_bytes + 8, 0);
+  u_int rows_per_strip = raw_data.main_ifd.rows_per_strip;
+  for (u_int row = 0; row < row_count; ++row) {
+    // Seek at the first row and at every strip start, strips need not be contiguous
+    if (row == 0 || (rows_per_strip && (row_start + row) % rows_per_strip == 0)) {
+      file.seekg(get_raw_row_offset(row_start + row, row_bytes), std::ios::beg);
+    }
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), row_bytes)) {
+      fprintf(stderr, "ERROR: Raw data truncated at row %d\n", row_start + row);
+      file.clear();
+      return false;
+    }
+    if (container_16) {
+      unpack_16_bits(buffer.data(), image.row(row), row_samples, raw_data.bitorder);
+    } else {
+      unpack_bits_msb(buffer.data(), image.row(row), row_samples, frame.bps);
+    }
+  }
+  return true;
+}
+
+void RawImageData :: apply_image_info(RawImage& image) {
+  rggb_t& cblack = raw_data.main_ifd.util.cblack;
+  u_int colour;
+
+  image.white = (1 << raw_data.main_ifd.frame.bps) - 1;
+  if (image.channels != 1) {
+    image.cfa = 0;
+    return;
+  }
+
+  // Fall back to RGGB when the file carries no CFA pattern
+  image.cfa = raw_data.main_ifd.util.cfa ? raw_data.main_ifd.util.cfa : 0x94949494;
+  for (u_int site = 0; site < 4; ++site) {
+    colour = cfa_colour(image.cfa, site >> 1, site & 1);
+    if (colour == 0) {
+      image.black[site] = cblack.r;
+    } else if (colour == 2) {
+      image.black[site] = cblack.b;
+    } else {
+      image.black[site] = cfa_colour(image.cfa, site >> 1, ~site & 1) == 0 ? cblack.g_r : cblack.g_b;
+    }
+  }
+}
+
 bool RawImageData :: init_parse_raw(off_t raw_data_base) {
+  PARSE_STAGE(Parse_Stage::IFD_WALK);
   raw_data.ifd_count = 0; // reset ifd count
   memset(raw_data.ifds, 0, sizeof(raw_data.ifds));  // reset ifds
+  raw_data.tags.clear();
   
   file.seekg(0, std::ios::beg);
   if (!parse_raw_data(raw_data_base)) {
@@ -164,7 +901,7 @@ bool RawImageData :: parse_raw_data(off_t raw_data_base) {
 
 bool RawImageData :: parse_raw_data_ifd(off_t raw_data_base) {
   u_int ifd;
-  if (raw_data.ifd_count >= sizeof(raw_data.ifds) / sizeof(raw_data.ifds[0])) {
+  if (raw_data.ifd_count + 1 >= sizeof(raw_data.ifds) / sizeof(raw_data.ifds[0])) {
     fprintf(stderr, "Raw File IFD Count Exceeded\n");
     return false;
   }
@@ -177,6 +914,7 @@ bool RawImageData :: parse_raw_data_ifd(off_t raw_data_base) {
   }
 
   u_int n_tag_entries = read_2_bytes_unsigned(file, raw_data.bitorder);
+  plan_ifd_reads(raw_data_base, n_tag_entries);
   if (n_tag_entries != 0) {
     raw_data.ifds[ifd]._id = ifd;
     raw_data.ifds[ifd].n_tag_entries = n_tag_entries;
@@ -193,8 +931,9 @@ void RawImageData :: parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base) {
   u_int tag_id, tag_type, tag_count;
   off_t offset, tag_data_offset, tag_offset, sub_ifd_offset;
   get_tag_header(raw_data_base, &tag_id, &tag_type, &tag_count, &tag_offset);
-  printf("tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
+  DEBUG_PRINT("tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
   tag_data_offset = get_tag_data_offset(raw_data_base, tag_type, tag_count);
+  store_tag(Tag_Space::IFD, ifd, tag_id, tag_type, tag_count, tag_data_offset);
   
   file.seekg(tag_data_offset, std::ios::beg); // Jump to data offset
   switch(tag_id) {
@@ -219,12 +958,14 @@ void RawImageData :: parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base) {
       raw_data.ifds[ifd].frame.pinterpret = get_tag_value(tag_type);
       break;
     case 271: case 17:  // Make
-      file.read(raw_data.ifds[ifd].exif.camera_make, 64);
       break;
     case 272: case 18:  // Model
-      file.read(raw_data.ifds[ifd].exif.camera_model, 64);
       break;
     case 273: case 19:  // StripOffsets
+      raw_data.ifds[ifd].offsets_base = raw_data_base;
+      raw_data.ifds[ifd].strip_offsets_array = tag_data_offset;
+      raw_data.ifds[ifd].strip_offsets_type = tag_type;
+      raw_data.ifds[ifd].n_strips = tag_count;
       raw_data.ifds[ifd].data_offset = get_tag_value(tag_type) + raw_data_base;
       parse_strip_data(ifd, raw_data_base);
       break;
@@ -252,13 +993,11 @@ void RawImageData :: parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base) {
     case 296: case 42:  // ResolutionUnit
       break;
     case 305: case 51:  // Software
-      file.read(raw_data.ifds[ifd].exif.software, 64);
       break;
     case 306: case 52:  // DateTime
       parse_time_stamp(ifd);
       break;
     case 315: case 61:  // Artist
-      file.read(raw_data.ifds[ifd].exif.artist, 64);
       break;
     case 320: case 66:  // ColorMap
       break;
@@ -269,9 +1008,14 @@ void RawImageData :: parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base) {
       raw_data.ifds[ifd].frame.tile_length = get_tag_value(tag_type);
       break;
     case 324: case 70:  // TileOffsets
+      raw_data.ifds[ifd].offsets_base = raw_data_base;
+      raw_data.ifds[ifd].tile_offsets_array = tag_data_offset;
+      raw_data.ifds[ifd].tile_offsets_type = tag_type;
+      raw_data.ifds[ifd].n_tiles = tag_count;
       raw_data.ifds[ifd].tile_offset = get_tag_value(tag_type) + raw_data_base;
       break;
     case 325: case 71:  // TileByteCounts
+      raw_data.ifds[ifd].tile_byte_counts = get_tag_value(tag_type);
       break;
     case 330: case 76:  // SubIFDs
       while (tag_count--) {
@@ -302,9 +1046,14 @@ void RawImageData :: parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base) {
     case 33421:         // CFARepeatPatternDim
       break;
     case 33422:         // CFAPattern
+      if (tag_count == 4) {
+        raw_data.ifds[ifd].util.cfa = 0;
+        for (u_int i = 0; i < 8; i += 2) {
+          raw_data.ifds[ifd].util.cfa |= file.get() * BIT_MASK << i;
+        }
+      }
       break;
     case 33432:         // Copyright
-      file.read(raw_data.ifds[ifd].exif.copyright, 64);
       break;
     case 33434:         // ExposureTime
       raw_data.ifds[ifd].exif.exposure = get_tag_value(tag_type);
@@ -351,7 +1100,7 @@ bool RawImageData :: parse_strip_data(u_int ifd, off_t raw_data_base) {
     return false;
   }
   file.seekg(raw_data.ifds[ifd].data_offset, std::ios::beg);
-  if (parse_jpeg_info(file, &jpeg_info, true)) {
+  if (TIMED_STAGE(Parse_Stage::JPEG_SNIFF, parse_jpeg_info(file, &jpeg_info, true))) {
     // print_jpeg_info(&jpeg_info);
     raw_data.ifds[ifd].frame.compression = 6;
     raw_data.ifds[ifd].frame.width = jpeg_info.width;
@@ -365,15 +1114,18 @@ bool RawImageData :: parse_strip_data(u_int ifd, off_t raw_data_base) {
 }
 
 bool RawImageData :: parse_exif_data(u_int ifd, off_t raw_data_base) {
+  PARSE_STAGE(Parse_Stage::EXIF);
   u_int n_tag_entries, tag_id, tag_type, tag_count;
   off_t tag_data_offset, tag_offset;
 
   file.seekg(raw_data.ifds[ifd].exif.offset, std::ios::beg);
   n_tag_entries = read_2_bytes_unsigned(file, raw_data.bitorder);
+  plan_ifd_reads(raw_data_base, n_tag_entries);
   for (int i = 0; i < n_tag_entries; ++i) {
     get_tag_header(raw_data_base, &tag_id, &tag_type, &tag_count, &tag_offset);
-    printf("Exif tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
+    DEBUG_PRINT("Exif tag: %d type: %d count: %d offset: %d\n", tag_id, tag_type, tag_count, tag_offset);
     tag_data_offset = get_tag_data_offset(raw_data_base, tag_type, tag_count);
+    store_tag(Tag_Space::EXIF, ifd, tag_id, tag_type, tag_count, tag_data_offset);
     file.seekg(tag_data_offset, std::ios::beg);
 
     switch (tag_id) {
@@ -411,14 +1163,14 @@ bool RawImageData :: parse_exif_data(u_int ifd, off_t raw_data_base) {
         raw_data.ifds[ifd].exif.focal_length = get_tag_value(tag_type);
         break;
       case 0x927c:  // MakerNote
-        parse_makernote(ifd, raw_data_base, 0);
+        TIMED_STAGE(Parse_Stage::MAKERNOTE, parse_makernote(ifd, raw_data_base, 0));
         break;
       case 0x9286:  // UserComment
         break;
       case 0xa302:  // CFAPattern
         if (read_4_bytes_unsigned(file, raw_data.bitorder) == 0x20002) {
+          raw_data.ifds[ifd].util.cfa = 0;
           for (u_int i = 0; i < 8; i += 2) {
-            raw_data.ifds[ifd].util.cfa = i;
             raw_data.ifds[ifd].util.cfa |= file.get() * BIT_MASK << i;
           }
         }
@@ -434,30 +1186,72 @@ bool RawImageData :: parse_exif_data(u_int ifd, off_t raw_data_base) {
 bool RawImageData :: parse_gps_data(u_int ifd, off_t raw_data_base) {
   u_int n_tag_entries, tag_id, tag_type, tag_count;
   off_t tag_data_offset, tag_offset;
-  int data;
-  file.seekg(raw_data.ifds[ifd].exif.gps_offset, std::ios::beg);
+  exif_t& exif = raw_data.ifds[ifd].exif;
+  const TagStore& tags = raw_data.tags;
+  const tag_entry_t* entry;
+
+  file.seekg(exif.gps_offset, std::ios::beg);
   n_tag_entries = read_2_bytes_unsigned(file, raw_data.bitorder);
+  plan_ifd_reads(raw_data_base, n_tag_entries);
   for (int i = 0; i < n_tag_entries; ++i) {
     get_tag_header(raw_data_base, &tag_id, &tag_type, &tag_count, &tag_offset);
     tag_data_offset = get_tag_data_offset(raw_data_base, tag_type, tag_count);
-    file.seekg(tag_data_offset, std::ios::beg);
-    switch (tag_id) {
-      case 0:
-        for (u_int i = 0; i < 4; ++i) {
-          data = get_tag_value(tag_type);
-          printf("gps data: %d\n", data);
-        }
-        break;
-    
-      default:
-        break;
-    }
+    store_tag(Tag_Space::GPS, ifd, tag_id, tag_type, tag_count, tag_data_offset);
     file.seekg(tag_offset, std::ios::beg);
+  }
 
+  // Degrees, minutes and seconds as rationals, the reference gives the hemisphere
+  if ((entry = tags.find(Tag_Space::GPS, 1, ifd))) {       // GPSLatitudeRef
+    exif.gps_latitude_reference = tags.get_string(*entry)[0];
+  }
+  if ((entry = tags.find(Tag_Space::GPS, 2, ifd))) {       // GPSLatitude
+    exif.gps_latitude = tags.get_number(*entry, 0) + tags.get_number(*entry, 1) / 60 + tags.get_number(*entry, 2) / 3600;
+  }
+  if ((entry = tags.find(Tag_Space::GPS, 3, ifd))) {       // GPSLongitudeRef
+    exif.gps_longitude_reference = tags.get_string(*entry)[0];
+  }
+  if ((entry = tags.find(Tag_Space::GPS, 4, ifd))) {       // GPSLongitude
+    exif.gps_longitude = tags.get_number(*entry, 0) + tags.get_number(*entry, 1) / 60 + tags.get_number(*entry, 2) / 3600;
+  }
+  if ((entry = tags.find(Tag_Space::GPS, 6, ifd))) {       // GPSAltitude, GPSAltitudeRef 1: below sea level
+    exif.gps_altitude = tags.get_number(*entry);
+    if ((entry = tags.find(Tag_Space::GPS, 5, ifd)) && tags.get_number(*entry) == 1) {
+      exif.gps_altitude = -exif.gps_altitude;
+    }
   }
   return true;
 }
 
+/*
+ * Keeps the entry in raw_data.tags, with its value when the planner already
+ * read it (TAG_STORE_VALUE_BYTES). Leaves the file anywhere.
+ */
+void RawImageData :: store_tag(Tag_Space space, u_int ifd, u_int tag_id, u_int tag_type, u_int tag_count, off_t tag_data_offset) {
+  u_char value[TAG_STORE_VALUE_BYTES];
+  tag_entry_t entry;
+  entry.tag = tag_id;
+  entry.type = tag_type;
+  entry.count = tag_count;
+  entry.space = space;
+  entry.ifd = ifd;
+  entry.bitorder = raw_data.bitorder;
+  entry.offset = tag_data_offset;
+  entry.size = (u_int64_t)get_tag_type_bytes(tag_type) * tag_count;
+
+  if (entry.size > TAG_STORE_VALUE_BYTES) {
+    raw_data.tags.add(entry, nullptr);
+    return;
+  }
+  file.seekg(tag_data_offset, std::ios::beg);
+  file.read(reinterpret_cast<char*>(value), entry.size);
+  if (!file) {
+    file.clear();
+    raw_data.tags.add(entry, nullptr);
+    return;
+  }
+  raw_data.tags.add(entry, value);
+}
+
 bool RawImageData :: parse_time_stamp(u_int ifd) {
   // Proper date time format: " YYYY:MM:DD HH:MM:SS"
   file.read(raw_data.ifds[ifd].exif.date_time_str, 20);
@@ -479,6 +1273,57 @@ bool RawImageData :: parse_time_stamp(u_int ifd) {
   return true;
 }
 
+void RawImageData :: plan_ifd_reads(off_t raw_data_base, u_int n_tag_entries) {
+  static const u_int type_bytes[13] = {1,1,1,2,4,8,1,1,2,4,8,4,8};
+  u_int tag_id, tag_type, tag_count, value, size;
+  off_t entries;
+
+  if (planner == nullptr) {
+    return;
+  }
+
+  // Entry table follows, everything it points to goes in one wave
+  entries = file.tellg();
+  for (u_int i = 0; i < n_tag_entries && file; ++i) {
+    tag_id = read_2_bytes_unsigned(file, raw_data.bitorder);
+    tag_type = read_2_bytes_unsigned(file, raw_data.bitorder);
+    tag_count = read_4_bytes_unsigned(file, raw_data.bitorder);
+    value = read_4_bytes_unsigned(file, raw_data.bitorder);
+    size = (tag_type < 13 ? type_bytes[tag_type] : 1) * std::min(tag_count, 1u << 28);
+
+    switch (tag_id) {
+      case 34665:       // Exif IFD
+      case 34853:       // GPS IFD
+        planner->plan(value + raw_data_base, PLANNER_IFD_BYTES);
+        break;
+      case 330:         // SubIFDs, tables of an offset array come with the next wave
+        planner->plan(value + raw_data_base, tag_count == 1 ? PLANNER_IFD_BYTES : size);
+        break;
+      case 0x927c:      // MakerNote, header and its own IFD
+        planner->plan(value + raw_data_base, std::min(size, (u_int)PLANNER_IFD_BYTES + 18));
+        break;
+      case 700:         // XMP
+      case 33723:       // IPTC
+      case 34675:       // InterColorProfile
+      case 50831:       // AsShotICCProfile
+        break;          // Only located, not read
+      default:
+        if (size > 4) {
+          planner->plan(value + raw_data_base, std::min(size, (u_int)PLANNER_VALUE_BYTES));
+        }
+        break;
+    }
+  }
+  value = read_4_bytes_unsigned(file, raw_data.bitorder);
+  if (value != 0 && file) {
+    planner->plan(value + raw_data_base, PLANNER_IFD_BYTES);  // Next IFD
+  }
+
+  planner->fetch();
+  file.clear();
+  file.seekg(entries, std::ios::beg);
+}
+
 off_t RawImageData :: get_tag_data_offset(off_t raw_data_base, u_int tag_type, u_int tag_count) {
   u_int type_byte = 0;
   switch (tag_type) {
@@ -579,9 +1424,9 @@ void RawImageData :: print_data(bool rawFileData, bool rawTiffIfds) {
   printf("Raw Data Offset: %d\n", raw_data.main_ifd.data_offset);
 
   printf("\n================EXIF DATA===============\n");
-  printf("Camera Make: %s\n", raw_data.main_ifd.exif.camera_make);
-  printf("Camera Model: %s\n", raw_data.main_ifd.exif.camera_model);
-  printf("Software: %s\n", raw_data.main_ifd.exif.software);
+  printf("Camera Make: %s\n", raw_data.tags.get_string(Tag_Space::IFD, 271));
+  printf("Camera Model: %s\n", raw_data.tags.get_string(Tag_Space::IFD, 272));
+  printf("Software: %s\n", raw_data.tags.get_string(Tag_Space::IFD, 305));
   
   printf("Focal Length: %lf\n", raw_data.main_ifd.exif.focal_length);
   printf("Exposure: %lf\n", raw_data.main_ifd.exif.exposure);
@@ -591,11 +1436,11 @@ void RawImageData :: print_data(bool rawFileData, bool rawTiffIfds) {
   printf("Image Count: %d\n", raw_data.main_ifd.exif.image_count);
   printf("Shutter Count: %d\n", raw_data.main_ifd.exif.shutter_count);
 
-  printf("Artist: %s\n", raw_data.main_ifd.exif.artist);
-  printf("Copyright: %s\n", raw_data.main_ifd.exif.copyright);
+  printf("Artist: %s\n", raw_data.tags.get_string(Tag_Space::IFD, 315));
+  printf("Copyright: %s\n", raw_data.tags.get_string(Tag_Space::IFD, 33432));
   printf("Date time: %s\n", raw_data.main_ifd.exif.date_time_str); 
 
-  printf("Lens Model: %s\n", raw_data.main_ifd.exif.lens_info.lens_model);
+  printf("Lens Model: %s\n", raw_data.tags.get_string(Tag_Space::EXIF, 0xa434));
   printf("Lens Type: %d\n", raw_data.main_ifd.exif.lens_info.lens_type);
   printf("Lens Focal Length: Min %lf, Max %lf\n", raw_data.main_ifd.exif.lens_info.min_focal_length, raw_data.main_ifd.exif.lens_info.max_focal_length);
   printf("Lens Aperture F: Min %lf, Max %lf\n", raw_data.main_ifd.exif.lens_info.min_f_number, raw_data.main_ifd.exif.lens_info.max_f_number);
@@ -13,10 +13,34 @@
 
 #include "rawimagedata_utils.h"
 #include "jpegimagedata.h"
+#include "rawimage.h"
+#include "normalise.h"
+#include "demosaic.h"
+#include "colour.h"
+#include "image_stats.h"
+#include "pipeline.h"
+#include "read_planner.h"
+#include "stream_reader.h"
+#include "memory_reader.h"
+#include "parse_stats.h"
+#include "tag_store.h"
+#include "embedded_blob.h"
 
 #define COPY_IF_SET(dest, src, field) if (src.field[0] != 0) strcpy(dest.field, src.field)
 #define ASSIGN_IF_SET(dest, src, field) if (src.field != 0) dest.field = src.field
 
+struct decode_options_t {
+  Demosaic_Method demosaic = Demosaic_Method::AHD;
+  Output_Format format = Output_Format::RGB8;
+  Transfer_Curve curve = Transfer_Curve::SRGB;
+  ThreadPool* pool = &ThreadPool::shared();  // nullptr: run on the calling thread
+  bool half_size = false;     // One RGB pixel per 2x2 quad, no interpolation
+  bool apply_orientation = true;
+  image_stats_t* raw_stats = nullptr;     // Per CFA site, before normalisation
+  image_stats_t* output_stats = nullptr;  // Per channel of the output image
+  size_t memory_limit = 0;    // Image buffer bytes the decode may hold, 0: the parser's set_memory_limit()
+};
+
 class RawImageData {
 
 public:
@@ -62,7 +86,6 @@ protected:
 
   struct lens_t {
     bool set = false;
-    char lens_model[64] = { 0 };
     u_short lens_type = 0;
     double min_focal_length = 0;
     double max_focal_length = 0;
@@ -73,10 +96,7 @@ protected:
   struct exif_t {
     off_t offset = 0;
 
-    char camera_make[64] = { 0 };
-    char camera_model[64] = { 0 };
-    char software[64] = { 0 };
-
+    // Make, model, software, artist, copyright, lens model: lookups in raw_data.tags
     double focal_length = 0;
     double exposure = 0;
     double f_number = 0;
@@ -85,9 +105,6 @@ protected:
     u_int image_count = 0;
     u_int shutter_count = 0;
 
-    char artist[64] = { 0 };
-    char copyright[64] = { 0 };
-
     off_t icc_profile_offset = 0;
     u_int icc_profile_count = 0;
 
@@ -96,6 +113,7 @@ protected:
     double gps_latitude = 0;
     char gps_longitude_reference = 0;
     double gps_longitude = 0;
+    double gps_altitude = 0;    // Metres, negative below sea level
 
     time_t date_time = 0;
     char date_time_str[20] = { 0 };
@@ -125,8 +143,18 @@ protected:
     
     u_int strip_byte_counts = 0;
     u_int rows_per_strip = 0;
+    u_int tile_byte_counts = 0;
     u_int jpeg_if_length = 0;
 
+    // Strip and tile offset arrays, read on demand; the fields above hold the first entry
+    off_t offsets_base = 0;
+    off_t strip_offsets_array = 0;
+    u_int strip_offsets_type = 0;
+    u_int n_strips = 0;
+    off_t tile_offsets_array = 0;
+    u_int tile_offsets_type = 0;
+    u_int n_tiles = 0;
+
   };
 
   struct raw_data_t {
@@ -139,8 +167,12 @@ protected:
     raw_data_ifd_t ifds[8];       // IFDs
     raw_data_ifd_t main_ifd;      // Raw IFD
 
+    TagStore tags;                // Every entry read, IFD, EXIF, GPS and makernote
+
   } raw_data;
 
+  RawImage raw_image;             // Output of load_raw_data()
+
 private:
   /* Private Variables */
   enum class Raw_Tag_Type_Bytes {
@@ -166,24 +198,94 @@ private:
 public:
   /* Public Functions */
   RawImageData(const std::string& file_path);
-  ~RawImageData();
+  RawImageData(const void* data, size_t size);    // data must outlive the parser
+  RawImageData(const std::string& file_path, std::unique_ptr<StreamReader> stream);  // Pipe already read from, rewound here
+  virtual ~RawImageData();
 
+  bool open_raw();
   bool load_raw();
 
+  const RawImage& image() const;
+  RawImage take_image();
+  void set_image(const RawImage& image) { raw_image = image; }  // Raw buffer for decode(), which modifies it
+
+  // Parsed metadata as a value, set_metadata() stands in for open_raw() of the same file
+  typedef raw_data_t metadata_t;
+  const metadata_t& get_metadata() const { return raw_data; }
+  void set_metadata(const metadata_t& metadata) { raw_data = metadata; blobs_found = false; }
+  const TagStore& get_tags() const { return raw_data.tags; }
+  // ICC, XMP, IPTC, makernote and curve blobs as spans of the mapped file or caller memory, hashed once per parse
+  const std::vector<blob_t>& get_blobs();
+  bool get_blob(Blob_Kind kind, blob_t* blob);    // First of its kind, false if the file has none
+
+  bool decode(const decode_options_t& options, RawImage& output);
+  bool decode_region(u_int x, u_int y, u_int width, u_int height, const decode_options_t& options, RawImage& output);
+  // Runs on pipeline_options.pool when it is set away from the shared default, on options.pool otherwise
+  bool decode_bands(const decode_options_t& options, const pipeline_options_t& pipeline_options, const band_sink_t& sink);
+  int get_orientation() const;
+  const read_plan_stats_t& get_read_stats() const { return read_stats; }  // Metadata reads of open_raw()
+  bool is_streaming() const { return stream != nullptr; }
+  void set_stream_window(size_t bytes) { if (stream) stream->set_window(bytes); }
+  // Stage times and stream I/O since the last open_raw() (set is false when compiled out), image memory
+  parse_stats_t get_parse_stats() const;
+  void set_trace(TraceRecorder* recorder) { trace = recorder; }  // Adds every timed stage, nullptr: off
+  // Image buffer bytes this parser's decodes may hold, 0: no limit. Decodes over it fail before allocating
+  void set_memory_limit(size_t bytes) { memory_limit = bytes; }
+  size_t get_decode_bytes(const decode_options_t& options) const;   // Peak for decode(), from the frame geometry
+
+  bool normalise_raw();
+  bool demosaic_raw(const demosaic_options_t& options);
+  void get_white_balance(double wb_multi[3]);
+  bool get_camera_matrix(float rgb_cam[3][3]);
+  // Dumps the parsed metadata (and TIFF IFDs) to stdout, for debugging
+  void print_data(bool rawFileData, bool rawTiffIfds);
+
 protected:
+  ReadPlanner* planner = nullptr; // Serves the metadata parse in open_raw()
+  std::unique_ptr<StreamReader> stream;   // Set when the file cannot seek
+  std::unique_ptr<MemoryReader> memory;   // Set when parsing caller memory
+  const u_char* memory_data = nullptr;
+  size_t memory_size = 0;
+  std::unique_ptr<FileMapping> mapping;   // Mapped by the first get_blobs()
+  std::vector<blob_t> blobs;
+  bool blobs_found = false;               // Since the last open_raw() or set_metadata()
+  read_plan_stats_t read_stats;
+  std::unique_ptr<IoCounter> io_counter;  // Between the stream and its buffer, with RAWIMAGEDATA_INSTRUMENT
+  parse_stats_t parse_stats;
+  TraceRecorder* trace = nullptr;
+  std::shared_ptr<MemoryAccount> memory_account = std::make_shared<MemoryAccount>();
+  size_t memory_limit = 0;
+
   /* Protected Functions */
   virtual bool load_raw_data() = 0;
   bool raw_identify();
+  std::streambuf* set_read_buffer(std::streambuf* buffer);
+  void start_parse_stats();
+  bool check_memory(size_t limit, size_t bytes);
   bool apply_raw_data();
 
+  bool load_uncompressed_raw_data();
+  // Sequential (Huffman) decoders run from the stream start and stop after row_start + row_count
+  virtual bool load_raw_rows(RawImage& image, u_int row_start, u_int row_count);
+  bool unpack_raw_rows(RawImage& image, u_int row_start, u_int row_count);
+  bool unpack_raw_tiles(RawImage& image, u_int x, u_int y);
+  bool load_raw_rect(RawImage& image, u_int x, u_int y);
+  off_t get_raw_row_offset(u_int row, size_t row_bytes);
+  off_t get_offset_entry(off_t array, u_int type, u_int index);
+  bool load_raw_half_size(RawImage& output, image_stats_t* raw_stats = nullptr);
+  size_t get_raw_row_bytes();
+  void apply_image_info(RawImage& image);
+
   bool init_parse_raw(off_t raw_data_base);
   bool parse_raw_data(off_t raw_data_base);
   bool parse_raw_data_ifd(off_t raw_data_base);
   void parse_raw_data_ifd_tag(u_int ifd, off_t raw_data_base);
+  void store_tag(Tag_Space space, u_int ifd, u_int tag_id, u_int tag_type, u_int tag_count, off_t tag_data_offset);
   bool parse_exif_data(u_int ifd, off_t raw_data_base);
   bool parse_strip_data(u_int ifd, off_t raw_data_base);
   bool parse_gps_data(u_int ifd, off_t raw_data_base);
   bool parse_time_stamp(u_int ifd);
+  void plan_ifd_reads(off_t raw_data_base, u_int n_tag_entries);
 
   virtual bool parse_makernote(u_int ifd, off_t raw_data_base, int uptag) = 0;
 
@@ -191,7 +293,6 @@ protected:
   void get_tag_header(off_t raw_data_base, u_int *tag_id, u_int *tag_type, u_int *tag_count, off_t *tag_offset);
   double get_tag_value(u_int tag_type);
 
-  void print_data(bool rawFileData, bool rawTiffIfds);
 
 };
 
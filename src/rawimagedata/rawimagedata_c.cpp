@@ -0,0 +1,183 @@
+#include "rawimagedata_c.h"
+#include "decode_server.h"
+#include "cameras/camera_raw.h"
+
+struct rid_image {
+  std::unique_ptr<RawImageData> parser;
+  bool parsed = false;
+  RawImage output;
+};
+
+/* Called in a catch block. Nothing may unwind into C, so every entry point turns exceptions into its failure return */
+static void report_exception(const char* function) {
+  try {
+    throw;
+  } catch (const std::exception& error) {
+    fprintf(stderr, "ERROR: %s: %s\n", function, error.what());
+  } catch (...) {
+    fprintf(stderr, "ERROR: %s: Unknown exception\n", function);
+  }
+}
+
+static bool parse(rid_image* image) {
+  if (!image->parsed) {
+    image->parsed = image->parser->open_raw();
+  }
+  return image->parsed;
+}
+
+rid_image* rid_open_memory(const void* data, size_t size) {
+  if (data == nullptr || size == 0) {
+    return nullptr;
+  }
+  try {
+    std::unique_ptr<RawImageData> parser(open_camera_raw(data, size));
+    if (parser == nullptr) {
+      return nullptr;
+    }
+    rid_image* image = new rid_image();
+    image->parser = std::move(parser);
+    return image;
+  } catch (...) {
+    report_exception("rid_open_memory");
+    return nullptr;
+  }
+}
+
+rid_image* rid_open_file(const char* path) {
+  if (path == nullptr) {
+    return nullptr;
+  }
+  try {
+    std::unique_ptr<RawImageData> parser(open_camera_raw(std::string(path)));
+    if (parser == nullptr) {
+      return nullptr;
+    }
+    rid_image* image = new rid_image();
+    image->parser = std::move(parser);
+    return image;
+  } catch (...) {
+    report_exception("rid_open_file");
+    return nullptr;
+  }
+}
+
+int rid_get_metadata(rid_image* image, rid_metadata* metadata) {
+  decode_metadata_t summary;
+  if (image == nullptr || metadata == nullptr) {
+    return RID_ERROR_ARGUMENT;
+  }
+  try {
+    if (!parse(image)) {
+      return RID_ERROR_PARSE;
+    }
+    get_decode_metadata(image->parser->get_metadata(), &summary);
+  } catch (...) {
+    report_exception("rid_get_metadata");
+    return RID_ERROR_PARSE;
+  }
+
+  memset(metadata, 0, sizeof(*metadata));
+  memcpy(metadata->camera_make, summary.camera_make, sizeof(metadata->camera_make));
+  memcpy(metadata->camera_model, summary.camera_model, sizeof(metadata->camera_model));
+  memcpy(metadata->lens_model, summary.lens_model, sizeof(metadata->lens_model));
+  memcpy(metadata->date_time, summary.date_time, sizeof(metadata->date_time));
+  metadata->width = summary.width;
+  metadata->height = summary.height;
+  metadata->bps = summary.bps;
+  metadata->orientation = summary.orientation;
+  metadata->iso = summary.iso;
+  metadata->exposure = summary.exposure;
+  metadata->f_number = summary.f_number;
+  metadata->focal_length = summary.focal_length;
+  return RID_OK;
+}
+
+int rid_get_blob(rid_image* image, int32_t kind, rid_blob* blob) {
+  blob_t found;
+  if (image == nullptr || blob == nullptr || kind < 0 || kind >= (int32_t)Blob_Kind::COUNT) {
+    return RID_ERROR_ARGUMENT;
+  }
+  try {
+    if (!parse(image)) {
+      return RID_ERROR_PARSE;
+    }
+    if (!image->parser->get_blob((Blob_Kind)kind, &found)) {
+      return RID_ERROR_NOT_FOUND;
+    }
+  } catch (...) {
+    report_exception("rid_get_blob");
+    return RID_ERROR_PARSE;
+  }
+  blob->data = found.data;
+  blob->size = found.size;
+  blob->hash = found.hash;
+  return RID_OK;
+}
+
+void rid_default_decode_options(rid_decode_options* options) {
+  if (options == nullptr) {
+    return;
+  }
+  memset(options, 0, sizeof(*options));
+  try {
+    // The defaults start the shared thread pool
+    decode_options_t defaults;
+    options->demosaic = (int32_t)defaults.demosaic;
+    options->format = (int32_t)defaults.format;
+    options->curve = (int32_t)defaults.curve;
+    options->half_size = defaults.half_size;
+    options->apply_orientation = defaults.apply_orientation;
+  } catch (...) {
+    report_exception("rid_default_decode_options");   // Zeroed options are valid, the decode reports the failure
+  }
+}
+
+int rid_decode(rid_image* image, const rid_decode_options* options, rid_buffer* output) {
+  if (image == nullptr || options == nullptr || output == nullptr ||
+      options->demosaic < RID_DEMOSAIC_BILINEAR || options->demosaic > RID_DEMOSAIC_AHD ||
+      options->format < RID_FORMAT_RGB8 || options->format > RID_FORMAT_FLOAT ||
+      options->curve < RID_CURVE_SRGB || options->curve > RID_CURVE_LINEAR) {
+    return RID_ERROR_ARGUMENT;
+  }
+  try {
+    if (!parse(image)) {
+      return RID_ERROR_PARSE;
+    }
+  } catch (...) {
+    report_exception("rid_decode");
+    return RID_ERROR_PARSE;
+  }
+
+  // The handle keeps the pixels, the caller gets them in place
+  image->output = RawImage();
+  try {
+    decode_options_t decode_options;
+    decode_options.demosaic = (Demosaic_Method)options->demosaic;
+    decode_options.format = (Output_Format)options->format;
+    decode_options.curve = (Transfer_Curve)options->curve;
+    decode_options.half_size = options->half_size != 0;
+    decode_options.apply_orientation = options->apply_orientation != 0;
+    if (options->threads == 1) {
+      decode_options.pool = nullptr;
+    }
+    if (!image->parser->decode(decode_options, image->output)) {
+      return RID_ERROR_DECODE;
+    }
+  } catch (...) {
+    report_exception("rid_decode");
+    image->output = RawImage();
+    return RID_ERROR_DECODE;
+  }
+  output->data = image->output.row<u_char>(0);
+  output->width = image->output.width;
+  output->height = image->output.height;
+  output->channels = image->output.channels;
+  output->sample_bytes = image->output.sample_bytes;
+  output->stride = image->output.stride;
+  return RID_OK;
+}
+
+void rid_release(rid_image* image) {
+  delete image;
+}
@@ -0,0 +1,98 @@
+#ifndef RAWIMAGEDATA_C_H
+#define RAWIMAGEDATA_C_H
+
+/*
+ * C interface of the rawimagedata library. Handles own everything they
+ * return: metadata strings and decoded pixels stay valid until the next
+ * rid_decode() on the same handle or rid_release(). No C++ exception
+ * crosses this interface: one thrown inside, out of memory included, fails
+ * the call (nullptr from rid_open_*(), RID_ERROR_PARSE or RID_ERROR_DECODE).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RID_OK 0
+#define RID_ERROR_ARGUMENT -1
+#define RID_ERROR_PARSE -2
+#define RID_ERROR_DECODE -3
+#define RID_ERROR_NOT_FOUND -4
+
+/* Same values as Demosaic_Method, Output_Format and Transfer_Curve */
+#define RID_DEMOSAIC_BILINEAR 0
+#define RID_DEMOSAIC_PPG 1
+#define RID_DEMOSAIC_AHD 2
+#define RID_FORMAT_RGB8 0
+#define RID_FORMAT_RGB16 1
+#define RID_FORMAT_FLOAT 2
+#define RID_CURVE_SRGB 0
+#define RID_CURVE_LINEAR 1
+/* Same values as Blob_Kind */
+#define RID_BLOB_ICC_PROFILE 0
+#define RID_BLOB_XMP 1
+#define RID_BLOB_IPTC 2
+#define RID_BLOB_MAKERNOTE 3
+#define RID_BLOB_LINEARIZATION_TABLE 4
+#define RID_BLOB_CONTRAST_CURVE 5
+
+typedef struct rid_image rid_image;
+
+typedef struct {
+  char camera_make[64];
+  char camera_model[64];
+  char lens_model[64];
+  char date_time[20];
+  uint32_t width, height;       /* Sensor frame */
+  uint32_t bps;
+  int32_t orientation;          /* EXIF 1-8 */
+  double iso;
+  double exposure;              /* Seconds */
+  double f_number;
+  double focal_length;          /* mm */
+} rid_metadata;
+
+typedef struct {
+  int32_t demosaic;
+  int32_t format;
+  int32_t curve;
+  int32_t half_size;
+  int32_t apply_orientation;
+  int32_t threads;              /* 0: shared pool, 1: calling thread only */
+} rid_decode_options;
+
+/* Pixels in place: row y starts at data + y * stride */
+typedef struct {
+  const void* data;
+  uint32_t width, height;
+  uint32_t channels;
+  uint32_t sample_bytes;        /* 1, 2 or 4 (float) */
+  size_t stride;                /* Bytes */
+} rid_buffer;
+
+/* Embedded blob in place, in the mapped file or the memory given to rid_open_memory() */
+typedef struct {
+  const void* data;
+  size_t size;
+  uint64_t hash;                /* Equal for equal bytes, a key to share ICC transforms by */
+} rid_blob;
+
+/* Parses a raw file held in memory, which is not copied and must outlive the handle */
+rid_image* rid_open_memory(const void* data, size_t size);
+rid_image* rid_open_file(const char* path);
+
+int rid_get_metadata(rid_image* image, rid_metadata* metadata);
+/* RID_ERROR_NOT_FOUND when the file has no blob of that kind. Valid until rid_release() */
+int rid_get_blob(rid_image* image, int32_t kind, rid_blob* blob);
+void rid_default_decode_options(rid_decode_options* options);
+int rid_decode(rid_image* image, const rid_decode_options* options, rid_buffer* output);
+void rid_release(rid_image* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,8 @@
 
 #include "rawimagedata_utils.h"
+#include "cpu_dispatch.h"
+
+#include <stdlib.h>
 
 u_int8_t bit_order_1_byte(u_char *s, uint16_t bitorder) {
   if (bitorder == 0x4949) {
@@ -62,4 +65,27 @@ u_int32_t read_4_bytes_unsigned(std::ifstream& file, uint16_t bitorder) {
 
 int32_t read_4_byte_signed(std::ifstream& file, uint16_t bitorder) {
   return (int32_t)read_4_bytes_unsigned(file, bitorder);
-}
\ No newline at end of file
+}
+
+static std::atomic<bool>& get_debug_flag() {
+  static const char* env = getenv("RAWIMAGEDATA_DEBUG");
+  static std::atomic<bool> flag(env != nullptr && env[0] != 0 && strcmp(env, "0") != 0);
+  return flag;
+}
+
+void set_debug_output(bool enable) {
+  get_debug_flag() = enable;
+}
+
+bool get_debug_output() {
+  return get_debug_flag().load(std::memory_order_relaxed);
+}
+
+void unpack_16_bits(const u_char *s, u_int16_t *dest, size_t count, uint16_t bitorder) {
+  get_kernels().unpack_16_bits(s, dest, count, bitorder);
+}
+
+void unpack_bits_msb(const u_char *s, u_int16_t *dest, size_t count, u_int bps) {
+  // s must be readable for ceil(count * bps / 8) bytes
+  get_kernels().unpack_bits_msb(s, dest, count, bps);
+}
@@ -6,6 +6,7 @@
 #include <vector>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
 
 u_int8_t bit_order_1_byte(u_char *s, uint16_t bitorder);
 u_int8_t read_1_byte_unsigned(std::ifstream& file, uint16_t bitorder);
@@ -19,4 +20,16 @@ u_int32_t bit_order_4_bytes(u_char *s, uint16_t bitorder);
 u_int32_t read_4_bytes_unsigned(std::ifstream& file, uint16_t bitorder);
 int32_t read_4_byte_signed(std::ifstream& file, uint16_t bitorder);
 
+/*
+ * Parser debug output on stdout (tags, IFDs, makernote entries, JPEG
+ * markers). Off unless enabled here or RAWIMAGEDATA_DEBUG is set, so
+ * programs embedding the library keep stdout to themselves.
+ */
+void set_debug_output(bool enable);
+bool get_debug_output();
+#define DEBUG_PRINT(...) do { if (get_debug_output()) printf(__VA_ARGS__); } while (0)
+
+void unpack_16_bits(const u_char *s, u_int16_t *dest, size_t count, uint16_t bitorder);
+void unpack_bits_msb(const u_char *s, u_int16_t *dest, size_t count, u_int bps);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "read_planner.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+ReadPlanner :: ReadPlanner(const std::string& file_path) {
+  struct stat st;
+  fd = open(file_path.c_str(), O_RDONLY);
+  if (fd >= 0 && fstat(fd, &st) == 0) {
+    file_size = st.st_size;
+  }
+}
+
+ReadPlanner :: ~ReadPlanner() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void ReadPlanner :: plan(off_t offset, size_t length) {
+  off_t end = std::min(offset + (off_t)length, file_size);
+  if (offset < 0 || offset >= end) {
+    return;
+  }
+  // Skip what an earlier wave already holds
+  const range_t* range = find_range(offset);
+  if (range != nullptr && offset + (off_t)length <= range->offset + (off_t)range->data.size()) {
+    return;
+  }
+  pending.push_back(std::make_pair(offset, end));
+}
+
+bool ReadPlanner :: fetch() {
+  if (pending.empty()) {
+    return true;
+  }
+  off_t pos = tell();
+  std::sort(pending.begin(), pending.end());
+
+  size_t i = 0;
+  bool ok = true;
+  while (i < pending.size()) {
+    off_t begin = pending[i].first;
+    off_t end = pending[i].second;
+    for (++i; i < pending.size() && pending[i].first <= end + PLANNER_GAP_BYTES; ++i) {
+      end = std::max(end, pending[i].second);
+    }
+    ok = read_range(begin, end) != nullptr && ok;
+  }
+  pending.clear();
+  stats.waves++;
+
+  // Ranges moved, point the get area at the new copy
+  current = nullptr;
+  setg(nullptr, nullptr, nullptr);
+  position = pos;
+  return ok;
+}
+
+const ReadPlanner::range_t* ReadPlanner :: find_range(off_t offset) const {
+  // Last range starting at or before offset
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), offset,
+                             [](off_t value, const range_t& range) { return value < range.offset; });
+  if (it == ranges.begin()) {
+    return nullptr;
+  }
+  --it;
+  return offset < it->offset + (off_t)it->data.size() ? &*it : nullptr;
+}
+
+const ReadPlanner::range_t* ReadPlanner :: read_range(off_t begin, off_t end) {
+  range_t range;
+  range.offset = begin;
+  range.data.resize(end - begin);
+
+  size_t done = 0;
+  while (done < range.data.size()) {
+    ssize_t n = pread(fd, range.data.data() + done, range.data.size() - done, begin + done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  stats.requests++;
+  stats.bytes_read += done;
+  range.data.resize(done);
+  if (done == 0) {
+    return nullptr;
+  }
+
+  auto it = std::lower_bound(ranges.begin(), ranges.end(), begin,
+                             [](const range_t& range, off_t value) { return range.offset < value; });
+  it = ranges.insert(it, std::move(range));
+  return &*it;
+}
+
+off_t ReadPlanner :: tell() const {
+  if (current != nullptr) {
+    return current->offset + (gptr() - eback());
+  }
+  return position;
+}
+
+std::streambuf::int_type ReadPlanner :: underflow() {
+  off_t pos = tell();
+  const range_t* range = find_range(pos);
+
+  if (range == nullptr) {
+    if (pos >= file_size) {
+      return traits_type::eof();
+    }
+    off_t begin = pos & ~(off_t)(PLANNER_MISS_BYTES - 1);
+    off_t end = std::min(begin + PLANNER_MISS_BYTES, file_size);
+    // Stop short of the next fetched range instead of reading it twice
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), pos,
+                                 [](off_t value, const range_t& range) { return value < range.offset; });
+    if (next != ranges.end()) {
+      end = std::min(end, next->offset);
+    }
+    if (next != ranges.begin()) {
+      auto prev = next - 1;
+      begin = std::max(begin, prev->offset + (off_t)prev->data.size());
+    }
+    stats.misses++;
+    range = read_range(begin, end);
+    if (range == nullptr) {
+      return traits_type::eof();
+    }
+  }
+
+  current = range;
+  char* data = const_cast<char*>(range->data.data());
+  setg(data, data + (pos - range->offset), data + range->data.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streambuf::pos_type ReadPlanner :: seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) {
+  off_t pos;
+  if (dir == std::ios::beg) {
+    pos = offset;
+  } else if (dir == std::ios::cur) {
+    pos = tell() + offset;
+  } else {
+    pos = file_size + offset;
+  }
+  return seekpos(pos, mode);
+}
+
+std::streambuf::pos_type ReadPlanner :: seekpos(pos_type pos, std::ios::openmode) {
+  if (pos < 0) {
+    return pos_type(off_type(-1));
+  }
+  // Stay in the current range when possible, the parser seeks back and forth a lot
+  if (current != nullptr && pos >= current->offset && pos < current->offset + (off_t)current->data.size()) {
+    setg(eback(), eback() + ((off_t)pos - current->offset), egptr());
+    return pos;
+  }
+  current = nullptr;
+  setg(nullptr, nullptr, nullptr);
+  position = pos;
+  return pos;
+}
@@ -0,0 +1,69 @@
+#ifndef READ_PLANNER_H
+#define READ_PLANNER_H
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define PLANNER_GAP_BYTES (16 << 10)    // Ranges closer than this are read as one
+#define PLANNER_MISS_BYTES 4096         // Read size for an offset no wave covered
+#define PLANNER_VALUE_BYTES 256         // Most of an out-of-line tag value the parser reads
+#define PLANNER_IFD_BYTES (2 + 12 * 48 + 4)  // Entry count, 48 entries and next IFD
+
+struct read_plan_stats_t {
+  size_t bytes_read = 0;
+  u_int requests = 0;     // Read calls (each coalesced range or miss)
+  u_int waves = 0;        // Batches of planned ranges
+  u_int misses = 0;       // Reads for offsets no wave covered
+};
+
+/*
+ * Stream buffer that serves metadata parsing from ranges read in waves.
+ * The parser plans every offset it knows it will visit (out-of-line tag
+ * values, EXIF/GPS/SubIFD/makernote tables, next IFD) and fetch() reads the
+ * wave as sorted, coalesced ranges with one pread each. Reads outside any
+ * fetched range fall back to a small aligned read, so a missed plan costs
+ * a round trip, never correctness.
+ */
+class ReadPlanner : public std::streambuf {
+
+public:
+  ReadPlanner(const std::string& file_path);
+  ~ReadPlanner();
+
+  bool is_open() const { return fd >= 0; }
+
+  void plan(off_t offset, size_t length);
+  bool fetch();
+
+  const read_plan_stats_t& get_stats() const { return stats; }
+
+protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) override;
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override;
+
+private:
+  struct range_t {
+    off_t offset;
+    std::vector<char> data;
+  };
+
+  int fd = -1;
+  off_t file_size = 0;
+  off_t position = 0;                               // Position when no range is current
+  const range_t* current = nullptr;                 // Range the get area points into
+  std::vector<range_t> ranges;                      // Fetched, sorted by offset
+  std::vector<std::pair<off_t, off_t>> pending;     // Planned [begin, end) not yet fetched
+  read_plan_stats_t stats;
+
+  off_t tell() const;
+  const range_t* find_range(off_t offset) const;
+  const range_t* read_range(off_t begin, off_t end);
+
+};
+
+#endif
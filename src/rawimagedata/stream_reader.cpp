@@ -0,0 +1,122 @@
+#include "stream_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+StreamReader :: StreamReader(int fd, size_t window_bytes) : fd(fd), window_bytes(window_bytes) {}
+
+StreamReader :: ~StreamReader() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void StreamReader :: pin() {
+  pinned_end = received;
+  held_bytes = 0;
+}
+
+off_t StreamReader :: tell() const {
+  if (eback() != nullptr) {
+    return current_offset + (gptr() - eback());
+  }
+  return position;
+}
+
+bool StreamReader :: receive() {
+  if (at_end) {
+    return false;
+  }
+  if (chunks.empty() || chunks.back().size == STREAM_CHUNK_BYTES || chunks.back().offset + (off_t)chunks.back().size != received) {
+    chunk_t chunk;
+    chunk.offset = received;
+    chunk.size = 0;
+    chunk.data.reset(new char[STREAM_CHUNK_BYTES]);
+    chunks.push_back(std::move(chunk));
+  }
+
+  // One read: whatever has arrived, so the parser can go on as soon as its bytes are in
+  chunk_t& chunk = chunks.back();
+  ssize_t n;
+  do {
+    n = read(fd, chunk.data.get() + chunk.size, STREAM_CHUNK_BYTES - chunk.size);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    if (n < 0) {
+      fprintf(stderr, "ERROR: Stream read failed at %ld\n", (long)received);
+    }
+    at_end = true;
+    return false;
+  }
+  chunk.size += n;
+  received += n;
+  if (chunk.offset >= pinned_end) {
+    held_bytes += n;
+  }
+
+  // Drop the oldest unpinned chunks past the window, never the one being filled
+  off_t pos = tell();
+  while (held_bytes > window_bytes) {
+    auto it = std::find_if(chunks.begin(), chunks.end(), [this](const chunk_t& c) { return c.offset >= pinned_end; });
+    if (it == chunks.end() || it + 1 == chunks.end()) {
+      break;
+    }
+    if (eback() == it->data.get()) {
+      setg(nullptr, nullptr, nullptr);
+      position = pos;
+    }
+    held_bytes -= it->size;
+    chunks.erase(it);
+  }
+  return true;
+}
+
+const StreamReader::chunk_t* StreamReader :: find_chunk(off_t offset) const {
+  auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+                             [](off_t value, const chunk_t& chunk) { return value < chunk.offset; });
+  if (it == chunks.begin()) {
+    return nullptr;
+  }
+  --it;
+  return offset < it->offset + (off_t)it->size ? &*it : nullptr;
+}
+
+std::streambuf::int_type StreamReader :: underflow() {
+  off_t pos = tell();
+
+  // Forward offsets resolve as their bytes arrive
+  while (pos >= received) {
+    if (!receive()) {
+      return traits_type::eof();
+    }
+  }
+  const chunk_t* chunk = find_chunk(pos);
+  if (chunk == nullptr) {
+    fprintf(stderr, "ERROR: Stream offset %ld is behind the %zu byte window\n", (long)pos, window_bytes);
+    return traits_type::eof();
+  }
+
+  current_offset = chunk->offset;
+  setg(chunk->data.get(), chunk->data.get() + (pos - chunk->offset), chunk->data.get() + chunk->size);
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streambuf::pos_type StreamReader :: seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) {
+  if (dir == std::ios::beg) {
+    return seekpos(offset, mode);
+  }
+  if (dir == std::ios::cur) {
+    return seekpos(tell() + offset, mode);
+  }
+  return pos_type(off_type(-1));  // Size unknown until the stream ends
+}
+
+std::streambuf::pos_type StreamReader :: seekpos(pos_type pos, std::ios::openmode) {
+  if (pos < 0) {
+    return pos_type(off_type(-1));
+  }
+  setg(nullptr, nullptr, nullptr);
+  position = pos;
+  return pos;
+}
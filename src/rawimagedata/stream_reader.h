@@ -0,0 +1,64 @@
+#ifndef STREAM_READER_H
+#define STREAM_READER_H
+
+#include <iostream>
+#include <streambuf>
+#include <deque>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define STREAM_CHUNK_BYTES (1 << 20)
+#define STREAM_WINDOW_BYTES (64 << 20)
+
+/*
+ * Stream buffer over a pipe or socket that cannot seek. Bytes are taken in
+ * order as the parser asks for them and kept in 1 MB chunks: seeking
+ * forward reads up to the offset, seeking back works while the bytes are
+ * still held. Chunks past the window are dropped oldest first, except the
+ * pinned head (the metadata region, pinned once open_raw() is done), so
+ * offset tables stay readable while the raw data streams through.
+ */
+class StreamReader : public std::streambuf {
+
+public:
+  StreamReader(int fd, size_t window_bytes = STREAM_WINDOW_BYTES);
+  ~StreamReader();
+
+  void set_window(size_t bytes) { window_bytes = bytes; }
+  void pin();                     // Keeps everything received so far
+
+  off_t get_bytes_received() const { return received; }
+  bool is_at_end() const { return at_end; }
+
+protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type offset, std::ios::seekdir dir, std::ios::openmode mode) override;
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override;
+
+private:
+  struct chunk_t {
+    off_t offset;
+    size_t size;
+    std::unique_ptr<char[]> data;
+  };
+
+  int fd;
+  size_t window_bytes;
+  std::deque<chunk_t> chunks;     // Held bytes in stream order, gaps where chunks were dropped
+  off_t pinned_end = 0;           // Chunks starting before this are never dropped
+  size_t held_bytes = 0;          // Bytes in chunks that may be dropped
+  off_t received = 0;
+  bool at_end = false;
+
+  off_t position = 0;             // Position when the get area is empty
+  off_t current_offset = 0;       // Stream offset of eback()
+
+  off_t tell() const;
+  bool receive();
+  const chunk_t* find_chunk(off_t offset) const;
+
+};
+
+#endif
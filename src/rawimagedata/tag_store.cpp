@@ -0,0 +1,125 @@
+#include "tag_store.h"
+#include "rawimagedata_utils.h"
+
+static const u_int TYPE_BYTES[13] = {1,1,1,2,4,8,1,1,2,4,8,4,8};
+static const char EMPTY_STRING[1] = { 0 };
+
+u_int get_tag_type_bytes(u_int type) {
+  return type < 13 ? TYPE_BYTES[type] : 1;
+}
+
+TagStore :: TagStore() {
+  entries.reserve(TAG_STORE_ENTRIES);
+  arena.reserve(TAG_STORE_ARENA_BYTES);
+}
+
+size_t TagStore :: get_heap_bytes() const {
+  return entries.capacity() * sizeof(tag_entry_t) + arena.capacity();
+}
+
+void TagStore :: clear() {
+  entries.clear();
+  arena.clear();
+}
+
+void TagStore :: add(const tag_entry_t& entry, const u_char* value) {
+  entries.push_back(entry);
+  tag_entry_t& added = entries.back();
+  added.stored = value != nullptr && entry.size <= TAG_STORE_VALUE_BYTES;
+  if (!added.stored) {
+    return;
+  }
+  // A NUL after every value, so ASCII is a C string in place
+  added.data = arena.size();
+  arena.insert(arena.end(), value, value + entry.size);
+  arena.push_back(0);
+}
+
+const tag_entry_t* TagStore :: find(Tag_Space space, u_int tag, int ifd) const {
+  for (const tag_entry_t& entry : entries) {
+    if (entry.tag == tag && entry.space == space && (ifd < 0 || entry.ifd == ifd)) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const u_char* TagStore :: get_bytes(const tag_entry_t& entry) const {
+  return entry.stored ? arena.data() + entry.data : nullptr;
+}
+
+double TagStore :: get_number(const tag_entry_t& entry, u_int index) const {
+  u_int bytes = get_tag_type_bytes(entry.type);
+  int64_t numerator, denominator;
+  u_char value[8];
+  if (!entry.stored || index >= entry.count) {
+    return 0;
+  }
+  memcpy(value, get_bytes(entry) + (size_t)index * bytes, bytes);
+
+  switch (entry.type) {
+    case 3: // SHORT
+      return bit_order_2_bytes(value, entry.bitorder);
+    case 4: // LONG
+      return bit_order_4_bytes(value, entry.bitorder);
+    case 5: // RATIONAL
+    case 10:// SRATIONAL
+      get_rational(entry, index, &numerator, &denominator);
+      return denominator ? (double)numerator / denominator : 0;
+    case 6: // SBYTE
+      return (int8_t)value[0];
+    case 8: // SSHORT
+      return (int16_t)bit_order_2_bytes(value, entry.bitorder);
+    case 9: // SLONG
+      return (int32_t)bit_order_4_bytes(value, entry.bitorder);
+    case 11:// FLOAT
+    {
+      u_int32_t bits = bit_order_4_bytes(value, entry.bitorder);
+      float number;
+      memcpy(&number, &bits, sizeof(number));
+      return number;
+    }
+    case 12:// DOUBLE
+    {
+      u_int64_t bits = (u_int64_t)bit_order_4_bytes(value, entry.bitorder) << 32 | bit_order_4_bytes(value + 4, entry.bitorder);
+      if (entry.bitorder == 0x4949) {
+        bits = bits << 32 | bits >> 32;
+      }
+      double number;
+      memcpy(&number, &bits, sizeof(number));
+      return number;
+    }
+    default:// BYTE, ASCII, UNDEFINED
+      return value[0];
+  }
+}
+
+bool TagStore :: get_rational(const tag_entry_t& entry, u_int index, int64_t* numerator, int64_t* denominator) const {
+  u_char value[8];
+  if (!entry.stored || index >= entry.count || (entry.type != 5 && entry.type != 10)) {
+    return false;
+  }
+  memcpy(value, get_bytes(entry) + (size_t)index * 8, 8);
+  if (entry.type == 5) {
+    *numerator = bit_order_4_bytes(value, entry.bitorder);
+    *denominator = bit_order_4_bytes(value + 4, entry.bitorder);
+  } else {
+    *numerator = (int32_t)bit_order_4_bytes(value, entry.bitorder);
+    *denominator = (int32_t)bit_order_4_bytes(value + 4, entry.bitorder);
+  }
+  return true;
+}
+
+const char* TagStore :: get_string(const tag_entry_t& entry) const {
+  return entry.stored ? reinterpret_cast<const char*>(get_bytes(entry)) : EMPTY_STRING;
+}
+
+double TagStore :: get_number(Tag_Space space, u_int tag, u_int index, double fallback) const {
+  const tag_entry_t* entry = find(space, tag);
+  return entry != nullptr && entry->stored && index < entry->count ? get_number(*entry, index) : fallback;
+}
+
+const char* TagStore :: get_string(Tag_Space space, u_int tag) const {
+  const tag_entry_t* entry = find(space, tag);
+  return entry != nullptr ? get_string(*entry) : EMPTY_STRING;
+}
@@ -0,0 +1,73 @@
+#ifndef TAG_STORE_H
+#define TAG_STORE_H
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+#define TAG_STORE_VALUE_BYTES 256     // Larger values stay in the file as a span, as PLANNER_VALUE_BYTES
+#define TAG_STORE_ENTRIES 512         // Capacity reserved up front, kept across parses
+#define TAG_STORE_ARENA_BYTES (16 << 10)
+
+enum class Tag_Space : u_int8_t {
+  IFD,          // TIFF IFDs and SubIFDs
+  EXIF,
+  GPS,
+  MAKERNOTE
+};
+
+/* One directory entry as the parser read it */
+struct tag_entry_t {
+  u_int16_t tag = 0;
+  u_int16_t type = 0;
+  u_int32_t count = 0;
+  Tag_Space space = Tag_Space::IFD;
+  u_int8_t ifd = 0;             // Index in raw_data.ifds of the directory it was read with
+  u_int16_t bitorder = 0x4949;  // Of the value, a makernote can differ from the file
+  bool stored = false;          // Value copied to the arena, otherwise only its span is known
+  off_t offset = 0;             // Of the value in the file
+  u_int64_t size = 0;           // count * type bytes
+  u_int32_t data = 0;           // Of the value in the arena, when stored
+};
+
+u_int get_tag_type_bytes(u_int type);
+
+/*
+ * Every IFD, EXIF, GPS and makernote entry of a parse, in the order read.
+ * Values up to TAG_STORE_VALUE_BYTES are copied to one arena, NUL padded;
+ * the rest (ICC, XMP, makernote, offset arrays) are spans of the file.
+ * Numbers, rationals and strings are decoded on lookup. clear() keeps the
+ * capacity, so a reused parser stores tags without allocating.
+ */
+class TagStore {
+
+public:
+  TagStore();
+
+  void clear();
+  void add(const tag_entry_t& entry, const u_char* value);    // value: entry.size bytes, nullptr: span only
+
+  size_t size() const { return entries.size(); }
+  const tag_entry_t& operator[](size_t i) const { return entries[i]; }
+  const tag_entry_t* find(Tag_Space space, u_int tag, int ifd = -1) const;   // First read, ifd -1: any
+
+  const u_char* get_bytes(const tag_entry_t& entry) const;   // nullptr: not stored
+  double get_number(const tag_entry_t& entry, u_int index = 0) const;
+  bool get_rational(const tag_entry_t& entry, u_int index, int64_t* numerator, int64_t* denominator) const;
+  const char* get_string(const tag_entry_t& entry) const;    // "" when not stored
+
+  // Lookups by id, fallback or "" when the tag was not read
+  double get_number(Tag_Space space, u_int tag, u_int index = 0, double fallback = 0) const;
+  const char* get_string(Tag_Space space, u_int tag) const;
+
+  size_t get_heap_bytes() const;    // Entries and arena as allocated
+
+private:
+  std::vector<tag_entry_t> entries;
+  std::vector<u_char> arena;
+
+};
+
+#endif
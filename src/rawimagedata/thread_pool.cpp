@@ -0,0 +1,174 @@
+#include "thread_pool.h"
+
+// Failed attempts to find a task before a waiter parks
+#define WAIT_SPINS 64
+#define WAIT_PARK_MS 10
+
+// Index of the pool worker running on this thread, -1 outside the pool
+static thread_local int worker_index = -1;
+static thread_local const ThreadPool* worker_pool = nullptr;
+
+ThreadPool :: ThreadPool(u_int n_threads) : stop(false), n_pending(0), next_queue(0), n_waiting(0) {
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (u_int i = 0; i < n_threads; ++i) {
+    queues.emplace_back(new worker_queue_t);
+  }
+  for (u_int i = 0; i < n_threads; ++i) {
+    threads.emplace_back(&ThreadPool::worker_loop, this, i);
+  }
+}
+
+ThreadPool :: ~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool :: submit(std::function<void()> task) {
+  u_int index;
+  if (worker_pool == this) {
+    index = worker_index;   // Keep nested work local to the worker
+  } else {
+    index = next_queue++ % queues.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    n_pending++;
+  }
+  try {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    queues[index]->tasks.push_back(std::move(task));
+  } catch (...) {
+    n_pending--;
+    throw;
+  }
+  wake.notify_one();
+  notify_waiters();   // A parked waiter can help with it
+}
+
+void ThreadPool :: parallel_for(u_int begin, u_int end, const std::function<void(u_int)>& fn) {
+  if (begin >= end) return;
+  if (end - begin == 1) {
+    fn(begin);
+    return;
+  }
+
+  // An exception must not leave a worker, the first one is thrown here once every task is done
+  std::atomic<u_int> remaining(end - begin);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  u_int i = begin;
+  try {
+    for (; i < end; ++i) {
+      submit([&fn, &remaining, &error_mutex, &error, i]() {
+        try {
+          fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!error) error = std::current_exception();
+        }
+        remaining--;
+      });
+    }
+  } catch (...) {
+    // The queued tasks still hold references to this frame
+    remaining -= end - i;
+    wait_until([&remaining]() { return remaining.load() == 0; });
+    throw;
+  }
+
+  wait_until([&remaining]() { return remaining.load() == 0; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void ThreadPool :: wait_until(const std::function<bool()>& done) {
+  // Help out instead of blocking
+  u_int self = worker_pool == this ? worker_index : 0;
+  u_int spins = 0;
+  while (!done()) {
+    if (run_one(self)) {
+      spins = 0;
+    } else if (++spins < WAIT_SPINS) {
+      std::this_thread::yield();
+    } else {
+      // Nothing queued, sleep until a task is queued or finishes (the timeout is only a backstop)
+      std::unique_lock<std::mutex> lock(wait_mutex);
+      n_waiting++;
+      task_event.wait_for(lock, std::chrono::milliseconds(WAIT_PARK_MS), [&]() { return n_pending.load() != 0 || done(); });
+      n_waiting--;
+      spins = 0;
+    }
+  }
+}
+
+void ThreadPool :: notify_waiters() {
+  if (n_waiting.load() != 0) {
+    // Taking the lock orders this after a waiter's check of done()
+    { std::lock_guard<std::mutex> lock(wait_mutex); }
+    task_event.notify_all();
+  }
+}
+
+ThreadPool& ThreadPool :: shared() {
+  // The thread waiting on a parallel_for() makes up the last core
+  static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+  return pool;
+}
+
+bool ThreadPool :: pop_task(u_int index, std::function<void()>* task) {
+  // Own queue from the back (LIFO, cache warm)
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    if (!queues[index]->tasks.empty()) {
+      *task = std::move(queues[index]->tasks.back());
+      queues[index]->tasks.pop_back();
+      return true;
+    }
+  }
+  // Steal from the front of the others (FIFO, oldest and largest first)
+  for (u_int i = 1; i < queues.size(); ++i) {
+    worker_queue_t* victim = queues[(index + i) % queues.size()].get();
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    if (!victim->tasks.empty()) {
+      *task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool :: run_one(u_int index) {
+  std::function<void()> task;
+  if (!pop_task(index, &task)) {
+    return false;
+  }
+  n_pending--;
+  task();
+  notify_waiters();
+  return true;
+}
+
+void ThreadPool :: worker_loop(u_int index) {
+  worker_index = index;
+  worker_pool = this;
+  while (true) {
+    if (run_one(index)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    wake.wait(lock, [this]() { return stop || n_pending.load() != 0; });
+    if (stop && n_pending.load() == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <sys/types.h>
+
+/*
+ * Work-stealing thread pool. Every worker owns a deque: it pushes and pops
+ * its own tasks at the back and steals from the front of the others when it
+ * runs dry. Threads waiting on a parallel_for() help run queued tasks, so
+ * nested parallel stages cannot deadlock the pool. With nothing left to
+ * run, a waiter spins briefly and then sleeps until a task is queued or
+ * finishes, so it does not hold a core while the last tasks run elsewhere.
+ *
+ * shared() is the process-wide instance every stage defaults to, so nested
+ * and concurrent decodes share one set of threads instead of each starting
+ * their own.
+ */
+class ThreadPool {
+
+public:
+  ThreadPool(u_int n_threads = 0);
+  ~ThreadPool();
+
+  void submit(std::function<void()> task);
+  // Returns when every call is done, then rethrows the first exception one of them threw
+  void parallel_for(u_int begin, u_int end, const std::function<void(u_int)>& fn);
+  // done() is checked after each task finishes, it must read what the tasks wrote through atomics or a lock
+  void wait_until(const std::function<bool()>& done);
+
+  u_int size() const { return threads.size(); }
+
+  static ThreadPool& shared();
+
+private:
+  struct worker_queue_t {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_queue_t>> queues;
+  std::vector<std::thread> threads;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stop;
+  std::atomic<size_t> n_pending;
+  std::atomic<u_int> next_queue;
+
+  std::mutex wait_mutex;      // Threads parked in wait_until()
+  std::condition_variable task_event;
+  std::atomic<u_int> n_waiting;
+
+  void worker_loop(u_int index);
+  bool run_one(u_int index);
+  bool pop_task(u_int index, std::function<void()>* task);
+  void notify_waiters();
+
+};
+
+#endif
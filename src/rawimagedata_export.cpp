@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "rawimagedata/metadata_export.h"
+
+int main(int argc, char** argv) {
+  std::vector<std::string> paths;
+  export_options_t options;
+  char line[4096];
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s OUTPUT.arrow [FILE...]   (paths from stdin, one per line, when no FILE is given)\n", argv[0]);
+    return 2;
+  }
+  for (int i = 2; i < argc; ++i) {
+    paths.push_back(argv[i]);
+  }
+  if (argc == 2) {
+    while (fgets(line, sizeof(line), stdin) != nullptr) {
+      line[strcspn(line, "\r\n")] = 0;
+      if (line[0] != 0) {
+        paths.push_back(line);
+      }
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool ok = export_metadata(paths, argv[1], options);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%zu files in %.2f s%s\n", paths.size(), seconds, ok ? "" : ", export failed");
+  return ok ? 0 : 1;
+}